@@ -0,0 +1,154 @@
+//! Classification of the clang command line.
+//!
+//! Only a final link produces a module that Snapify and Asyncify can run on. Object files,
+//! assembly and preprocessed output are produced by clang alone, so large projects can compile
+//! translation units in parallel (`-c`) and run the wasm-opt pipeline once on the linked module.
+
+use std::path::PathBuf;
+
+use anyhow::Error;
+
+/// Flag marking an explicit link step (`kafu clang --link a.o b.o -o app.wasm`).
+pub(crate) const LINK_FLAG: &str = "--link";
+
+/// Clang flag enabling Wasm SIMD128. It is on by default and can be turned off with
+/// `-mno-simd128`.
+pub(crate) const SIMD_FLAG: &str = "-msimd128";
+
+/// Clang flags that stop before linking.
+const COMPILE_ONLY_FLAGS: &[&str] = &["-c", "-S", "-E", "-M", "-MM", "-fsyntax-only"];
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub(crate) enum Mode {
+    /// Clang produces no linked module; its output is used as is.
+    CompileOnly,
+    /// Clang links a module, which then goes through Snapify and Asyncify.
+    Link,
+}
+
+/// Rejects flags that build wasi-threads modules, which the runtime cannot migrate.
+pub(crate) fn ensure_single_threaded(args: &[String]) -> Result<(), Error> {
+    let threaded = args.iter().find(|arg| {
+        matches!(arg.as_str(), "-pthread" | "-pthreads") || arg.contains("wasm32-wasip1-threads")
+    });
+    match threaded {
+        Some(arg) => Err(anyhow::anyhow!(
+            "{arg}: wasi-threads modules are not supported by Kafu (a snapshot captures a single thread)"
+        )),
+        None => Ok(()),
+    }
+}
+
+/// Determines the mode and removes [`LINK_FLAG`] from `args`.
+pub(crate) fn take_mode(args: &mut Vec<String>) -> Result<Mode, Error> {
+    let len = args.len();
+    args.retain(|arg| arg != LINK_FLAG);
+    let explicit_link = args.len() != len;
+
+    let compile_only = args
+        .iter()
+        .find(|arg| COMPILE_ONLY_FLAGS.contains(&arg.as_str()));
+    match (compile_only, explicit_link) {
+        (Some(flag), true) => Err(anyhow::anyhow!(
+            "{LINK_FLAG} cannot be combined with {flag}"
+        )),
+        (Some(_), false) => Ok(Mode::CompileOnly),
+        (None, _) => Ok(Mode::Link),
+    }
+}
+
+/// Removes the output flag (`-o <file>` or `-o<file>`) from `args` and returns its path.
+pub(crate) fn take_output(args: &mut Vec<String>) -> Option<PathBuf> {
+    let index = args
+        .iter()
+        .position(|arg| arg.starts_with("-o") && !arg.starts_with("-obj"))?;
+    let arg = args.remove(index);
+    if arg == "-o" {
+        (index < args.len()).then(|| PathBuf::from(args.remove(index)))
+    } else {
+        Some(PathBuf::from(&arg[2..]))
+    }
+}
+
+/// Returns the wasm-opt flags enabling the SIMD features selected by the clang flags.
+///
+/// The last flag wins, as in clang; relaxed SIMD implies SIMD.
+pub(crate) fn wasm_opt_simd_flags(args: &[String]) -> Vec<&'static str> {
+    let mut simd = true;
+    let mut relaxed_simd = false;
+    for arg in args {
+        match arg.as_str() {
+            SIMD_FLAG => simd = true,
+            "-mno-simd128" => (simd, relaxed_simd) = (false, false),
+            "-mrelaxed-simd" => (simd, relaxed_simd) = (true, true),
+            "-mno-relaxed-simd" => relaxed_simd = false,
+            _ => {}
+        }
+    }
+    let mut flags = Vec::new();
+    if simd {
+        flags.push("--enable-simd");
+    }
+    if relaxed_simd {
+        flags.push("--enable-relaxed-simd");
+    }
+    flags
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn args(args: &[&str]) -> Vec<String> {
+        args.iter().map(|arg| arg.to_string()).collect()
+    }
+
+    #[test]
+    fn detects_compile_only_invocations() {
+        let mut compile = args(&["-c", "a.c", "-o", "a.o"]);
+        assert_eq!(take_mode(&mut compile).unwrap(), Mode::CompileOnly);
+
+        let mut link = args(&["--link", "a.o", "b.o", "-o", "app.wasm"]);
+        assert_eq!(take_mode(&mut link).unwrap(), Mode::Link);
+        assert_eq!(link, args(&["a.o", "b.o", "-o", "app.wasm"]));
+
+        let mut single = args(&["main.c"]);
+        assert_eq!(take_mode(&mut single).unwrap(), Mode::Link);
+
+        assert!(take_mode(&mut args(&["--link", "-c", "a.c"])).is_err());
+    }
+
+    #[test]
+    fn takes_both_output_forms() {
+        let mut separate = args(&["a.o", "-o", "app.wasm", "-O2"]);
+        assert_eq!(take_output(&mut separate), Some(PathBuf::from("app.wasm")));
+        assert_eq!(separate, args(&["a.o", "-O2"]));
+
+        let mut joined = args(&["a.o", "-oapp.wasm"]);
+        assert_eq!(take_output(&mut joined), Some(PathBuf::from("app.wasm")));
+        assert_eq!(joined, args(&["a.o"]));
+
+        assert_eq!(take_output(&mut args(&["a.o"])), None);
+    }
+
+    #[test]
+    fn rejects_threads() {
+        assert!(ensure_single_threaded(&args(&["-pthread", "main.c"])).is_err());
+        assert!(ensure_single_threaded(&args(&["--target=wasm32-wasip1-threads"])).is_err());
+        assert!(ensure_single_threaded(&args(&["-O2", "main.c"])).is_ok());
+    }
+
+    #[test]
+    fn simd_flags_follow_the_last_clang_flag() {
+        assert_eq!(wasm_opt_simd_flags(&args(&["main.c"])), ["--enable-simd"]);
+        assert!(wasm_opt_simd_flags(&args(&["-mno-simd128", "main.c"])).is_empty());
+        assert_eq!(
+            wasm_opt_simd_flags(&args(&["-mno-simd128", "-mrelaxed-simd"])),
+            ["--enable-simd", "--enable-relaxed-simd"]
+        );
+        assert_eq!(
+            wasm_opt_simd_flags(&args(&["-mrelaxed-simd", "-mno-relaxed-simd"])),
+            ["--enable-simd"]
+        );
+    }
+}
@@ -0,0 +1,199 @@
+//! Call-graph analysis used to restrict Asyncify instrumentation.
+//!
+//! Only functions that can (transitively) reach a Snapify migration point can be on the stack
+//! when the program unwinds, so only they need Asyncify's unwind/rewind instrumentation.
+//! Instrumenting the rest of the module only costs code size and runtime.
+
+use std::collections::{HashMap, HashSet};
+
+use anyhow::Error;
+use wasmparser::{ElementItems, KnownCustom, Name, Operator, Parser, Payload, TypeRef};
+
+/// Import through which Snapify-instrumented code requests a checkpoint (may unwind).
+pub(crate) const MIGRATION_POINT_IMPORT: (&str, &str) = ("snapify", "should_checkpoint");
+
+#[derive(Default)]
+struct FunctionInfo {
+    /// Directly called function indices.
+    callees: Vec<u32>,
+    /// Whether the function contains an indirect call (call_indirect or call_ref).
+    calls_indirect: bool,
+}
+
+/// Returns the names of the functions that can reach a migration point, or `None` when the
+/// list cannot be computed reliably (no migration point import, or functions without names).
+///
+/// Indirect calls are handled conservatively: a function with an indirect call is included
+/// when any address-taken function (in a table or referenced by `ref.func`) is included.
+pub(crate) fn compute_onlylist(wasm: &[u8]) -> Result<Option<Vec<String>>, Error> {
+    let mut num_imported_funcs = 0u32;
+    let mut migration_point = None;
+    let mut functions: Vec<FunctionInfo> = Vec::new();
+    let mut address_taken: HashSet<u32> = HashSet::new();
+    let mut names: HashMap<u32, String> = HashMap::new();
+
+    for payload in Parser::new(0).parse_all(wasm) {
+        match payload? {
+            Payload::ImportSection(section) => {
+                for import in section {
+                    let import = import?;
+                    if let TypeRef::Func(_) = import.ty {
+                        if (import.module, import.name) == MIGRATION_POINT_IMPORT {
+                            migration_point = Some(num_imported_funcs);
+                        }
+                        num_imported_funcs += 1;
+                    }
+                }
+            }
+            Payload::ElementSection(section) => {
+                for element in section {
+                    match element?.items {
+                        ElementItems::Functions(indices) => {
+                            for index in indices {
+                                address_taken.insert(index?);
+                            }
+                        }
+                        ElementItems::Expressions(_, exprs) => {
+                            for expr in exprs {
+                                let mut reader = expr?.get_operators_reader();
+                                while !reader.eof() {
+                                    if let Operator::RefFunc { function_index } = reader.read()? {
+                                        address_taken.insert(function_index);
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+            Payload::CodeSectionEntry(body) => {
+                let mut info = FunctionInfo::default();
+                let mut reader = body.get_operators_reader()?;
+                while !reader.eof() {
+                    match reader.read()? {
+                        Operator::Call { function_index }
+                        | Operator::ReturnCall { function_index } => {
+                            info.callees.push(function_index)
+                        }
+                        Operator::CallIndirect { .. }
+                        | Operator::ReturnCallIndirect { .. }
+                        | Operator::CallRef { .. }
+                        | Operator::ReturnCallRef { .. } => info.calls_indirect = true,
+                        Operator::RefFunc { function_index } => {
+                            address_taken.insert(function_index);
+                        }
+                        _ => {}
+                    }
+                }
+                functions.push(info);
+            }
+            Payload::CustomSection(section) => {
+                if let KnownCustom::Name(reader) = section.as_known() {
+                    for name in reader {
+                        if let Name::Function(map) = name? {
+                            for naming in map {
+                                let naming = naming?;
+                                names.insert(naming.index, naming.name.to_string());
+                            }
+                        }
+                    }
+                }
+            }
+            _ => {}
+        }
+    }
+
+    let Some(migration_point) = migration_point else {
+        return Ok(None);
+    };
+
+    // Reverse reachability to the migration point, iterated to a fixpoint.
+    let mut reaches = HashSet::from([migration_point]);
+    loop {
+        let indirect_reaches = address_taken.iter().any(|f| reaches.contains(f));
+        let mut changed = false;
+        for (i, info) in functions.iter().enumerate() {
+            let func_idx = num_imported_funcs + i as u32;
+            if reaches.contains(&func_idx) {
+                continue;
+            }
+            if (info.calls_indirect && indirect_reaches)
+                || info.callees.iter().any(|callee| reaches.contains(callee))
+            {
+                reaches.insert(func_idx);
+                changed = true;
+            }
+        }
+        if !changed {
+            break;
+        }
+    }
+
+    let mut onlylist = Vec::new();
+    for func_idx in reaches {
+        if func_idx < num_imported_funcs {
+            continue;
+        }
+        match names.get(&func_idx) {
+            Some(name) => onlylist.push(name.clone()),
+            None => return Ok(None),
+        }
+    }
+    onlylist.sort();
+    Ok(Some(onlylist))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn onlylist(wat: &str) -> Option<Vec<String>> {
+        compute_onlylist(&wat::parse_str(wat).unwrap()).unwrap()
+    }
+
+    #[test]
+    fn includes_only_callers_of_migration_point() {
+        let list = onlylist(
+            r#"
+(module
+  (import "snapify" "should_checkpoint" (func $should_checkpoint (param i32) (result i32)))
+  (func $dest (drop (call $should_checkpoint (i32.const 0))))
+  (func $caller (call $dest))
+  (func $compute (result i32) (i32.const 42))
+  (func $_start (call $caller) (drop (call $compute)))
+)
+"#,
+        );
+        assert_eq!(
+            list,
+            Some(vec![
+                "_start".to_string(),
+                "caller".to_string(),
+                "dest".to_string()
+            ])
+        );
+    }
+
+    #[test]
+    fn indirect_calls_are_conservative() {
+        let list = onlylist(
+            r#"
+(module
+  (import "snapify" "should_checkpoint" (func $should_checkpoint (param i32) (result i32)))
+  (type $void (func))
+  (table 1 funcref)
+  (elem (i32.const 0) $dest)
+  (func $dest (drop (call $should_checkpoint (i32.const 0))))
+  (func $dispatch (call_indirect (type $void) (i32.const 0)))
+  (func $compute (result i32) (i32.const 42))
+)
+"#,
+        );
+        assert_eq!(list, Some(vec!["dest".to_string(), "dispatch".to_string()]));
+    }
+
+    #[test]
+    fn no_migration_point_means_no_list() {
+        assert_eq!(onlylist("(module (func $f))"), None);
+    }
+}
@@ -0,0 +1,91 @@
+//! Content-addressed cache of the wasm-opt stages.
+//!
+//! The Snapify and Asyncify stages are deterministic functions of the linked module, the build
+//! profile and the wasm-opt binary, so their output is cached under a hash of those inputs.
+//! Relinking an unchanged program then skips both wasm-opt runs.
+
+use std::{
+    fs,
+    path::{Path, PathBuf},
+    time::UNIX_EPOCH,
+};
+
+use anyhow::Error;
+use sha2::{Digest, Sha256};
+
+/// Set to `0` to disable the cache.
+pub(crate) const CACHE_ENV: &str = "KAFU_CLANG_CACHE";
+/// Overrides the cache directory.
+pub(crate) const CACHE_DIR_ENV: &str = "KAFU_CLANG_CACHE_DIR";
+
+pub(crate) struct StageCache {
+    dir: PathBuf,
+}
+
+impl StageCache {
+    /// Returns the cache, or `None` when it is disabled or no cache directory is available.
+    pub(crate) fn open() -> Option<Self> {
+        if std::env::var(CACHE_ENV).is_ok_and(|v| v == "0") {
+            return None;
+        }
+        let dir = match std::env::var_os(CACHE_DIR_ENV) {
+            Some(dir) => PathBuf::from(dir),
+            None => match std::env::var_os("XDG_CACHE_HOME") {
+                Some(dir) => PathBuf::from(dir).join("kafu/clang"),
+                None => PathBuf::from(std::env::var_os("HOME")?).join(".cache/kafu/clang"),
+            },
+        };
+        Some(Self { dir })
+    }
+
+    /// Computes the cache key of the wasm-opt stages for `stage1`.
+    /// `options` covers everything else that changes the wasm-opt invocations (profile, features).
+    pub(crate) fn key(stage1: &[u8], options: &str, wasm_opt_path: &Path) -> String {
+        let mut hasher = Sha256::new();
+        hasher.update(env!("CARGO_PKG_VERSION"));
+        hasher.update([0]);
+        hasher.update(options);
+        hasher.update([0]);
+        // Identify the wasm-opt binary by path, size and mtime; hashing it on every build
+        // would cost more than the lookup saves.
+        hasher.update(wasm_opt_path.as_os_str().as_encoded_bytes());
+        if let Ok(metadata) = fs::metadata(wasm_opt_path) {
+            hasher.update(metadata.len().to_le_bytes());
+            if let Ok(mtime) = metadata.modified()
+                && let Ok(mtime) = mtime.duration_since(UNIX_EPOCH)
+            {
+                hasher.update(mtime.as_nanos().to_le_bytes());
+            }
+        }
+        hasher.update([0]);
+        hasher.update(stage1);
+        hasher
+            .finalize()
+            .iter()
+            .map(|b| format!("{b:02x}"))
+            .collect()
+    }
+
+    pub(crate) fn get(&self, key: &str) -> Option<Vec<u8>> {
+        fs::read(self.entry_path(key)).ok()
+    }
+
+    /// Stores an entry. Failures are ignored: the cache is only an optimization.
+    pub(crate) fn put(&self, key: &str, wasm: &[u8]) {
+        let result = (|| -> Result<(), Error> {
+            fs::create_dir_all(&self.dir)?;
+            // Write to a temporary file and rename so concurrent builds never see a partial entry.
+            let tmp = tempfile::NamedTempFile::new_in(&self.dir)?;
+            fs::write(tmp.path(), wasm)?;
+            tmp.persist(self.entry_path(key))?;
+            Ok(())
+        })();
+        if let Err(e) = result {
+            eprintln!("warning: failed to write kafu clang cache: {e}");
+        }
+    }
+
+    fn entry_path(&self, key: &str) -> PathBuf {
+        self.dir.join(format!("{key}.wasm"))
+    }
+}
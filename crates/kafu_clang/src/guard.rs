@@ -0,0 +1,483 @@
+//! Guest-side guards for Snapify's migration points.
+//!
+//! Snapify makes every migration point call the `snapify.should_checkpoint` import, although most
+//! of these calls cannot migrate: a `KAFU_DEST` function entered on its destination node, or any
+//! function exit while no call has migrated. This pass routes the migration points of each
+//! `KAFU_DEST` function through a guard generated for its destination. The guard reads
+//! `__kafu_node_state` (kafu.h) and calls the import only
+//!
+//! - at entry, when the hash of the current node differs from the destination's, and
+//! - at exit, when the migration depth is non-zero,
+//!
+//! which are the checks of `kafu_should_check_entry` and `kafu_should_check_exit`. A placement
+//! group's name hashes to no node, so its entries always reach the host.
+
+use std::{collections::HashMap, ops::Range};
+
+use anyhow::Error;
+use wasmparser::{ExternalKind, KnownCustom, Name, Operator, Parser, Payload, TypeRef, ValType};
+
+use crate::{
+    asyncify::MIGRATION_POINT_IMPORT,
+    sections::{DEST_SECTION_PREFIX, read_uleb128, write_uleb128},
+};
+
+/// Exported global holding the address of the guest's `kafu_node_state_t`.
+const NODE_STATE_EXPORT: &str = "__kafu_node_state";
+/// Offsets of `node_hash` and `migration_depth` in `kafu_node_state_t`.
+const NODE_HASH_OFFSET: u64 = 0;
+const MIGRATION_DEPTH_OFFSET: u64 = 8;
+
+const GUARD_NAME_PREFIX: &str = "__kafu_migration_point_guard.";
+
+const CUSTOM_SECTION_ID: u8 = 0;
+const FUNCTION_SECTION_ID: u8 = 3;
+const CODE_SECTION_ID: u8 = 10;
+const FUNCTION_NAMES_ID: u8 = 1;
+
+/// A function body and the calls to the migration point import in it.
+struct Body {
+    range: Range<usize>,
+    calls: Vec<Range<usize>>,
+}
+
+/// Returns `wasm` with the migration points of `KAFU_DEST` functions guarded, or `None` when
+/// there is nothing to guard.
+///
+/// Modules are left as they are when they use the legacy migration point import (which does not
+/// pass the function index the guard forwards), do not export `__kafu_node_state`, or carry
+/// DWARF: the guards make calls longer, which would shift the code offsets the DWARF refers to.
+pub(crate) fn guard_migration_points(wasm: &[u8]) -> Result<Option<Vec<u8>>, Error> {
+    let mut func_types = Vec::new();
+    let mut num_imported_funcs = 0u32;
+    let mut migration_point = None;
+    let mut node_state = None;
+    let mut bodies = Vec::new();
+    let mut names: HashMap<u32, String> = HashMap::new();
+    let mut dests: HashMap<String, String> = HashMap::new();
+    let mut has_debug_info = false;
+
+    for payload in Parser::new(0).parse_all(wasm) {
+        match payload? {
+            Payload::TypeSection(section) => {
+                for func_type in section.into_iter_err_on_gc_types() {
+                    func_types.push(func_type?);
+                }
+            }
+            Payload::ImportSection(section) => {
+                for import in section {
+                    let import = import?;
+                    if let TypeRef::Func(type_idx) = import.ty {
+                        if (import.module, import.name) == MIGRATION_POINT_IMPORT {
+                            migration_point = Some((num_imported_funcs, type_idx));
+                        }
+                        num_imported_funcs += 1;
+                    }
+                }
+            }
+            Payload::ExportSection(section) => {
+                for export in section {
+                    let export = export?;
+                    if export.kind == ExternalKind::Global && export.name == NODE_STATE_EXPORT {
+                        node_state = Some(export.index);
+                    }
+                }
+            }
+            Payload::CodeSectionEntry(body) => {
+                let mut calls = Vec::new();
+                let mut reader = body.get_operators_reader()?;
+                while !reader.eof() {
+                    let start = reader.original_position();
+                    if let Operator::Call { function_index } = reader.read()?
+                        && migration_point.is_some_and(|(index, _)| index == function_index)
+                    {
+                        calls.push(start..reader.original_position());
+                    }
+                }
+                bodies.push(Body {
+                    range: body.range(),
+                    calls,
+                });
+            }
+            Payload::CustomSection(section) => {
+                if section.name().starts_with(".debug_") {
+                    has_debug_info = true;
+                } else if let Some(dest) = section.name().strip_prefix(DEST_SECTION_PREFIX)
+                    && let Some((ident, dest)) = dest.split_once('.')
+                {
+                    dests.insert(ident.to_string(), dest.to_string());
+                } else if let KnownCustom::Name(reader) = section.as_known() {
+                    for name in reader {
+                        if let Name::Function(map) = name? {
+                            for naming in map {
+                                let naming = naming?;
+                                names.insert(naming.index, naming.name.to_string());
+                            }
+                        }
+                    }
+                }
+            }
+            _ => {}
+        }
+    }
+
+    let (Some((migration_point, type_idx)), Some(node_state)) = (migration_point, node_state)
+    else {
+        return Ok(None);
+    };
+    let indexed_abi = func_types.get(type_idx as usize).is_some_and(|ty| {
+        ty.params() == [ValType::I32, ValType::I32, ValType::I32] && ty.results() == [ValType::I32]
+    });
+    if has_debug_info || !indexed_abi {
+        return Ok(None);
+    }
+
+    // One guard per destination, appended after the defined functions so that no existing
+    // function index changes.
+    let first_guard = num_imported_funcs + bodies.len() as u32;
+    let mut guards: Vec<&str> = Vec::new();
+    let mut body_guards = Vec::with_capacity(bodies.len());
+    for (i, body) in bodies.iter().enumerate() {
+        let dest = names
+            .get(&(num_imported_funcs + i as u32))
+            .and_then(|name| dests.get(name));
+        let guard = match dest {
+            Some(dest) if !body.calls.is_empty() => {
+                let position = match guards.iter().position(|guard| *guard == dest) {
+                    Some(position) => position,
+                    None => {
+                        guards.push(dest);
+                        guards.len() - 1
+                    }
+                };
+                Some(first_guard + position as u32)
+            }
+            _ => None,
+        };
+        body_guards.push(guard);
+    }
+    if guards.is_empty() {
+        return Ok(None);
+    }
+
+    const HEADER_SIZE: usize = 8;
+    let mut guarded = wasm[..HEADER_SIZE].to_vec();
+    let mut offset = HEADER_SIZE;
+    while offset < wasm.len() {
+        let start = offset;
+        let id = wasm[offset];
+        offset += 1;
+        let size = read_uleb128(wasm, &mut offset)? as usize;
+        let end = offset
+            .checked_add(size)
+            .filter(|end| *end <= wasm.len())
+            .ok_or_else(|| anyhow::anyhow!("Truncated Wasm section"))?;
+        let content = offset..end;
+        offset = end;
+
+        let mut section = Vec::new();
+        match id {
+            FUNCTION_SECTION_ID => {
+                let mut entries = content.start;
+                let count = read_uleb128(wasm, &mut entries)?;
+                write_uleb128(&mut section, count + guards.len() as u64);
+                section.extend_from_slice(&wasm[entries..content.end]);
+                for _ in &guards {
+                    write_uleb128(&mut section, u64::from(type_idx));
+                }
+            }
+            CODE_SECTION_ID => {
+                write_uleb128(&mut section, (bodies.len() + guards.len()) as u64);
+                for (body, guard) in bodies.iter().zip(&body_guards) {
+                    let code = match guard {
+                        Some(guard) => redirect_calls(wasm, body, *guard),
+                        None => wasm[body.range.clone()].to_vec(),
+                    };
+                    write_uleb128(&mut section, code.len() as u64);
+                    section.extend_from_slice(&code);
+                }
+                for dest in &guards {
+                    let code = guard_body(dest, node_state, migration_point);
+                    write_uleb128(&mut section, code.len() as u64);
+                    section.extend_from_slice(&code);
+                }
+            }
+            CUSTOM_SECTION_ID if custom_section_name(wasm, content.clone())? == "name" => {
+                section = append_function_names(wasm, content, first_guard, &guards)?;
+            }
+            _ => {
+                guarded.extend_from_slice(&wasm[start..end]);
+                continue;
+            }
+        }
+        guarded.push(id);
+        write_uleb128(&mut guarded, section.len() as u64);
+        guarded.extend_from_slice(&section);
+    }
+    Ok(Some(guarded))
+}
+
+/// Returns the code of `body` with its migration point calls going to `guard` instead.
+fn redirect_calls(wasm: &[u8], body: &Body, guard: u32) -> Vec<u8> {
+    const CALL: u8 = 0x10;
+    let mut code = Vec::with_capacity(body.range.len() + body.calls.len());
+    let mut copied = body.range.start;
+    for call in &body.calls {
+        code.extend_from_slice(&wasm[copied..call.start]);
+        code.push(CALL);
+        write_uleb128(&mut code, u64::from(guard));
+        copied = call.end;
+    }
+    code.extend_from_slice(&wasm[copied..body.range.end]);
+    code
+}
+
+/// Code of the guard for `dest`, with the signature of the indexed migration point import:
+///
+/// ```wat
+/// (func (param $reason i32) (param $func_idx i32) (param $depth i32) (result i32)
+///   (if (result i32)
+///     (if (result i32) (local.get $reason)
+///       (then (i32.eqz (i32.load offset=8 (global.get $__kafu_node_state))))
+///       (else (i64.eq (i64.load (global.get $__kafu_node_state)) (i64.const <hash of dest>))))
+///     (then (i32.const 0))
+///     (else (call $should_checkpoint (local.get $reason) (local.get $func_idx) (local.get $depth)))))
+/// ```
+fn guard_body(dest: &str, node_state: u32, migration_point: u32) -> Vec<u8> {
+    const LOCAL_GET: u8 = 0x20;
+    const GLOBAL_GET: u8 = 0x23;
+    const IF: u8 = 0x04;
+    const ELSE: u8 = 0x05;
+    const END: u8 = 0x0b;
+    const CALL: u8 = 0x10;
+    const I32: u8 = 0x7f;
+    const I32_CONST: u8 = 0x41;
+    const I32_LOAD: u8 = 0x28;
+    const I32_EQZ: u8 = 0x45;
+    const I64_CONST: u8 = 0x42;
+    const I64_LOAD: u8 = 0x29;
+    const I64_EQ: u8 = 0x51;
+
+    // No locals.
+    let mut code = vec![0];
+    // reason: 0 at function entry, 1 at function exit.
+    code.extend([LOCAL_GET, 0, IF, I32]);
+    code.push(GLOBAL_GET);
+    write_uleb128(&mut code, u64::from(node_state));
+    code.extend([I32_LOAD, 2]);
+    write_uleb128(&mut code, MIGRATION_DEPTH_OFFSET);
+    code.extend([I32_EQZ, ELSE, GLOBAL_GET]);
+    write_uleb128(&mut code, u64::from(node_state));
+    code.extend([I64_LOAD, 3]);
+    write_uleb128(&mut code, NODE_HASH_OFFSET);
+    code.push(I64_CONST);
+    write_sleb128(&mut code, node_hash(dest) as i64);
+    code.extend([I64_EQ, END]);
+    code.extend([IF, I32, I32_CONST, 0, ELSE]);
+    code.extend([LOCAL_GET, 0, LOCAL_GET, 1, LOCAL_GET, 2, CALL]);
+    write_uleb128(&mut code, u64::from(migration_point));
+    code.extend([END, END]);
+    code
+}
+
+/// Returns the content of the name section in `content` with the guards' names added to its
+/// function names.
+fn append_function_names(
+    wasm: &[u8],
+    content: Range<usize>,
+    first_guard: u32,
+    guards: &[&str],
+) -> Result<Vec<u8>, Error> {
+    let mut offset = content.start;
+    let name_len = read_uleb128(wasm, &mut offset)? as usize;
+    offset += name_len;
+    let mut section = wasm[content.start..offset].to_vec();
+    while offset < content.end {
+        let id = wasm[offset];
+        offset += 1;
+        let size = read_uleb128(wasm, &mut offset)? as usize;
+        let end = offset
+            .checked_add(size)
+            .filter(|end| *end <= content.end)
+            .ok_or_else(|| anyhow::anyhow!("Truncated name subsection"))?;
+        let mut subsection = Vec::new();
+        if id == FUNCTION_NAMES_ID {
+            let mut entries = offset;
+            let count = read_uleb128(wasm, &mut entries)?;
+            write_uleb128(&mut subsection, count + guards.len() as u64);
+            subsection.extend_from_slice(&wasm[entries..end]);
+            // Guards have the highest indices, so the map stays sorted.
+            for (i, dest) in guards.iter().enumerate() {
+                let name = format!("{GUARD_NAME_PREFIX}{dest}");
+                write_uleb128(&mut subsection, u64::from(first_guard) + i as u64);
+                write_uleb128(&mut subsection, name.len() as u64);
+                subsection.extend_from_slice(name.as_bytes());
+            }
+        } else {
+            subsection.extend_from_slice(&wasm[offset..end]);
+        }
+        section.push(id);
+        write_uleb128(&mut section, subsection.len() as u64);
+        section.extend_from_slice(&subsection);
+        offset = end;
+    }
+    Ok(section)
+}
+
+fn custom_section_name(wasm: &[u8], content: Range<usize>) -> Result<&str, Error> {
+    let mut offset = content.start;
+    let len = read_uleb128(wasm, &mut offset)? as usize;
+    let name = wasm
+        .get(offset..offset + len)
+        .filter(|_| offset + len <= content.end)
+        .ok_or_else(|| anyhow::anyhow!("Truncated custom section name"))?;
+    Ok(std::str::from_utf8(name)?)
+}
+
+/// 64-bit FNV-1a hash of a node ID. Must match `kafu_node_hash` in kafu.h.
+fn node_hash(node_id: &str) -> u64 {
+    node_id.bytes().fold(0xcbf29ce484222325, |hash, byte| {
+        (hash ^ u64::from(byte)).wrapping_mul(0x100000001b3)
+    })
+}
+
+fn write_sleb128(out: &mut Vec<u8>, mut value: i64) {
+    loop {
+        let byte = (value & 0x7f) as u8;
+        value >>= 7;
+        let done = (value == 0 && byte & 0x40 == 0) || (value == -1 && byte & 0x40 != 0);
+        if done {
+            out.push(byte);
+            break;
+        }
+        out.push(byte | 0x80);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const MODULE: &str = r#"
+(module
+  (import "snapify" "should_checkpoint"
+    (func $should_checkpoint (param i32 i32 i32) (result i32)))
+  (memory (export "memory") 1)
+  (global (export "__kafu_node_state") i32 (i32.const 16))
+  (func $f
+    (drop (call $should_checkpoint (i32.const 0) (i32.const 1) (i32.const 1)))
+    (drop (call $should_checkpoint (i32.const 1) (i32.const 1) (i32.const 1))))
+  (func $g
+    (drop (call $should_checkpoint (i32.const 0) (i32.const 2) (i32.const 1))))
+  (func $h
+    (drop (call $should_checkpoint (i32.const 0) (i32.const 3) (i32.const 1))))
+  (func $_start (call $f) (call $g) (call $h))
+  (@custom ".kafu_dest.f.edge1" "")
+  (@custom ".kafu_dest.g.cloud1" "")
+  (@custom ".kafu_dest.h.edge1" "")
+)
+"#;
+
+    /// Names of the functions called by each named function.
+    fn callees(wasm: &[u8]) -> HashMap<String, Vec<String>> {
+        let mut names = HashMap::new();
+        let mut bodies = Vec::new();
+        let mut num_imported_funcs = 0;
+        for payload in Parser::new(0).parse_all(wasm) {
+            match payload.unwrap() {
+                Payload::ImportSection(section) => num_imported_funcs = section.count(),
+                Payload::CodeSectionEntry(body) => {
+                    let mut calls = Vec::new();
+                    let mut reader = body.get_operators_reader().unwrap();
+                    while !reader.eof() {
+                        if let Operator::Call { function_index } = reader.read().unwrap() {
+                            calls.push(function_index);
+                        }
+                    }
+                    bodies.push(calls);
+                }
+                Payload::CustomSection(section) => {
+                    if let KnownCustom::Name(reader) = section.as_known() {
+                        for name in reader {
+                            if let Name::Function(map) = name.unwrap() {
+                                for naming in map {
+                                    let naming = naming.unwrap();
+                                    names.insert(naming.index, naming.name.to_string());
+                                }
+                            }
+                        }
+                    }
+                }
+                _ => {}
+            }
+        }
+        bodies
+            .into_iter()
+            .enumerate()
+            .map(|(i, calls)| {
+                (
+                    names[&(num_imported_funcs + i as u32)].clone(),
+                    calls.iter().map(|callee| names[callee].clone()).collect(),
+                )
+            })
+            .collect()
+    }
+
+    #[test]
+    fn routes_migration_points_through_one_guard_per_destination() {
+        let wasm = wat::parse_str(MODULE).unwrap();
+        let guarded = guard_migration_points(&wasm).unwrap().unwrap();
+        wasmparser::validate(&guarded).unwrap();
+
+        let callees = callees(&guarded);
+        let edge1 = "__kafu_migration_point_guard.edge1".to_string();
+        let cloud1 = "__kafu_migration_point_guard.cloud1".to_string();
+        assert_eq!(callees["f"], vec![edge1.clone(), edge1.clone()]);
+        assert_eq!(callees["g"], vec![cloud1.clone()]);
+        assert_eq!(callees["h"], vec![edge1.clone()]);
+        assert_eq!(callees[&edge1], vec!["should_checkpoint".to_string()]);
+        assert_eq!(callees[&cloud1], vec!["should_checkpoint".to_string()]);
+
+        // The guards call the import, so they are on Asyncify's onlylist too.
+        let onlylist = crate::asyncify::compute_onlylist(&guarded)
+            .unwrap()
+            .unwrap();
+        assert!(onlylist.contains(&edge1) && onlylist.contains(&cloud1));
+    }
+
+    #[test]
+    fn leaves_unsupported_modules_alone() {
+        // No node state to read.
+        let wasm = wat::parse_str(MODULE.replace("(export \"__kafu_node_state\")", "")).unwrap();
+        assert!(guard_migration_points(&wasm).unwrap().is_none());
+
+        // DWARF refers to code offsets that the guards would shift.
+        let wasm = wat::parse_str(MODULE.replace(
+            "(@custom \".kafu_dest.f.edge1\" \"\")",
+            "(@custom \".kafu_dest.f.edge1\" \"\") (@custom \".debug_info\" \"dwarf\")",
+        ))
+        .unwrap();
+        assert!(guard_migration_points(&wasm).unwrap().is_none());
+
+        // The legacy import does not take the function index.
+        let wasm = wat::parse_str(
+            r#"
+(module
+  (import "snapify" "should_checkpoint" (func $should_checkpoint (param i32) (result i32)))
+  (global (export "__kafu_node_state") i32 (i32.const 16))
+  (func $f (drop (call $should_checkpoint (i32.const 0))))
+  (@custom ".kafu_dest.f.edge1" "")
+)
+"#,
+        )
+        .unwrap();
+        assert!(guard_migration_points(&wasm).unwrap().is_none());
+    }
+
+    #[test]
+    fn hashes_node_ids_like_kafu_h() {
+        // FNV-1a test vectors.
+        assert_eq!(node_hash(""), 0xcbf29ce484222325);
+        assert_eq!(node_hash("a"), 0xaf63dc4c8601ec8c);
+    }
+}
@@ -1,11 +1,20 @@
+mod args;
+mod asyncify;
+mod cache;
+mod guard;
+mod profile;
+mod sections;
+
 use std::{
-    path::PathBuf,
+    path::{Path, PathBuf},
     process::{Command, ExitCode},
 };
 
 use anyhow::Error;
 use clap::Parser;
 
+use crate::{args::Mode, cache::StageCache, profile::Profile};
+
 const DISPLAY_INTERNAL_COMMAND: bool = true;
 
 /// Clang and wasm-opt wrapper for Kafu.
@@ -78,28 +87,44 @@ fn main() -> Result<ExitCode, Error> {
         return Ok(ExitCode::SUCCESS);
     }
 
-    // Stage1: Clang
-    // Extract output path from -o flag if present, and remove -o <file> from args
-    let mut output_path = PathBuf::from("a.out");
-    for arg in cli.args.windows(2) {
-        if arg[0] == "-o" {
-            output_path = PathBuf::from(arg[1].clone());
-            break;
+    // Kafu-specific flags are consumed here and never reach clang.
+    let mut profile = match std::env::var(profile::PROFILE_ENV) {
+        Ok(name) => Profile::parse(&name)?,
+        Err(_) => Profile::default(),
+    };
+    let mut clang_args = Vec::with_capacity(cli.args.len());
+    for arg in &cli.args {
+        match arg.strip_prefix(profile::PROFILE_FLAG) {
+            Some(name) => profile = Profile::parse(name)?,
+            None => clang_args.push(arg.clone()),
         }
     }
 
+    args::ensure_single_threaded(&clang_args)?;
+
+    // SIMD128 is on by default. It goes first so that a later -mno-simd128 wins.
+    clang_args.insert(0, args::SIMD_FLAG.to_string());
+    let wasm_opt_features = args::wasm_opt_simd_flags(&clang_args);
+
+    // Objects, assembly and preprocessed output come from clang alone; Snapify and Asyncify
+    // run once, on the linked module.
+    if args::take_mode(&mut clang_args)? == Mode::CompileOnly {
+        clang_args.push("-I".to_string());
+        clang_args.push(get_kafu_sdk_include_path()?.to_string_lossy().to_string());
+        let mut clang_cmd = Command::new(clang_path);
+        clang_cmd.args(&clang_args);
+        run_command("clang", &mut clang_cmd, "Failed to run clang command")?;
+        return Ok(ExitCode::SUCCESS);
+    }
+
+    // Stage1: Clang
+    // Extract output path from -o flag if present, and remove it from args
+    let output_path = args::take_output(&mut clang_args).unwrap_or_else(|| PathBuf::from("a.out"));
+
     let temp_dir = tempfile::tempdir()?;
     let stage1 = temp_dir.path().join("stage1.wasm");
     let stage2 = temp_dir.path().join("stage2.wasm");
-    let stage3 = output_path.clone();
-
-    // Remove -o flag and its following filename from clang args
-    let mut clang_args = cli.args.clone();
-    let output_index = clang_args.iter().position(|arg| arg == "-o");
-    if let Some(output_index) = output_index {
-        clang_args.remove(output_index);
-        clang_args.remove(output_index);
-    }
+    let stage3 = temp_dir.path().join("stage3.wasm");
 
     // Add -o <stage1.wasm> to clang args
     clang_args.push("-o".to_string());
@@ -109,50 +134,156 @@ fn main() -> Result<ExitCode, Error> {
     clang_args.push("-I".to_string());
     clang_args.push(get_kafu_sdk_include_path()?.to_string_lossy().to_string());
 
-    // Add -Wl,--no-gc-sections to prevent Kafu attributes from being removed by the linker.
-    clang_args.push("-Wl,--no-gc-sections".to_string());
+    // The runtime resolves function pointers passed to KAFU_SPAWN through the function table.
+    clang_args.push("-Wl,--export-table".to_string());
+    // The runtime leaves the part of the shadow stack below the stack pointer out of snapshots.
+    clang_args.push("-Wl,--export-if-defined=__stack_pointer".to_string());
+    clang_args.push("-Wl,--export-if-defined=__stack_low".to_string());
+    // The runtime finds the guest-visible node state (kafu.h) and the free-span table
+    // (kafu_memory.h) through their exported addresses.
+    clang_args.push("-Wl,--export-if-defined=__kafu_node_state".to_string());
+    clang_args.push("-Wl,--export-if-defined=__kafu_free_spans".to_string());
 
     let mut clang_cmd = Command::new(clang_path);
     clang_cmd.args(&clang_args);
     run_command("clang", &mut clang_cmd, "Failed to run clang command")?;
 
+    // The linker garbage-collects the KAFU_DEST custom sections; restore them from the
+    // exported `__kafu_dest.*` markers, which survive as GC roots.
+    let mut stage1_wasm = std::fs::read(&stage1)?;
+    if sections::restore_kafu_dest_sections(&mut stage1_wasm)? > 0 {
+        std::fs::write(&stage1, &stage1_wasm)?;
+    }
+
+    let cache = StageCache::open();
+    let cache_options = [profile.name()]
+        .into_iter()
+        .chain(wasm_opt_features.iter().copied())
+        .collect::<Vec<_>>()
+        .join(" ");
+    let cache_key = StageCache::key(&stage1_wasm, &cache_options, &wasm_opt_path);
+    let output_wasm = match cache.as_ref().and_then(|cache| cache.get(&cache_key)) {
+        Some(cached) => {
+            eprintln!("kafu clang: wasm-opt stages unchanged, using cached output");
+            cached
+        }
+        None => {
+            run_wasm_opt_stages(
+                &wasm_opt_path,
+                profile,
+                &wasm_opt_features,
+                &stage1_wasm,
+                [&stage1, &stage2, &stage3].map(PathBuf::as_path),
+                temp_dir.path(),
+            )?;
+            let output_wasm = std::fs::read(&stage3)?;
+            if let Some(cache) = &cache {
+                cache.put(&cache_key, &output_wasm);
+            }
+            output_wasm
+        }
+    };
+
+    // Release profiles ship without DWARF; it goes to <output>.debug.wasm instead.
+    if profile.split_debug_info() {
+        let mut debug_path = output_path.clone().into_os_string();
+        debug_path.push(".debug.wasm");
+        let debug_path = PathBuf::from(debug_path);
+        let debug_file_name = debug_path
+            .file_name()
+            .map(|name| name.to_string_lossy().to_string())
+            .unwrap_or_default();
+        if let Some(stripped) = sections::split_debug_info(&output_wasm, &debug_file_name)? {
+            std::fs::write(&debug_path, &output_wasm)?;
+            std::fs::write(&output_path, stripped)?;
+            return Ok(ExitCode::SUCCESS);
+        }
+    }
+    std::fs::write(&output_path, output_wasm)?;
+
+    Ok(ExitCode::SUCCESS)
+}
+
+/// Runs Snapify (stage1 -> stage2) and Asyncify (stage2 -> stage3).
+fn run_wasm_opt_stages(
+    wasm_opt_path: &Path,
+    profile: Profile,
+    features: &[&str],
+    stage1_wasm: &[u8],
+    [stage1, stage2, stage3]: [&Path; 3],
+    temp_dir: &Path,
+) -> Result<(), Error> {
     // Stage2: Snapify
     // wasm-opt stage1.wasm -O0 --enable-multimemory --snapify --pass-arg=policy@kafu -o stage2.wasm
-    let mut snapify_cmd = Command::new(&wasm_opt_path);
+    let mut snapify_cmd = Command::new(wasm_opt_path);
     snapify_cmd
-        .arg(&stage1)
-        .arg("-O0")
+        .arg(stage1)
+        .arg(profile.pre_snapify_opt())
         .arg("-g")
         .arg("--enable-multimemory")
+        .args(features);
+    if profile.pre_snapify_opt() != "-O0" {
+        // Inlining a KAFU_DEST function into its callers would skip its migration points.
+        let dest_functions = sections::kafu_dest_functions(stage1_wasm)?;
+        if !dest_functions.is_empty() {
+            snapify_cmd.arg(format!("--no-inline={}", dest_functions.join(",")));
+        }
+    }
+    snapify_cmd
         .arg("--snapify")
         .arg("--pass-arg=policy@kafu")
         .arg("-o")
-        .arg(&stage2);
+        .arg(stage2);
     run_command(
         "snapify",
         &mut snapify_cmd,
         "Failed to run wasm-opt (snapify) command",
     )?;
 
+    // Migration points that cannot migrate skip the host call.
+    let mut stage2_wasm = std::fs::read(stage2)?;
+    if let Some(guarded) = guard::guard_migration_points(&stage2_wasm)? {
+        stage2_wasm = guarded;
+        std::fs::write(stage2, &stage2_wasm)?;
+    }
+
     // Stage3: Asyncify
     // wasm-opt stage2.wasm -O3 --enable-multimemory --asyncify --pass-arg=asyncify-memory@snapify_memory -o stage3.wasm
+    // Only functions that can reach a migration point are instrumented (asyncify-onlylist).
     let mut asyncify_cmd = Command::new(wasm_opt_path);
     asyncify_cmd
-        .arg(&stage2)
-        .arg("-O3")
+        .arg(stage2)
+        .arg(profile.pre_asyncify_opt())
         .arg("-g")
         .arg("--enable-multimemory")
+        .args(features)
         .arg("--asyncify")
-        .arg("--pass-arg=asyncify-memory@snapify_memory")
-        .arg("-o")
-        .arg(&stage3);
+        .arg("--pass-arg=asyncify-memory@snapify_memory");
+    match asyncify::compute_onlylist(&stage2_wasm)? {
+        Some(onlylist) => {
+            let onlylist_path = temp_dir.join("asyncify-onlylist.txt");
+            std::fs::write(&onlylist_path, onlylist.join("\n"))?;
+            asyncify_cmd.arg(format!(
+                "--pass-arg=asyncify-onlylist@@{}",
+                onlylist_path.display()
+            ));
+        }
+        None => {
+            eprintln!(
+                "warning: could not determine the functions reaching migration points; instrumenting the whole module"
+            );
+        }
+    }
+    if let Some(opt) = profile.post_asyncify_opt() {
+        asyncify_cmd.arg(opt);
+    }
+    asyncify_cmd.arg("-o").arg(stage3);
     run_command(
         "asyncify",
         &mut asyncify_cmd,
         "Failed to run wasm-opt (asyncify) command",
     )?;
-
-    Ok(ExitCode::SUCCESS)
+    Ok(())
 }
 
 fn display_command(cmd: &Command) {
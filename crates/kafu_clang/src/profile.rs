@@ -0,0 +1,70 @@
+//! Build profiles controlling the wasm-opt stages.
+
+use anyhow::Error;
+
+/// Flag selecting the build profile (`--kafu-profile=<name>`); `KAFU_PROFILE` is the fallback.
+pub(crate) const PROFILE_FLAG: &str = "--kafu-profile=";
+pub(crate) const PROFILE_ENV: &str = "KAFU_PROFILE";
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Default)]
+pub(crate) enum Profile {
+    /// Fast builds with embedded debug info.
+    #[default]
+    Dev,
+    /// Optimized for speed; DWARF is split into `<output>.debug.wasm`.
+    Release,
+    /// Optimized for size; DWARF is split into `<output>.debug.wasm`.
+    Size,
+}
+
+impl Profile {
+    pub(crate) fn parse(name: &str) -> Result<Self, Error> {
+        match name {
+            "dev" => Ok(Self::Dev),
+            "release" => Ok(Self::Release),
+            "size" => Ok(Self::Size),
+            _ => Err(anyhow::anyhow!(
+                "Unknown build profile `{name}` (expected dev, release or size)"
+            )),
+        }
+    }
+
+    pub(crate) fn name(self) -> &'static str {
+        match self {
+            Self::Dev => "dev",
+            Self::Release => "release",
+            Self::Size => "size",
+        }
+    }
+
+    /// Optimization level applied before Snapify inserts migration points.
+    pub(crate) fn pre_snapify_opt(self) -> &'static str {
+        match self {
+            Self::Dev => "-O0",
+            Self::Release => "-O2",
+            Self::Size => "-Os",
+        }
+    }
+
+    /// Optimization level applied before Asyncify.
+    pub(crate) fn pre_asyncify_opt(self) -> &'static str {
+        match self {
+            Self::Dev | Self::Release => "-O3",
+            Self::Size => "-Oz",
+        }
+    }
+
+    /// Optimization level applied after Asyncify to clean up its instrumentation.
+    pub(crate) fn post_asyncify_opt(self) -> Option<&'static str> {
+        match self {
+            Self::Dev => None,
+            Self::Release => Some("-O3"),
+            Self::Size => Some("-Oz"),
+        }
+    }
+
+    /// Whether DWARF is moved out of the output into `<output>.debug.wasm`.
+    pub(crate) fn split_debug_info(self) -> bool {
+        self != Self::Dev
+    }
+}
@@ -0,0 +1,223 @@
+//! Post-link retention of Kafu metadata sections.
+//!
+//! `KAFU_DEST(ident, dest)` emits a `.kafu_dest.<ident>.<dest>` custom section, which the
+//! linker drops when garbage-collecting sections. Instead of disabling `--gc-sections` for the
+//! whole program, `KAFU_DEST` also defines a weak, exported marker function
+//! `__kafu_dest.<ident>.<dest>` (exports are GC roots), and the custom sections are restored
+//! from those markers after linking.
+//!
+//! This module also splits DWARF into a separate file for release builds.
+
+use std::collections::HashSet;
+
+use anyhow::Error;
+use wasmparser::{Parser, Payload};
+
+const DEST_MARKER_PREFIX: &str = "__kafu_dest.";
+pub(crate) const DEST_SECTION_PREFIX: &str = ".kafu_dest.";
+
+/// Appends a `.kafu_dest.*` custom section for every `__kafu_dest.*` export whose section
+/// did not survive linking. Returns the number of sections added.
+pub(crate) fn restore_kafu_dest_sections(wasm: &mut Vec<u8>) -> Result<usize, Error> {
+    let mut markers = Vec::new();
+    let mut sections = HashSet::new();
+    for payload in Parser::new(0).parse_all(wasm) {
+        match payload? {
+            Payload::ExportSection(section) => {
+                for export in section {
+                    if let Some(dest) = export?.name.strip_prefix(DEST_MARKER_PREFIX) {
+                        markers.push(dest.to_string());
+                    }
+                }
+            }
+            Payload::CustomSection(section) => {
+                if let Some(dest) = section.name().strip_prefix(DEST_SECTION_PREFIX) {
+                    sections.insert(dest.to_string());
+                }
+            }
+            _ => {}
+        }
+    }
+
+    let mut added = 0;
+    for dest in markers {
+        if sections.contains(&dest) {
+            continue;
+        }
+        append_empty_custom_section(wasm, &format!("{DEST_SECTION_PREFIX}{dest}"));
+        added += 1;
+    }
+    Ok(added)
+}
+
+/// Returns the identifiers of the functions annotated with `KAFU_DEST`.
+pub(crate) fn kafu_dest_functions(wasm: &[u8]) -> Result<Vec<String>, Error> {
+    let mut idents = Vec::new();
+    for payload in Parser::new(0).parse_all(wasm) {
+        if let Payload::CustomSection(section) = payload?
+            && let Some(dest) = section.name().strip_prefix(DEST_SECTION_PREFIX)
+            && let Some((ident, _)) = dest.split_once('.')
+        {
+            idents.push(ident.to_string());
+        }
+    }
+    Ok(idents)
+}
+
+/// Moves DWARF out of `wasm`.
+///
+/// Returns the module without its `.debug_*` sections and with an `external_debug_info`
+/// section pointing at `debug_file_name`, or `None` when the module has no DWARF.
+pub(crate) fn split_debug_info(
+    wasm: &[u8],
+    debug_file_name: &str,
+) -> Result<Option<Vec<u8>>, Error> {
+    const HEADER_SIZE: usize = 8;
+    if wasm.len() < HEADER_SIZE {
+        return Err(anyhow::anyhow!("Not a Wasm module"));
+    }
+    let mut stripped = wasm[..HEADER_SIZE].to_vec();
+    let mut has_debug_info = false;
+    let mut offset = HEADER_SIZE;
+    while offset < wasm.len() {
+        let start = offset;
+        let id = wasm[offset];
+        offset += 1;
+        let size = read_uleb128(wasm, &mut offset)? as usize;
+        let end = offset
+            .checked_add(size)
+            .filter(|end| *end <= wasm.len())
+            .ok_or_else(|| anyhow::anyhow!("Truncated Wasm section"))?;
+        if id == 0 {
+            let mut name_offset = offset;
+            let name_len = read_uleb128(wasm, &mut name_offset)? as usize;
+            let name = wasm
+                .get(name_offset..name_offset + name_len)
+                .unwrap_or_default();
+            if name.starts_with(b".debug_") {
+                has_debug_info = true;
+                offset = end;
+                continue;
+            }
+        }
+        stripped.extend_from_slice(&wasm[start..end]);
+        offset = end;
+    }
+    if !has_debug_info {
+        return Ok(None);
+    }
+
+    let mut url = Vec::new();
+    write_uleb128(&mut url, debug_file_name.len() as u64);
+    url.extend_from_slice(debug_file_name.as_bytes());
+    append_custom_section(&mut stripped, "external_debug_info", &url);
+    Ok(Some(stripped))
+}
+
+fn append_empty_custom_section(wasm: &mut Vec<u8>, name: &str) {
+    append_custom_section(wasm, name, &[]);
+}
+
+fn append_custom_section(wasm: &mut Vec<u8>, name: &str, data: &[u8]) {
+    let mut payload = Vec::new();
+    write_uleb128(&mut payload, name.len() as u64);
+    payload.extend_from_slice(name.as_bytes());
+    payload.extend_from_slice(data);
+
+    // Custom section id.
+    wasm.push(0);
+    write_uleb128(wasm, payload.len() as u64);
+    wasm.extend_from_slice(&payload);
+}
+
+pub(crate) fn read_uleb128(data: &[u8], offset: &mut usize) -> Result<u64, Error> {
+    let mut value = 0u64;
+    let mut shift = 0;
+    loop {
+        let byte = *data
+            .get(*offset)
+            .ok_or_else(|| anyhow::anyhow!("Truncated LEB128 value"))?;
+        *offset += 1;
+        value |= u64::from(byte & 0x7f) << shift;
+        if byte & 0x80 == 0 {
+            return Ok(value);
+        }
+        shift += 7;
+        if shift >= 64 {
+            return Err(anyhow::anyhow!("LEB128 value too large"));
+        }
+    }
+}
+
+pub(crate) fn write_uleb128(out: &mut Vec<u8>, mut value: u64) {
+    loop {
+        let byte = (value & 0x7f) as u8;
+        value >>= 7;
+        if value == 0 {
+            out.push(byte);
+            break;
+        }
+        out.push(byte | 0x80);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn custom_section_names(wasm: &[u8]) -> Vec<String> {
+        Parser::new(0)
+            .parse_all(wasm)
+            .filter_map(|payload| match payload.unwrap() {
+                Payload::CustomSection(section) => Some(section.name().to_string()),
+                _ => None,
+            })
+            .collect()
+    }
+
+    #[test]
+    fn restores_missing_sections_once() {
+        let mut wasm = wat::parse_str(
+            r#"
+(module
+  (func (export "__kafu_dest.f.edge1"))
+  (func (export "__kafu_dest.g.cloud1"))
+  (@custom ".kafu_dest.g.cloud1" "")
+)
+"#,
+        )
+        .unwrap();
+        assert_eq!(restore_kafu_dest_sections(&mut wasm).unwrap(), 1);
+        let names = custom_section_names(&wasm);
+        assert!(names.contains(&".kafu_dest.f.edge1".to_string()));
+        assert!(names.contains(&".kafu_dest.g.cloud1".to_string()));
+
+        // Idempotent.
+        assert_eq!(restore_kafu_dest_sections(&mut wasm).unwrap(), 0);
+
+        assert_eq!(kafu_dest_functions(&wasm).unwrap().len(), 2);
+    }
+
+    #[test]
+    fn splits_debug_sections() {
+        let wasm = wat::parse_str(
+            r#"
+(module
+  (func (export "f"))
+  (@custom ".debug_info" "dwarf")
+  (@custom ".debug_line" "dwarf")
+  (@custom "producers" "")
+)
+"#,
+        )
+        .unwrap();
+        let stripped = split_debug_info(&wasm, "main.wasm.debug.wasm")
+            .unwrap()
+            .unwrap();
+        assert_eq!(
+            custom_section_names(&stripped),
+            vec!["producers".to_string(), "external_debug_info".to_string()]
+        );
+        assert!(split_debug_info(&stripped, "x").unwrap().is_none());
+    }
+}
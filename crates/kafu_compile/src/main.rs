@@ -0,0 +1,94 @@
+use std::{path::PathBuf, process::ExitCode};
+
+use anyhow::Error;
+use clap::Parser;
+use kafu_config::{KafuConfig, WasmLocation};
+
+/// Ahead-of-time compile a Kafu application for the nodes in a Kafu config.
+///
+/// For each node with an `aot` section, the Wasm binary is compiled for the node's
+/// target triple and CPU features, and written to the node's artifact path.
+#[derive(Parser)]
+#[command(version, about)]
+struct Cli {
+    /// Path to the Kafu config file.
+    config: PathBuf,
+
+    /// Compile only for the given node (can be repeated).
+    #[arg(long = "node", value_name = "NODE_ID")]
+    nodes: Vec<String>,
+
+    /// Use this Wasm binary instead of `app.path` (required when the config uses `app.url`).
+    #[arg(long)]
+    wasm: Option<PathBuf>,
+}
+
+fn main() -> Result<ExitCode, Error> {
+    let cli = Cli::parse();
+    let config = KafuConfig::load(&cli.config)
+        .map_err(|e| anyhow::anyhow!("Failed to load Kafu config: {}", e))?;
+
+    let wasm_path = match (&cli.wasm, config.get_wasm_location()) {
+        (Some(path), _) => path.clone(),
+        (None, WasmLocation::Path(path)) => path,
+        (None, WasmLocation::Url(url)) => {
+            return Err(anyhow::anyhow!(
+                "app.url ({url}) is not supported; download the binary and pass --wasm <path>"
+            ));
+        }
+    };
+    let wasm = std::fs::read(&wasm_path)
+        .map_err(|e| anyhow::anyhow!("Failed to read {}: {}", wasm_path.display(), e))?;
+
+    let node_ids: Vec<String> = if cli.nodes.is_empty() {
+        config
+            .nodes
+            .iter()
+            .filter(|(_, node)| node.aot.is_some())
+            .map(|(node_id, _)| node_id.clone())
+            .collect()
+    } else {
+        cli.nodes.clone()
+    };
+    if node_ids.is_empty() {
+        return Err(anyhow::anyhow!(
+            "No node has an `aot` section in the config"
+        ));
+    }
+
+    for node_id in &node_ids {
+        let node = config
+            .nodes
+            .get(node_id)
+            .ok_or_else(|| anyhow::anyhow!("Node {} not found in the config", node_id))?;
+        let (Some(aot), Some(output_path)) =
+            (node.aot.as_ref(), config.get_aot_artifact_path(node_id))
+        else {
+            return Err(anyhow::anyhow!(
+                "Node {} has no `aot` section in the config",
+                node_id
+            ));
+        };
+
+        eprintln!(
+            "Compiling {} for {} (target: {}, cpu features: [{}])",
+            wasm_path.display(),
+            node_id,
+            aot.target.as_deref().unwrap_or("host"),
+            aot.cpu_features.join(", ")
+        );
+        let engine_config = node.engine.clone().unwrap_or_default();
+        let artifact = kafu_runtime::engine::precompile(
+            &wasm,
+            aot.target.as_deref(),
+            &aot.cpu_features,
+            &engine_config,
+        )
+        .map_err(|e| anyhow::anyhow!("Failed to compile for {}: {:#}", node_id, e))?;
+        std::fs::write(&output_path, artifact)
+            .map_err(|e| anyhow::anyhow!("Failed to write {}: {}", output_path.display(), e))?;
+        eprintln!("  -> {}", output_path.display());
+    }
+
+    Ok(ExitCode::SUCCESS)
+}
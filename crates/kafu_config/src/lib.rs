@@ -5,6 +5,9 @@ use serde::{Deserialize, Serialize};
 
 pub type Result<T> = std::result::Result<T, String>;
 
+/// `KAFU_DEST` destination that lets the runtime choose among all nodes.
+pub const ANY_DESTINATION: &str = "any";
+
 #[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
 #[serde(deny_unknown_fields)]
 pub struct KafuConfig {
@@ -64,6 +67,67 @@ impl KafuConfig {
         unreachable!();
     }
 
+    /// Returns the IDs of the nodes in the given placement group, in configuration order.
+    ///
+    /// A node without `placement` forms a group named after its node ID.
+    pub fn get_placement_group_nodes(&self, group: &str) -> Vec<&str> {
+        self.nodes
+            .iter()
+            .filter(|(node_id, node)| node.placement.as_deref().unwrap_or(node_id) == group)
+            .map(|(node_id, _)| node_id.as_str())
+            .collect()
+    }
+
+    /// Returns the nodes a `KAFU_DEST` destination can resolve to, in configuration order.
+    ///
+    /// A destination is a node ID, [`ANY_DESTINATION`] for every node, or otherwise the name of a
+    /// placement group (see [`KafuConfig::get_placement_group_nodes`]).
+    pub fn get_destination_nodes(&self, dest: &str) -> Vec<&str> {
+        if let Some((node_id, _)) = self.nodes.get_key_value(dest) {
+            return vec![node_id.as_str()];
+        }
+        if dest == ANY_DESTINATION {
+            return self.nodes.keys().map(String::as_str).collect();
+        }
+        self.get_placement_group_nodes(dest)
+    }
+
+    /// Returns the path of the precompiled artifact for the given node, if the node has an `aot` section.
+    ///
+    /// Relative paths are resolved against the directory where the Kafu config file is located.
+    /// When `aot.path` is omitted, `<node-id>.cwasm` next to the config file is used.
+    pub fn get_aot_artifact_path(&self, node_id: &str) -> Option<PathBuf> {
+        let aot = self.nodes.get(node_id)?.aot.as_ref()?;
+        let path = aot
+            .path
+            .clone()
+            .unwrap_or_else(|| PathBuf::from(format!("{node_id}.cwasm")));
+        if path.is_relative() {
+            Some(self.kafu_config_dir.join(path))
+        } else {
+            Some(path)
+        }
+    }
+
+    /// Returns the models to preload on the given node, by name.
+    ///
+    /// Relative paths are resolved against the directory where the Kafu config file is located.
+    pub fn get_node_models(&self, node_id: &str) -> Vec<(String, ModelConfig)> {
+        let Some(node) = self.nodes.get(node_id) else {
+            return vec![];
+        };
+        node.models
+            .iter()
+            .map(|(name, model)| {
+                let mut model = model.clone();
+                if model.path.is_relative() {
+                    model.path = self.kafu_config_dir.join(&model.path);
+                }
+                (name.clone(), model)
+            })
+            .collect()
+    }
+
     fn validate(&self) -> Result<()> {
         if !self.kafu_config_dir.is_dir() {
             return Err(format!(
@@ -88,6 +152,31 @@ impl KafuConfig {
             if node_config.address.is_empty() {
                 return Err("Address must not be empty".to_string());
             }
+
+            if let Some(aot) = &node_config.aot
+                && aot.cpu_features.iter().any(|f| f.is_empty())
+            {
+                return Err(format!(
+                    "Node {node_id}: aot.cpu_features must not contain empty entries"
+                ));
+            }
+
+            if node_config.models.keys().any(|name| name.is_empty()) {
+                return Err(format!("Node {node_id}: model names must not be empty"));
+            }
+
+            if let Some(engine) = &node_config.engine {
+                if engine.simd == Some(false) && engine.relaxed_simd == Some(true) {
+                    return Err(format!(
+                        "Node {node_id}: engine.relaxed_simd requires engine.simd"
+                    ));
+                }
+                if engine.compile_threads == Some(0) {
+                    return Err(format!(
+                        "Node {node_id}: engine.compile_threads must be greater than 0"
+                    ));
+                }
+            }
         }
 
         if self.app.path.is_some() && self.app.url.is_some() {
@@ -235,8 +324,9 @@ pub struct NodeConfig {
     pub port: u16,
     /// Optional logical placement group for this node when running on orchestrators such as Kubernetes.
     ///
-    /// This value is not used by the core runtime itself, but by integration tools
-    /// (e.g. `kafu kustomize`) to decide how nodes are placed onto physical machines.
+    /// Integration tools (e.g. `kafu kustomize`) use it to decide how nodes are placed onto
+    /// physical machines, and `kafu_parallel_for` uses it to split work across the nodes of a
+    /// group (see [`KafuConfig::get_placement_group_nodes`]).
     /// For example, when generating Kubernetes manifests, this value can be mapped to
     /// a node label so that multiple logical Kafu nodes (Pods) share the same
     /// underlying Kubernetes node.
@@ -244,4 +334,132 @@ pub struct NodeConfig {
     /// Backward compatible: if omitted, tools should fall back to the node ID.
     #[serde(default, skip_serializing_if = "Option::is_none")]
     pub placement: Option<String>,
+    /// Ahead-of-time compilation settings for this node (optional).
+    ///
+    /// When set, `kafu compile` emits a precompiled artifact for this node and `kafu serve`
+    /// loads it instead of compiling the Wasm binary at startup.
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub aot: Option<AotConfig>,
+    /// Wasm engine tuning for this node (optional).
+    ///
+    /// Settings that affect code generation must be the same when running `kafu compile`
+    /// and `kafu serve`; both read them from this section.
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub engine: Option<EngineConfig>,
+    /// ML models that `kafu serve` loads into wasi-nn at startup, by name (optional).
+    ///
+    /// Guests get them with `wasi_nn_load_by_name`, so the model bytes never enter their memory.
+    #[serde(default, skip_serializing_if = "IndexMap::is_empty")]
+    pub models: IndexMap<String, ModelConfig>,
+}
+
+/// A model preloaded into wasi-nn.
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
+#[serde(deny_unknown_fields)]
+pub struct ModelConfig {
+    /// Path to the model file, or to a directory holding the files of a multi-file model
+    /// (e.g. OpenVINO's `model.xml` and `model.bin`).
+    /// If relative path is specified, it is relative to the directory where the Kafu config file is located.
+    pub path: PathBuf,
+    /// Format of the model file.
+    /// Default: onnx.
+    #[serde(default)]
+    pub encoding: ModelEncoding,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize, Default)]
+#[serde(rename_all = "lowercase")]
+pub enum ModelEncoding {
+    #[default]
+    Onnx,
+    Openvino,
+    Pytorch,
+    Tensorflowlite,
+    Ggml,
+}
+
+impl ModelEncoding {
+    /// Returns the name of the encoding in wasi-nn (`graph_encoding`).
+    pub fn as_str(&self) -> &'static str {
+        match self {
+            ModelEncoding::Onnx => "onnx",
+            ModelEncoding::Openvino => "openvino",
+            ModelEncoding::Pytorch => "pytorch",
+            ModelEncoding::Tensorflowlite => "tensorflowlite",
+            ModelEncoding::Ggml => "ggml",
+        }
+    }
+}
+
+/// Wasm engine tuning. Unset fields keep the runtime defaults.
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize, Default)]
+#[serde(deny_unknown_fields)]
+pub struct EngineConfig {
+    /// Code generator. `winch` compiles much faster but produces slower code.
+    /// Default: cranelift.
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub compiler: Option<EngineCompiler>,
+    /// Cranelift optimization level. Ignored by winch.
+    /// Default: speed.
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub opt_level: Option<EngineOptLevel>,
+    /// Enable the Wasm SIMD proposal.
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub simd: Option<bool>,
+    /// Enable the Wasm relaxed SIMD proposal (requires `simd`).
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub relaxed_simd: Option<bool>,
+    /// Make relaxed SIMD instructions return the same results on every host, so a program
+    /// that migrates between x86_64 and aarch64 nodes sees consistent values.
+    /// Default: true.
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub relaxed_simd_deterministic: Option<bool>,
+    /// Virtual address space reserved for each linear memory, in bytes.
+    /// Smaller reservations add bounds checks but fit devices with small address spaces.
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub memory_reservation: Option<u64>,
+    /// Size of the guard region after each linear memory, in bytes.
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub memory_guard_size: Option<u64>,
+    /// Back linear memories with transparent huge pages (Linux only).
+    /// Default: false.
+    #[serde(default, skip_serializing_if = "std::ops::Not::not")]
+    pub huge_pages: bool,
+    /// Number of threads used to compile the Wasm binary. `1` disables parallel compilation.
+    /// Default: all available cores.
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub compile_threads: Option<usize>,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize)]
+#[serde(rename_all = "lowercase")]
+pub enum EngineCompiler {
+    Cranelift,
+    Winch,
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Serialize, Deserialize)]
+#[serde(rename_all = "snake_case")]
+pub enum EngineOptLevel {
+    None,
+    Speed,
+    SpeedAndSize,
+}
+
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize, Default)]
+#[serde(deny_unknown_fields)]
+pub struct AotConfig {
+    /// Target triple to compile for (e.g. `aarch64-unknown-linux-gnu`).
+    /// Defaults to the host where `kafu compile` runs.
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    pub target: Option<String>,
+    /// CPU features to assume on the node.
+    /// Each entry is either a Cranelift ISA flag (e.g. `has_avx2`) or a preset (e.g. `x86-64-v3`).
+    #[serde(default, skip_serializing_if = "Vec::is_empty")]
+    pub cpu_features: Vec<String>,
+    /// Path to the precompiled artifact.
+    /// If relative path is specified, it is relative to the directory where the Kafu config file is located.
+    /// Default: `<node-id>.cwasm`.
+    #[serde(default, skip_serializing_if = "Option::is_none")]
+    path: Option<PathBuf>,
 }
@@ -1,4 +1,4 @@
-use kafu_config::KafuConfig;
+use kafu_config::{EngineCompiler, EngineOptLevel, KafuConfig, ModelEncoding};
 
 #[test]
 fn test_parse_and_validate() {
@@ -19,3 +19,83 @@ fn test_empty_cluster() {
     let config = KafuConfig::load("tests/fixtures/empty_cluster.yaml").unwrap_err();
     assert_eq!(config, "At least one node is required in the nodes field");
 }
+
+#[test]
+fn test_aot_artifact_path() {
+    let config = KafuConfig::load("tests/fixtures/aot.yaml").unwrap();
+    let dir = std::path::Path::new("tests/fixtures")
+        .canonicalize()
+        .unwrap();
+    let cloud1 = config.nodes.get("cloud1").unwrap().aot.as_ref().unwrap();
+    assert_eq!(cloud1.target.as_deref(), Some("x86_64-unknown-linux-gnu"));
+    assert_eq!(cloud1.cpu_features, vec!["x86-64-v3"]);
+    assert_eq!(
+        config.get_aot_artifact_path("cloud1"),
+        Some(dir.join("cloud1.cwasm"))
+    );
+    assert_eq!(
+        config.get_aot_artifact_path("edge1"),
+        Some(dir.join("artifacts/edge1.cwasm"))
+    );
+    assert_eq!(config.get_aot_artifact_path("edge2"), None);
+}
+
+#[test]
+fn test_engine_profiles() {
+    let config = KafuConfig::load("tests/fixtures/engine.yaml").unwrap();
+    let cloud1 = config.nodes.get("cloud1").unwrap().engine.as_ref().unwrap();
+    assert_eq!(cloud1.compiler, None);
+    assert_eq!(cloud1.opt_level, Some(EngineOptLevel::SpeedAndSize));
+    assert_eq!(cloud1.relaxed_simd_deterministic, Some(false));
+    assert!(cloud1.huge_pages);
+    assert_eq!(cloud1.compile_threads, Some(8));
+    let edge1 = config.nodes.get("edge1").unwrap().engine.as_ref().unwrap();
+    assert_eq!(edge1.compiler, Some(EngineCompiler::Winch));
+    assert_eq!(edge1.simd, Some(false));
+    assert_eq!(edge1.memory_reservation, Some(256 * 1024 * 1024));
+    assert_eq!(edge1.memory_guard_size, Some(64 * 1024));
+    assert!(!edge1.huge_pages);
+}
+
+#[test]
+fn test_placement_group_nodes() {
+    let config = KafuConfig::load("tests/fixtures/placement.yaml").unwrap();
+    assert_eq!(
+        config.get_placement_group_nodes("edge"),
+        vec!["edge1", "edge2"]
+    );
+    assert_eq!(config.get_placement_group_nodes("cloud1"), vec!["cloud1"]);
+    assert!(config.get_placement_group_nodes("edge1").is_empty());
+}
+
+#[test]
+fn test_destination_nodes() {
+    let config = KafuConfig::load("tests/fixtures/placement.yaml").unwrap();
+    assert_eq!(config.get_destination_nodes("edge1"), vec!["edge1"]);
+    assert_eq!(config.get_destination_nodes("edge"), vec!["edge1", "edge2"]);
+    assert_eq!(
+        config.get_destination_nodes("any"),
+        vec!["cloud1", "edge1", "edge2"]
+    );
+    assert!(config.get_destination_nodes("fog").is_empty());
+}
+
+#[test]
+fn test_node_models() {
+    let config = KafuConfig::load("tests/fixtures/models.yaml").unwrap();
+    let dir = std::path::Path::new("tests/fixtures")
+        .canonicalize()
+        .unwrap();
+    let models = config.get_node_models("edge1");
+    assert_eq!(models.len(), 2);
+    assert_eq!(models[0].0, "squeezenet");
+    assert_eq!(models[0].1.path, dir.join("models/squeezenet1.1-7.onnx"));
+    assert_eq!(models[0].1.encoding, ModelEncoding::Onnx);
+    assert_eq!(models[1].0, "detector");
+    assert_eq!(
+        models[1].1.path,
+        std::path::PathBuf::from("/opt/models/detector")
+    );
+    assert_eq!(models[1].1.encoding, ModelEncoding::Openvino);
+    assert!(config.get_node_models("cloud1").is_empty());
+}
@@ -0,0 +1,107 @@
+//! Ahead-of-time compiled artifacts produced by `kafu compile`.
+//!
+//! An artifact is a wasmtime precompiled module prefixed with a small header that records
+//! the SHA-256 digest of the Wasm binary it was compiled from. The runtime refuses to load
+//! an artifact whose digest does not match the Wasm binary in use, because Kafu metadata
+//! (migration points, destinations) is always read from the original binary.
+
+use anyhow::{bail, Context as _, Result};
+use sha2::{Digest, Sha256};
+use wasmtime::Engine;
+
+use kafu_config::EngineConfig;
+
+use super::config::{new_wasmtime_config, with_compile_threads};
+
+const ARTIFACT_MAGIC: &[u8; 8] = b"KAFUAOT1";
+const ARTIFACT_HEADER_SIZE: usize = ARTIFACT_MAGIC.len() + 32;
+
+/// Cranelift ISA flags enabled by each CPU feature preset.
+const CPU_FEATURE_PRESETS: &[(&str, &[&str])] = &[
+    (
+        "x86-64-v2",
+        &[
+            "has_sse3",
+            "has_ssse3",
+            "has_sse41",
+            "has_sse42",
+            "has_popcnt",
+        ],
+    ),
+    (
+        "x86-64-v3",
+        &[
+            "has_sse3",
+            "has_ssse3",
+            "has_sse41",
+            "has_sse42",
+            "has_popcnt",
+            "has_avx",
+            "has_avx2",
+            "has_bmi1",
+            "has_bmi2",
+            "has_fma",
+            "has_lzcnt",
+        ],
+    ),
+];
+
+/// Expands CPU feature presets into Cranelift ISA flags. Unknown names are passed through.
+fn expand_cpu_features(cpu_features: &[String]) -> Vec<&str> {
+    let mut flags = Vec::new();
+    for feature in cpu_features {
+        match CPU_FEATURE_PRESETS.iter().find(|(name, _)| name == feature) {
+            Some((_, preset)) => flags.extend_from_slice(preset),
+            None => flags.push(feature.as_str()),
+        }
+    }
+    flags.sort_unstable();
+    flags.dedup();
+    flags
+}
+
+/// Compiles `wasm` for the given target and returns a Kafu AOT artifact.
+///
+/// `engine_config` must match the node's engine settings used by `kafu serve`.
+pub fn precompile(
+    wasm: &[u8],
+    target: Option<&str>,
+    cpu_features: &[String],
+    engine_config: &EngineConfig,
+) -> Result<Vec<u8>> {
+    let mut wasmtime_config = new_wasmtime_config(engine_config);
+    if let Some(target) = target {
+        wasmtime_config
+            .target(target)
+            .with_context(|| format!("unsupported target `{target}`"))?;
+    }
+    for flag in expand_cpu_features(cpu_features) {
+        // SAFETY: the flags only describe the CPU of the node that loads the artifact.
+        // wasmtime checks them against the host CPU when the artifact is deserialized.
+        unsafe {
+            wasmtime_config.cranelift_flag_enable(flag);
+        }
+    }
+    let engine = Engine::new(&wasmtime_config)?;
+    let cwasm = with_compile_threads(engine_config, || engine.precompile_module(wasm))?
+        .context("failed to precompile module")?;
+
+    let mut artifact = Vec::with_capacity(ARTIFACT_HEADER_SIZE + cwasm.len());
+    artifact.extend_from_slice(ARTIFACT_MAGIC);
+    artifact.extend_from_slice(&Sha256::digest(wasm));
+    artifact.extend_from_slice(&cwasm);
+    Ok(artifact)
+}
+
+/// Validates the artifact header and returns the precompiled module bytes.
+pub(crate) fn artifact_payload<'a>(artifact: &'a [u8], wasm: &[u8]) -> Result<&'a [u8]> {
+    if artifact.len() < ARTIFACT_HEADER_SIZE || &artifact[..ARTIFACT_MAGIC.len()] != ARTIFACT_MAGIC
+    {
+        bail!("not a Kafu AOT artifact (re-run `kafu compile`)");
+    }
+    let digest = &artifact[ARTIFACT_MAGIC.len()..ARTIFACT_HEADER_SIZE];
+    if digest != Sha256::digest(wasm).as_slice() {
+        bail!("AOT artifact was compiled from a different Wasm binary (re-run `kafu compile`)");
+    }
+    Ok(&artifact[ARTIFACT_HEADER_SIZE..])
+}
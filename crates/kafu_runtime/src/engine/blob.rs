@@ -0,0 +1,213 @@
+//! Immutable blobs (`kafu_blob_*` in kafu_blob.h).
+//!
+//! Large read-only inputs, such as model weights or label tables, live on the host instead of in
+//! the guest's linear memory, so they never enter snapshots. A blob is identified by the SHA-256
+//! digest of its contents; the guest keeps only the 32-byte digest and copies ranges of the blob
+//! into its memory when it needs them. A node that does not hold a blob fetches it from the
+//! other nodes once, through the cluster backend, and keeps it for later reads.
+
+use std::collections::HashMap;
+use std::ops::Range;
+use std::sync::{Arc, Mutex};
+
+use anyhow::{Context as _, Result};
+use sha2::{Digest, Sha256};
+use wasmtime::{Caller, Linker, Memory};
+
+use super::store::KafuStore;
+use super::task::{check_range, guest_memory, read_str};
+
+/// SHA-256 digest of the contents of a blob.
+pub type BlobDigest = [u8; 32];
+
+/// Blobs held by this node, by digest. Blobs are kept for the lifetime of the runtime.
+#[derive(Default)]
+pub struct BlobStore {
+    blobs: Mutex<HashMap<BlobDigest, Arc<[u8]>>>,
+}
+
+impl BlobStore {
+    /// Stores `data`, unless a blob with the same contents is already held, and returns its
+    /// digest.
+    pub fn insert(&self, data: &[u8]) -> BlobDigest {
+        let digest: BlobDigest = Sha256::digest(data).into();
+        self.blobs
+            .lock()
+            .unwrap()
+            .entry(digest)
+            .or_insert_with(|| data.into());
+        digest
+    }
+
+    /// Stores a blob received from another node, checking it against `digest`.
+    pub fn insert_fetched(&self, digest: &BlobDigest, data: Vec<u8>) -> Result<Arc<[u8]>> {
+        anyhow::ensure!(
+            Sha256::digest(&data).as_slice() == digest,
+            "blob {} does not match its digest",
+            hex(digest)
+        );
+        let blob = Arc::clone(
+            self.blobs
+                .lock()
+                .unwrap()
+                .entry(*digest)
+                .or_insert_with(|| data.into()),
+        );
+        Ok(blob)
+    }
+
+    pub fn get(&self, digest: &BlobDigest) -> Option<Arc<[u8]>> {
+        self.blobs.lock().unwrap().get(digest).cloned()
+    }
+}
+
+fn hex(digest: &BlobDigest) -> String {
+    digest.iter().map(|b| format!("{b:02x}")).collect()
+}
+
+/// Reads the file at `path` as the guest sees it through WASI: relative to the preopened
+/// directory, which is mounted at `/`. Paths that leave the directory, through `..` or a
+/// symbolic link, are rejected.
+async fn read_preopened(dir: Arc<cap_std::fs::Dir>, path: String) -> Result<Vec<u8>> {
+    tokio::task::spawn_blocking(move || {
+        dir.read(path.trim_start_matches('/'))
+            .with_context(|| format!("failed to read `{path}`"))
+    })
+    .await?
+}
+
+fn read_digest(caller: &Caller<'_, KafuStore>, memory: Memory, ptr: u32) -> Result<BlobDigest> {
+    let data = memory.data(caller);
+    check_range(data.len(), ptr, 32)?;
+    Ok(data[ptr as usize..][..32].try_into().unwrap())
+}
+
+/// Returns the blob with the digest at `digest_ptr`, fetching it from the other nodes if this
+/// node does not hold it yet.
+async fn get_blob(caller: &mut Caller<'_, KafuStore>, digest_ptr: u32) -> Result<Arc<[u8]>> {
+    let memory = guest_memory(caller, "memory")?;
+    let digest = read_digest(caller, memory, digest_ptr)?;
+    let blobs = Arc::clone(&caller.data().blobs);
+    if let Some(blob) = blobs.get(&digest) {
+        return Ok(blob);
+    }
+    let cluster = caller
+        .data()
+        .cluster
+        .clone()
+        .with_context(|| format!("blob {} is not held by this node", hex(&digest)))?;
+    let data = cluster
+        .fetch_blob(digest)
+        .await?
+        .with_context(|| format!("blob {} is not held by any node", hex(&digest)))?;
+    blobs.insert_fetched(&digest, data)
+}
+
+/// Stores `data` as a blob and writes its digest at `digest_ptr`.
+fn put_blob(
+    caller: &mut Caller<'_, KafuStore>,
+    memory: Memory,
+    data: &[u8],
+    digest_ptr: u32,
+) -> Result<()> {
+    check_range(memory.data_size(&caller), digest_ptr, 32)?;
+    let digest = caller.data().blobs.insert(data);
+    memory.write(&mut *caller, digest_ptr as usize, &digest)?;
+    Ok(())
+}
+
+/// Returns the part of a `len`-byte blob that a read of `buf_len` bytes at `offset` covers.
+fn read_range(len: usize, offset: u64, buf_len: u32) -> Result<Range<usize>> {
+    anyhow::ensure!(
+        offset <= len as u64,
+        "offset {offset} is past the end of a {len}-byte blob"
+    );
+    let start = offset as usize;
+    Ok(start..len.min(start + buf_len as usize))
+}
+
+/// Links the blob functions of the `kafu` import module (see `include/kafu_blob.h`).
+pub(crate) fn link_blob_imports(linker: &mut Linker<KafuStore>) -> Result<()> {
+    linker.func_wrap(
+        "kafu",
+        "blob_put",
+        |mut caller: Caller<'_, KafuStore>, buf_ptr: u32, len: u32, digest_ptr: u32| -> i32 {
+            let result = guest_memory(&mut caller, "memory").and_then(|memory| {
+                let data = memory.data(&caller);
+                check_range(data.len(), buf_ptr, len)?;
+                let data = data[buf_ptr as usize..][..len as usize].to_vec();
+                put_blob(&mut caller, memory, &data, digest_ptr)
+            });
+            match result {
+                Ok(()) => 0,
+                Err(e) => {
+                    tracing::warn!("failed to store blob: {e:#}");
+                    1
+                }
+            }
+        },
+    )?;
+    linker.func_wrap_async(
+        "kafu",
+        "blob_load",
+        |mut caller: Caller<'_, KafuStore>, (path_ptr, path_len, digest_ptr): (u32, u32, u32)| {
+            Box::new(async move {
+                let result = async {
+                    let memory = guest_memory(&mut caller, "memory")?;
+                    let path = read_str(&caller, memory, path_ptr, path_len)?;
+                    let dir = Arc::clone(&caller.data().preopened_dir);
+                    let data = read_preopened(dir, path).await?;
+                    put_blob(&mut caller, memory, &data, digest_ptr)
+                };
+                match result.await {
+                    Ok(()) => 0i32,
+                    Err(e) => {
+                        tracing::warn!("failed to load blob: {e:#}");
+                        1
+                    }
+                }
+            })
+        },
+    )?;
+    linker.func_wrap_async(
+        "kafu",
+        "blob_size",
+        |mut caller: Caller<'_, KafuStore>, (digest_ptr,): (u32,)| {
+            Box::new(async move {
+                match get_blob(&mut caller, digest_ptr).await {
+                    Ok(blob) => blob.len() as i64,
+                    Err(e) => {
+                        tracing::warn!("failed to get blob size: {e:#}");
+                        -1
+                    }
+                }
+            })
+        },
+    )?;
+    linker.func_wrap_async(
+        "kafu",
+        "blob_read",
+        |mut caller: Caller<'_, KafuStore>,
+         (digest_ptr, offset, buf_ptr, buf_len): (u32, u64, u32, u32)| {
+            Box::new(async move {
+                let result = async {
+                    let blob = get_blob(&mut caller, digest_ptr).await?;
+                    let range = read_range(blob.len(), offset, buf_len)?;
+                    let memory = guest_memory(&mut caller, "memory")?;
+                    check_range(memory.data_size(&caller), buf_ptr, buf_len)?;
+                    let read = range.len();
+                    memory.write(&mut caller, buf_ptr as usize, &blob[range])?;
+                    Ok::<_, anyhow::Error>(read)
+                };
+                match result.await {
+                    Ok(read) => read as i64,
+                    Err(e) => {
+                        tracing::warn!("failed to read blob: {e:#}");
+                        -1
+                    }
+                }
+            })
+        },
+    )?;
+    Ok(())
+}
@@ -0,0 +1,272 @@
+//! Message channels between nodes (`kafu_channel_*` in kafu.h).
+//!
+//! A channel is a named, bounded FIFO queue of byte messages that lives on one node, its home.
+//! Guests on any node send to and receive from it through the cluster backend; a full queue
+//! makes senders wait, which propagates backpressure to producers on other nodes.
+
+use std::collections::HashMap;
+use std::sync::{Arc, Mutex};
+
+use anyhow::{Context as _, Result};
+use tokio::sync::mpsc;
+use wasmtime::{Caller, Linker};
+
+use super::store::KafuStore;
+use super::task::{check_range, cluster_backend, guest_memory, read_str};
+
+/// Capacity of a channel that receives messages before it is opened.
+pub const DEFAULT_CHANNEL_CAPACITY: u32 = 16;
+
+struct Channel {
+    /// `None` once the channel is closed.
+    sender: Mutex<Option<mpsc::Sender<Vec<u8>>>>,
+    receiver: tokio::sync::Mutex<ChannelReceiver>,
+}
+
+struct ChannelReceiver {
+    queue: mpsc::Receiver<Vec<u8>>,
+    /// The next message, taken from `queue` but too long for the receiver that asked for it.
+    held: Option<Vec<u8>>,
+}
+
+/// Outcome of receiving from a channel.
+#[derive(Debug, PartialEq, Eq)]
+pub enum Received {
+    Message(Vec<u8>),
+    /// The next message is this many bytes, more than the receiver can take. It stays first in
+    /// the channel.
+    TooLong(u32),
+    /// The channel is closed and drained.
+    Closed,
+}
+
+/// Channels whose home is this node, by name.
+#[derive(Default)]
+pub struct ChannelTable {
+    channels: Mutex<HashMap<String, Arc<Channel>>>,
+}
+
+impl ChannelTable {
+    fn get_or_open(&self, name: &str, capacity: u32) -> Arc<Channel> {
+        let mut channels = self.channels.lock().unwrap();
+        let channel = channels.entry(name.to_string()).or_insert_with(|| {
+            let (sender, receiver) = mpsc::channel(capacity.max(1) as usize);
+            Arc::new(Channel {
+                sender: Mutex::new(Some(sender)),
+                receiver: tokio::sync::Mutex::new(ChannelReceiver {
+                    queue: receiver,
+                    held: None,
+                }),
+            })
+        });
+        Arc::clone(channel)
+    }
+
+    /// Creates the channel with the given capacity, unless it already exists.
+    pub fn open(&self, name: &str, capacity: u32) {
+        self.get_or_open(name, capacity);
+    }
+
+    /// Queues a message, waiting while the channel is full.
+    pub async fn send(&self, name: &str, message: Vec<u8>) -> Result<()> {
+        let sender = self
+            .get_or_open(name, DEFAULT_CHANNEL_CAPACITY)
+            .sender
+            .lock()
+            .unwrap()
+            .clone()
+            .with_context(|| format!("channel `{name}` is closed"))?;
+        sender
+            .send(message)
+            .await
+            .map_err(|_| anyhow::anyhow!("channel `{name}` is closed"))
+    }
+
+    /// Takes the next message if it is at most `max_len` bytes, waiting while the channel is
+    /// empty. A longer message is left in the channel.
+    pub async fn recv(&self, name: &str, max_len: u32) -> Received {
+        let channel = self.get_or_open(name, DEFAULT_CHANNEL_CAPACITY);
+        let mut receiver = channel.receiver.lock().await;
+        let message = match receiver.held.take() {
+            Some(message) => message,
+            None => match receiver.queue.recv().await {
+                Some(message) => message,
+                None => return Received::Closed,
+            },
+        };
+        if message.len() > max_len as usize {
+            let len = message.len() as u32;
+            receiver.held = Some(message);
+            return Received::TooLong(len);
+        }
+        Received::Message(message)
+    }
+
+    /// Closes the channel: queued messages can still be received, new ones are rejected.
+    /// A closed channel stays closed.
+    pub fn close(&self, name: &str) {
+        self.get_or_open(name, DEFAULT_CHANNEL_CAPACITY)
+            .sender
+            .lock()
+            .unwrap()
+            .take();
+    }
+}
+
+/// Reads the channel name and home node passed by the guest.
+fn read_channel(
+    caller: &mut Caller<'_, KafuStore>,
+    name_ptr: u32,
+    name_len: u32,
+    home_ptr: u32,
+    home_len: u32,
+) -> Result<(String, String)> {
+    let memory = guest_memory(caller, "memory")?;
+    let name = read_str(caller, memory, name_ptr, name_len)?;
+    let home = read_str(caller, memory, home_ptr, home_len)?;
+    Ok((name, home))
+}
+
+/// Receives a message into the guest buffer. A message that does not fit stays in the channel.
+#[allow(clippy::too_many_arguments)]
+async fn recv(
+    caller: &mut Caller<'_, KafuStore>,
+    name_ptr: u32,
+    name_len: u32,
+    home_ptr: u32,
+    home_len: u32,
+    buf_ptr: u32,
+    buf_len: u32,
+) -> Result<Received> {
+    let cluster = cluster_backend(caller)?;
+    let (name, home) = read_channel(caller, name_ptr, name_len, home_ptr, home_len)?;
+    let memory = guest_memory(caller, "memory")?;
+    check_range(memory.data_size(&caller), buf_ptr, buf_len)?;
+    let received = cluster.channel_recv(&home, &name, buf_len).await?;
+    if let Received::Message(message) = &received {
+        memory.write(&mut *caller, buf_ptr as usize, message)?;
+    }
+    Ok(received)
+}
+
+/// Links the channel functions of the `kafu` import module (see `include/kafu.h`).
+pub(crate) fn link_channel_imports(linker: &mut Linker<KafuStore>) -> Result<()> {
+    linker.func_wrap_async(
+        "kafu",
+        "channel_open",
+        |mut caller: Caller<'_, KafuStore>,
+         (name_ptr, name_len, home_ptr, home_len, capacity): (u32, u32, u32, u32, u32)| {
+            Box::new(async move {
+                let result = async {
+                    let cluster = cluster_backend(&caller)?;
+                    let (name, home) =
+                        read_channel(&mut caller, name_ptr, name_len, home_ptr, home_len)?;
+                    cluster.channel_open(&home, &name, capacity).await
+                };
+                match result.await {
+                    Ok(()) => 0i32,
+                    Err(e) => {
+                        tracing::warn!("failed to open channel: {e:#}");
+                        1
+                    }
+                }
+            })
+        },
+    )?;
+    linker.func_wrap_async(
+        "kafu",
+        "channel_send",
+        |mut caller: Caller<'_, KafuStore>,
+         (name_ptr, name_len, home_ptr, home_len, buf_ptr, len): (
+            u32,
+            u32,
+            u32,
+            u32,
+            u32,
+            u32,
+        )| {
+            Box::new(async move {
+                let result = async {
+                    let cluster = cluster_backend(&caller)?;
+                    let (name, home) =
+                        read_channel(&mut caller, name_ptr, name_len, home_ptr, home_len)?;
+                    let memory = guest_memory(&mut caller, "memory")?;
+                    let data = memory.data(&caller);
+                    check_range(data.len(), buf_ptr, len)?;
+                    let message = data[buf_ptr as usize..][..len as usize].to_vec();
+                    cluster.channel_send(&home, &name, message).await
+                };
+                match result.await {
+                    Ok(()) => 0i32,
+                    Err(e) => {
+                        tracing::warn!("failed to send to channel: {e:#}");
+                        1
+                    }
+                }
+            })
+        },
+    )?;
+    linker.func_wrap_async(
+        "kafu",
+        "channel_recv",
+        |mut caller: Caller<'_, KafuStore>,
+         (name_ptr, name_len, home_ptr, home_len, buf_ptr, buf_len): (
+            u32,
+            u32,
+            u32,
+            u32,
+            u32,
+            u32,
+        )| {
+            Box::new(async move {
+                match recv(
+                    &mut caller,
+                    name_ptr,
+                    name_len,
+                    home_ptr,
+                    home_len,
+                    buf_ptr,
+                    buf_len,
+                )
+                .await
+                {
+                    Ok(Received::Message(message)) => message.len() as i32,
+                    Ok(Received::Closed) => -1,
+                    Ok(Received::TooLong(len)) => {
+                        tracing::warn!(
+                            "{len}-byte message does not fit in a {buf_len}-byte buffer"
+                        );
+                        -3
+                    }
+                    Err(e) => {
+                        tracing::warn!("failed to receive from channel: {e:#}");
+                        -2
+                    }
+                }
+            })
+        },
+    )?;
+    linker.func_wrap_async(
+        "kafu",
+        "channel_close",
+        |mut caller: Caller<'_, KafuStore>,
+         (name_ptr, name_len, home_ptr, home_len): (u32, u32, u32, u32)| {
+            Box::new(async move {
+                let result = async {
+                    let cluster = cluster_backend(&caller)?;
+                    let (name, home) =
+                        read_channel(&mut caller, name_ptr, name_len, home_ptr, home_len)?;
+                    cluster.channel_close(&home, &name).await
+                };
+                match result.await {
+                    Ok(()) => 0i32,
+                    Err(e) => {
+                        tracing::warn!("failed to close channel: {e:#}");
+                        1
+                    }
+                }
+            })
+        },
+    )?;
+    Ok(())
+}
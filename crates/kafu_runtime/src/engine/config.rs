@@ -1,7 +1,9 @@
 use std::path::PathBuf;
 use std::sync::{Arc, RwLock};
 
-use kafu_config::KafuConfig;
+use kafu_config::{EngineCompiler, EngineConfig, EngineOptLevel, KafuConfig, ModelConfig};
+
+use super::task::{MAX_ACTORS, MAX_CONCURRENT_TASKS};
 
 #[derive(Clone)]
 pub struct WasiConfig {
@@ -47,11 +49,135 @@ impl Default for WasiConfig {
     }
 }
 
+/// Builds the wasmtime configuration used for every Kafu engine.
+///
+/// `kafu compile` starts from the same configuration so that precompiled artifacts
+/// remain loadable by the runtime.
+pub fn new_wasmtime_config(engine_config: &EngineConfig) -> wasmtime::Config {
+    let mut wasmtime_config = wasmtime::Config::new();
+    wasmtime_config.async_support(true);
+
+    if let Some(compiler) = engine_config.compiler {
+        wasmtime_config.strategy(match compiler {
+            EngineCompiler::Cranelift => wasmtime::Strategy::Cranelift,
+            EngineCompiler::Winch => wasmtime::Strategy::Winch,
+        });
+    }
+    if let Some(opt_level) = engine_config.opt_level {
+        wasmtime_config.cranelift_opt_level(match opt_level {
+            EngineOptLevel::None => wasmtime::OptLevel::None,
+            EngineOptLevel::Speed => wasmtime::OptLevel::Speed,
+            EngineOptLevel::SpeedAndSize => wasmtime::OptLevel::SpeedAndSize,
+        });
+    }
+    // kafu clang emits SIMD128 by default, so Cranelift engines enable it explicitly rather
+    // than relying on wasmtime's defaults. Winch keeps wasmtime's per-target defaults.
+    let simd = match engine_config.compiler {
+        Some(EngineCompiler::Winch) => engine_config.simd,
+        _ => Some(engine_config.simd.unwrap_or(true)),
+    };
+    if let Some(simd) = simd {
+        wasmtime_config.wasm_simd(simd);
+        // Relaxed SIMD depends on SIMD; wasmtime rejects the combination otherwise.
+        wasmtime_config.wasm_relaxed_simd(simd && engine_config.relaxed_simd.unwrap_or(true));
+    } else if let Some(relaxed_simd) = engine_config.relaxed_simd {
+        wasmtime_config.wasm_relaxed_simd(relaxed_simd);
+    }
+    // Snapshots move between nodes with different ISAs, so relaxed SIMD results must not
+    // depend on the host unless a node opts out.
+    wasmtime_config
+        .relaxed_simd_deterministic(engine_config.relaxed_simd_deterministic.unwrap_or(true));
+    if let Some(reservation) = engine_config.memory_reservation {
+        wasmtime_config.memory_reservation(reservation);
+    }
+    if let Some(guard_size) = engine_config.memory_guard_size {
+        wasmtime_config.memory_guard_size(guard_size);
+    }
+    if let Some(threads) = engine_config.compile_threads {
+        wasmtime_config.parallel_compilation(threads > 1);
+    }
+    wasmtime_config
+}
+
+/// Runs `compile` on a dedicated thread pool when `compile_threads` is set.
+///
+/// wasmtime parallelizes compilation on the current rayon pool, so this bounds the number
+/// of compiler threads without touching the global pool used elsewhere in the runtime.
+pub(crate) fn with_compile_threads<R: Send>(
+    engine_config: &EngineConfig,
+    compile: impl FnOnce() -> R + Send,
+) -> anyhow::Result<R> {
+    match engine_config.compile_threads {
+        Some(threads) if threads > 1 => {
+            let pool = rayon::ThreadPoolBuilder::new()
+                .num_threads(threads)
+                .thread_name(|i| format!("kafu-compile-{i}"))
+                .build()?;
+            Ok(pool.install(compile))
+        }
+        _ => Ok(compile()),
+    }
+}
+
+/// Number of instance slots reserved by the pooling allocator.
+///
+/// A node runs one program at a time plus up to [`MAX_CONCURRENT_TASKS`] tasks and
+/// [`MAX_ACTORS`] actors; the spare slots let a new instance be created for a restore while the
+/// previous one is still being dropped.
+const POOLED_INSTANCES: u32 = 4 + MAX_CONCURRENT_TASKS + MAX_ACTORS;
+/// Snapify adds `snapify_memory` next to the program's own `memory`.
+const POOLED_MEMORIES_PER_INSTANCE: u32 = 2;
+/// Upper bound on table elements; C++ programs with many virtual functions need large tables.
+const POOLED_TABLE_ELEMENTS: usize = 100_000;
+
+/// Builds the engine used to run Kafu programs.
+///
+/// Instance slots (memories, tables and async stacks) are pre-reserved by the pooling
+/// allocator and recycled across instantiations. When the host cannot reserve them
+/// (e.g. small virtual address spaces on 32-bit devices), falls back to on-demand allocation.
+///
+/// `wasm_backtrace` is only needed by modules using the legacy migration point import, which
+/// locates its caller by walking the stack.
+pub(crate) fn new_runtime_engine(
+    engine_config: &EngineConfig,
+    wasm_backtrace: bool,
+) -> anyhow::Result<wasmtime::Engine> {
+    let mut pooling = wasmtime::PoolingAllocationConfig::default();
+    pooling
+        .total_core_instances(POOLED_INSTANCES)
+        .total_memories(POOLED_INSTANCES * POOLED_MEMORIES_PER_INSTANCE)
+        .total_tables(POOLED_INSTANCES)
+        .total_stacks(POOLED_INSTANCES)
+        .max_memories_per_module(POOLED_MEMORIES_PER_INSTANCE)
+        .table_elements(POOLED_TABLE_ELEMENTS);
+    if let Some(reservation) = engine_config.memory_reservation {
+        // Slots cannot move, so a memory may not outgrow its reservation.
+        pooling.max_memory_size(reservation as usize);
+    }
+
+    let mut wasmtime_config = new_wasmtime_config(engine_config);
+    wasmtime_config.wasm_backtrace(wasm_backtrace);
+    wasmtime_config.allocation_strategy(wasmtime::InstanceAllocationStrategy::Pooling(pooling));
+    match wasmtime::Engine::new(&wasmtime_config) {
+        Ok(engine) => Ok(engine),
+        Err(e) => {
+            tracing::warn!("pooling allocator unavailable, using on-demand allocation: {e:#}");
+            let mut wasmtime_config = new_wasmtime_config(engine_config);
+            wasmtime_config.wasm_backtrace(wasm_backtrace);
+            wasmtime::Engine::new(&wasmtime_config)
+        }
+    }
+}
+
 #[derive(Clone)]
 pub struct KafuRuntimeConfig {
     pub node_id: String,
     pub wasi_config: WasiConfig,
     pub linker_config: LinkerConfig,
+    /// Per-node engine tuning (`nodes.<id>.engine` in the Kafu config).
+    pub engine_config: EngineConfig,
+    /// Models preloaded into wasi-nn, by name (`nodes.<id>.models` in the Kafu config).
+    pub models: Vec<(String, ModelConfig)>,
 }
 
 #[derive(Debug, Clone)]
@@ -59,6 +185,7 @@ pub struct LinkerConfig {
     pub wasip1: bool,
     pub wasi_nn: bool,
     pub spectest: bool,
+    /// Kafu host API: the `kafu_helper` and `kafu` import modules.
     pub kafu_helper: bool,
     pub snapify: LinkerSnapifyConfig,
 }
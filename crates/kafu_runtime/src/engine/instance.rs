@@ -1,19 +1,33 @@
-use std::sync::Arc;
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicU32, AtomicU64, Ordering};
+use std::sync::{Arc, OnceLock};
 use std::time::Instant;
 
 use anyhow::{Context as _, Result};
 use rayon::prelude::*;
-use wasmtime::{Engine, Instance, Module, Store, TypedFunc};
+use tokio::sync::{Mutex, Semaphore};
+use wasmtime::{Engine, Instance, InstancePre, Linker, Module, Ref, Store, TypedFunc};
 
 use super::store::MAIN_MEMORY_PAGE_SIZE;
 use wasmtime_wasi_nn::preload;
-use wasmtime_wast::{Async, WastContext};
 
-use super::config::KafuRuntimeConfig;
-use super::linker::{link_imports, wasi_ctx};
-use super::migration::{MigrationContext, MigrationStackEntry, PendingMigration};
+use super::blob::BlobStore;
+use super::channel::ChannelTable;
+use super::config::{new_runtime_engine, with_compile_threads, KafuRuntimeConfig};
+use super::kafu_metadata::MigrationPointAbi;
+use super::linker::{link_imports, open_preopened_dir, wasi_ctx};
+use super::migration::{
+    publish_node_state, MigrationContext, MigrationStackEntry, PendingMigration,
+};
+use super::models::ModelRegistry;
 use super::module::WasmModule;
+use super::placement::NodeLoad;
+use super::scratch::ScratchRanges;
 use super::store::{KafuLibraryContext, KafuStore};
+use super::task::{
+    ClusterBackend, Task, TaskInput, TaskTable, FUNCTION_TABLE_EXPORT, MAX_ACTORS,
+    MAX_CONCURRENT_TASKS, TASK_INIT_EXPORT,
+};
 
 /// Delta pages for baseline comparison.
 type SnapshotMemoryDelta = Vec<(u32, Vec<u8>)>;
@@ -21,60 +35,304 @@ type SnapshotMemoryDelta = Vec<(u32, Vec<u8>)>;
 pub struct KafuRuntimeInstance {
     instance: Instance,
     store: Store<KafuStore>,
+    /// Back linear memories with transparent huge pages (`engine.huge_pages`).
+    huge_pages: bool,
     /// Cached for fast restore; resolved lazily so modules without snapify exports can still start().
     start_restore_func: Option<TypedFunc<(), ()>>,
     restore_globals_func: Option<TypedFunc<(), ()>>,
     start_func: Option<TypedFunc<(), ()>>,
 }
 
-impl KafuRuntimeInstance {
-    pub async fn new(wasm: Arc<WasmModule>, config: &KafuRuntimeConfig) -> Result<Self> {
-        let mut wasmtime_config = wasmtime::Config::new();
-        wasmtime_config.async_support(true);
-        wasmtime_config.wasm_backtrace(true);
-        let engine = Engine::new(&wasmtime_config)?;
+/// A module pre-linked against the Kafu host imports.
+///
+/// Compilation, import resolution and type-checking happen once in [`KafuRuntimePre::new`];
+/// [`KafuRuntimePre::instantiate`] then only allocates a store and an instance slot from the
+/// engine's pooling allocator, which makes restarts and restores cheap.
+pub struct KafuRuntimePre {
+    engine: Engine,
+    instance_pre: InstancePre<KafuStore>,
+    module: Arc<WasmModule>,
+    config: KafuRuntimeConfig,
+    /// Runs tasks spawned by the guest (see [`KafuRuntimePre::set_cluster`]).
+    cluster: OnceLock<Arc<dyn ClusterBackend>>,
+    /// Bounds the number of tasks executing on this node at once.
+    task_slots: Semaphore,
+    /// Tasks executing or waiting for a slot (see [`KafuRuntimePre::load`]).
+    pending_tasks: AtomicU32,
+    /// Actors living on this node, by ID. Calls to one actor are serialized by its lock.
+    actors: Mutex<HashMap<u64, Arc<Mutex<Actor>>>>,
+    next_actor_id: AtomicU64,
+    /// Channels whose home is this node.
+    channels: ChannelTable,
+    /// Blobs held by this node.
+    blobs: Arc<BlobStore>,
+    /// Models preloaded into wasi-nn, shared by every instance.
+    models: ModelRegistry,
+}
+
+/// An instance kept alive for the calls of an actor.
+struct Actor {
+    instance: KafuRuntimeInstance,
+    /// Pages grown for task arguments, reused by later calls.
+    arguments: Option<ArgumentRegion>,
+}
+
+fn ensure_actor_slot(actors: &HashMap<u64, Arc<Mutex<Actor>>>) -> Result<()> {
+    anyhow::ensure!(
+        actors.len() < MAX_ACTORS as usize,
+        "too many actors on this node (at most {MAX_ACTORS})"
+    );
+    Ok(())
+}
+
+/// Counts a task in [`KafuRuntimePre::load`] until it finishes or is cancelled.
+struct PendingTask<'a>(&'a AtomicU32);
+
+impl Drop for PendingTask<'_> {
+    fn drop(&mut self) {
+        self.0.fetch_sub(1, Ordering::Relaxed);
+    }
+}
+
+/// Memory grown past the guest's heap to hold the input and output regions of a task.
+#[derive(Debug, Clone, Copy)]
+struct ArgumentRegion {
+    base: u64,
+    len: u64,
+}
+
+impl KafuRuntimePre {
+    pub fn new(wasm: Arc<WasmModule>, config: &KafuRuntimeConfig) -> Result<Self> {
+        let migration_point_abi = wasm.metadata.migration_point_abi;
+        let engine = new_runtime_engine(
+            &config.engine_config,
+            migration_point_abi == MigrationPointAbi::Legacy,
+        )?;
+
+        let main_module = match &wasm.precompiled {
+            // SAFETY: the artifact was produced by `kafu compile` with the same engine
+            // configuration, and its header was checked against the WASM binary.
+            Some(precompiled) => unsafe { Module::deserialize(&engine, precompiled) }
+                .context("failed to load precompiled module")?,
+            None => {
+                with_compile_threads(&config.engine_config, || Module::new(&engine, &wasm.wasm))??
+            }
+        };
+
+        let mut linker: Linker<KafuStore> = Linker::new(&engine);
+        link_imports(&config.linker_config, &mut linker, migration_point_abi)?;
+        let instance_pre = linker
+            .instantiate_pre(&main_module)
+            .context("failed to link main module")?;
+        let models = ModelRegistry::load(&config.models)?;
+
+        Ok(Self {
+            engine,
+            instance_pre,
+            module: wasm,
+            config: config.clone(),
+            cluster: OnceLock::new(),
+            task_slots: Semaphore::new(MAX_CONCURRENT_TASKS as usize),
+            pending_tasks: AtomicU32::new(0),
+            actors: Mutex::new(HashMap::new()),
+            next_actor_id: AtomicU64::new(1),
+            channels: ChannelTable::default(),
+            blobs: Arc::default(),
+            models,
+        })
+    }
+
+    /// Sets the backend that runs tasks spawned by instances created afterwards.
+    /// Without one, spawning a task fails. Can only be set once.
+    pub fn set_cluster(&self, cluster: Arc<dyn ClusterBackend>) -> Result<()> {
+        self.cluster
+            .set(cluster)
+            .map_err(|_| anyhow::anyhow!("cluster backend is already set"))
+    }
+
+    /// Channels whose home is this node (see `kafu_channel_open` in kafu.h).
+    pub fn channels(&self) -> &ChannelTable {
+        &self.channels
+    }
 
-        let main_module = Module::new(&engine, &wasm.wasm)?;
+    /// Blobs held by this node (see `kafu_blob_put` in kafu_blob.h).
+    pub fn blobs(&self) -> &BlobStore {
+        &self.blobs
+    }
+
+    /// Create a fresh instance of the pre-linked module.
+    pub async fn instantiate(&self) -> Result<KafuRuntimeInstance> {
+        self.instantiate_on(&self.config.node_id, false).await
+    }
+
+    /// Runs `task` on behalf of `node_id` and returns its output region.
+    ///
+    /// The task runs in a fresh instance, or in the instance of `task.actor`.
+    pub async fn run_task(&self, node_id: &str, task: Task) -> Result<Vec<u8>> {
+        if let Some(id) = task.actor {
+            let actor = self
+                .actors
+                .lock()
+                .await
+                .get(&id)
+                .cloned()
+                .with_context(|| format!("actor {id} does not exist"))?;
+            anyhow::ensure!(
+                matches!(task.input, TaskInput::Arguments { .. }),
+                "actor methods only take arguments"
+            );
+            let mut actor = actor.lock().await;
+            let Actor {
+                instance,
+                arguments,
+            } = &mut *actor;
+            return instance.run_task(task, arguments).await;
+        }
+        self.pending_tasks.fetch_add(1, Ordering::Relaxed);
+        let _pending = PendingTask(&self.pending_tasks);
+        let _slot = self.task_slots.acquire().await?;
+        let mut instance = self.instantiate_on(node_id, true).await?;
+        if matches!(task.input, TaskInput::Arguments { .. }) {
+            instance.run_init().await?;
+        }
+        instance.run_task(task, &mut None).await
+    }
+
+    /// Returns the tasks executing and waiting on this node, for load-aware placement.
+    pub fn load(&self) -> NodeLoad {
+        let running_tasks = MAX_CONCURRENT_TASKS - self.task_slots.available_permits() as u32;
+        let pending_tasks = self.pending_tasks.load(Ordering::Relaxed);
+        NodeLoad {
+            running_tasks,
+            queued_tasks: pending_tasks.saturating_sub(running_tasks),
+            latency: None,
+            unreachable: false,
+        }
+    }
+
+    /// Creates an actor: a pristine instance, with its constructors run, that stays alive until
+    /// [`KafuRuntimePre::destroy_actor`] or the end of the program run
+    /// ([`KafuRuntimePre::drop_actors`]). Returns its ID.
+    pub async fn create_actor(&self, node_id: &str) -> Result<u64> {
+        ensure_actor_slot(&*self.actors.lock().await)?;
+        // The map is not locked while the instance is created, so that calls to other actors
+        // go on. The limit is checked again for actors created in the meantime.
+        let mut instance = self.instantiate_on(node_id, true).await?;
+        instance.run_init().await?;
+        let mut actors = self.actors.lock().await;
+        ensure_actor_slot(&actors)?;
+        let id = self.next_actor_id.fetch_add(1, Ordering::Relaxed);
+        actors.insert(
+            id,
+            Arc::new(Mutex::new(Actor {
+                instance,
+                arguments: None,
+            })),
+        );
+        Ok(id)
+    }
 
-        let wasi = wasi_ctx(&config.wasi_config)?;
-        let (backends, registry) = preload(&[])?;
-        let wasi_nn = wasmtime_wasi_nn::witx::WasiNnCtx::new(backends, registry);
-        let wast = WastContext::new(&engine, Async::No, |_| {});
+    pub async fn destroy_actor(&self, id: u64) -> Result<()> {
+        self.actors
+            .lock()
+            .await
+            .remove(&id)
+            .map(drop)
+            .with_context(|| format!("actor {id} does not exist"))
+    }
+
+    /// Drops every actor on this node. Actors belong to one program run, so this is called when
+    /// the run ends, even if the program did not destroy them.
+    pub async fn drop_actors(&self) {
+        let actors = std::mem::take(&mut *self.actors.lock().await);
+        if !actors.is_empty() {
+            tracing::debug!("dropping {} actors left by the program", actors.len());
+        }
+    }
+
+    async fn instantiate_on(&self, node_id: &str, is_task: bool) -> Result<KafuRuntimeInstance> {
+        let preopened_dir = Arc::new(open_preopened_dir(&self.config.wasi_config)?);
+        let wasi = wasi_ctx(&self.config.wasi_config, &preopened_dir)?;
+        let (backends, _) = preload(&[])?;
+        let wasi_nn = wasmtime_wasi_nn::witx::WasiNnCtx::new(backends, self.models.registry());
 
         let mut store = Store::new(
-            &engine,
+            &self.engine,
             KafuStore {
-                node_id: config.node_id.clone(),
+                node_id: node_id.to_string(),
                 libctx: KafuLibraryContext {
                     wasi,
                     wasi_nn,
                     kafu_helper: crate::witx::KafuHelperCtx::new(),
-                    _wast: wast,
                 },
-                module: wasm,
+                module: Arc::clone(&self.module),
                 migration_ctx: MigrationContext {
                     pending_migration_request: None,
                     migration_stack: vec![],
+                    region_target: None,
                 },
+                node_state: None,
+                cluster: self.cluster.get().cloned(),
+                tasks: TaskTable::default(),
+                is_task,
+                scratch: ScratchRanges::default(),
+                free_span_table: None,
+                blobs: Arc::clone(&self.blobs),
+                preopened_dir,
                 baseline_main_memory: None,
                 baseline_snapify_memory: None,
             },
         );
 
-        let mut linker: wasmtime::Linker<KafuStore> = wasmtime::Linker::new(&engine);
-        link_imports(&config.linker_config, &mut linker, &mut store)?;
-
-        let instance = linker
-            .instantiate_async(&mut store, &main_module)
+        let instance = self
+            .instance_pre
+            .instantiate_async(&mut store)
             .await
             .context("failed to instantiate main module")?;
-        Ok(Self {
+        let mut instance = KafuRuntimeInstance {
             instance,
             store,
+            huge_pages: self.config.engine_config.huge_pages,
             start_restore_func: None,
             restore_globals_func: None,
             start_func: None,
-        })
+        };
+        instance.advise_huge_pages("memory");
+        instance.advise_huge_pages("snapify_memory");
+        instance.init_node_state()?;
+        instance.init_free_span_table();
+        Ok(instance)
+    }
+}
+
+impl KafuRuntimeInstance {
+    /// Compile, link and instantiate `wasm` in one step.
+    ///
+    /// Prefer [`KafuRuntimePre`] when more than one instance of the same module is needed.
+    pub async fn new(wasm: Arc<WasmModule>, config: &KafuRuntimeConfig) -> Result<Self> {
+        KafuRuntimePre::new(wasm, config)?.instantiate().await
+    }
+
+    /// Locates the guest-visible node state of kafu.h and publishes the current node.
+    ///
+    /// kafu clang exports the address of `__kafu_node_state` as a global. Reading it runs no
+    /// guest code: every export of a command module runs the static constructors first.
+    fn init_node_state(&mut self) -> Result<()> {
+        let Some(addr) = self.global_u32("__kafu_node_state") else {
+            return Ok(());
+        };
+        let memory = self
+            .instance
+            .get_memory(&mut self.store, "memory")
+            .context("memory export `memory` not found")?;
+        self.store.data_mut().node_state = Some((memory, addr));
+        publish_node_state(&mut self.store)
+    }
+
+    /// Locates the free-span table of kafu_memory.h, if any. Like the node state, its address is
+    /// an exported global, so no guest code runs.
+    fn init_free_span_table(&mut self) {
+        self.store.data_mut().free_span_table = self.global_u32("__kafu_free_spans");
     }
 
     fn get_or_resolve_start_restore(&mut self) -> Result<&TypedFunc<(), ()>> {
@@ -147,6 +405,9 @@ impl KafuRuntimeInstance {
         let restore_globals = self.get_or_resolve_restore_globals()?.clone();
         restore_globals.call_async(&mut self.store, ()).await?;
 
+        // The snapshot carries the sender's node state; overwrite it with ours.
+        publish_node_state(&mut self.store)?;
+
         tracing::debug!(
             "{}: Restore completed (total={:.3}s mem={:.3}s)",
             self.store.data().get_node_id(),
@@ -157,6 +418,112 @@ impl KafuRuntimeInstance {
         Ok(())
     }
 
+    /// Sets the scratch ranges of the main memory, e.g. those carried by a migration along with
+    /// the snapshot passed to restore().
+    pub fn set_scratch_ranges(&mut self, scratch: ScratchRanges) {
+        self.store.data_mut().scratch = scratch;
+    }
+
+    /// Runs a task in this instance and returns the contents of its output region.
+    ///
+    /// `arguments` is where argument-only tasks place their input and output; it is grown as
+    /// needed and kept for the next task in the same instance.
+    async fn run_task(
+        &mut self,
+        task: Task,
+        arguments: &mut Option<ArgumentRegion>,
+    ) -> Result<Vec<u8>> {
+        let (in_ptr, in_len, out_ptr) = match task.input {
+            TaskInput::Snapshot {
+                main_memory,
+                snapify_memory,
+                in_ptr,
+                in_len,
+                out_ptr,
+            } => {
+                self.grow_and_restore_memory("memory", &main_memory)?;
+                self.grow_and_restore_memory("snapify_memory", &snapify_memory)?;
+                // Unlike restore(), no stack is rewound: only the globals are brought back.
+                let restore_globals = self.get_or_resolve_restore_globals()?.clone();
+                restore_globals.call_async(&mut self.store, ()).await?;
+                publish_node_state(&mut self.store)?;
+                (in_ptr, in_len, out_ptr)
+            }
+            TaskInput::Arguments { input } => {
+                self.place_task_arguments(&input, task.out_len, arguments)?
+            }
+        };
+
+        let table = self
+            .instance
+            .get_table(&mut self.store, FUNCTION_TABLE_EXPORT)
+            .with_context(|| format!("table export `{FUNCTION_TABLE_EXPORT}` not found"))?;
+        let func = match table.get(&mut self.store, u64::from(task.function)) {
+            Some(Ref::Func(Some(func))) => func,
+            _ => anyhow::bail!("function pointer {} is not valid", task.function),
+        };
+        func.typed::<(u32, u32, u32, u32), ()>(&self.store)
+            .context("task function has the wrong signature")?
+            .call_async(&mut self.store, (in_ptr, in_len, out_ptr, task.out_len))
+            .await
+            .context("task trapped")?;
+
+        let memory = self
+            .instance
+            .get_memory(&mut self.store, "memory")
+            .context("memory export `memory` not found")?;
+        let data = memory.data(&self.store);
+        let end = out_ptr as usize + task.out_len as usize;
+        anyhow::ensure!(end <= data.len(), "task output region is out of bounds");
+        Ok(data[out_ptr as usize..end].to_vec())
+    }
+
+    /// Runs the guest's constructors through the exported init function, if any.
+    async fn run_init(&mut self) -> Result<()> {
+        if let Ok(init) = self
+            .instance
+            .get_typed_func::<(), ()>(&mut self.store, TASK_INIT_EXPORT)
+        {
+            init.call_async(&mut self.store, ()).await?;
+        }
+        Ok(())
+    }
+
+    /// Places the input of an argument-only task, followed by its output region, in pages grown
+    /// past the end of memory so that the guest's stack and heap are left untouched.
+    fn place_task_arguments(
+        &mut self,
+        input: &[u8],
+        out_len: u32,
+        arguments: &mut Option<ArgumentRegion>,
+    ) -> Result<(u32, u32, u32)> {
+        let memory = self
+            .instance
+            .get_memory(&mut self.store, "memory")
+            .context("memory export `memory` not found")?;
+        let in_len = u32::try_from(input.len()).context("task input is too large")?;
+        // Keep the output region 16-byte aligned for SIMD loads and stores.
+        let out_offset = (u64::from(in_len) + 15) & !15;
+        let len = out_offset + u64::from(out_len);
+        let region = match *arguments {
+            Some(region) if region.len >= len => region,
+            _ => {
+                let pages = len.div_ceil(MAIN_MEMORY_PAGE_SIZE as u64);
+                let base = memory.grow(&mut self.store, pages)? * MAIN_MEMORY_PAGE_SIZE as u64;
+                ArgumentRegion {
+                    base,
+                    len: pages * MAIN_MEMORY_PAGE_SIZE as u64,
+                }
+            }
+        };
+        *arguments = Some(region);
+        memory.write(&mut self.store, region.base as usize, input)?;
+        let in_ptr = u32::try_from(region.base).context("task arguments exceed 32-bit memory")?;
+        let out_ptr = u32::try_from(region.base + out_offset)
+            .context("task arguments exceed 32-bit memory")?;
+        Ok((in_ptr, in_len, out_ptr))
+    }
+
     /// Resume program execution after a successful restore().
     ///
     /// This invokes the WASM module's exported start function (`_start`).
@@ -174,11 +541,44 @@ impl KafuRuntimeInstance {
         let delta = memory_page_size.saturating_sub(current);
         if delta > 0 {
             mem_instance.grow(&mut self.store, delta)?;
+            // Advise before writing so the restored pages are faulted in as huge pages.
+            self.advise_huge_pages(memory_name);
         }
         mem_instance.write(&mut self.store, 0, memory)?;
         Ok(())
     }
 
+    /// Ask the kernel to back the accessible part of a linear memory with transparent huge
+    /// pages. Best effort: failures are logged and ignored.
+    fn advise_huge_pages(&mut self, memory_name: &str) {
+        if !self.huge_pages {
+            return;
+        }
+        let Some(mem_instance) = self.instance.get_memory(&mut self.store, memory_name) else {
+            return;
+        };
+        #[cfg(target_os = "linux")]
+        {
+            let ptr = mem_instance.data_ptr(&self.store);
+            let len = mem_instance.data_size(&self.store);
+            // SAFETY: the range is the memory's own mapping; MADV_HUGEPAGE only changes how the
+            // kernel backs it and never its contents.
+            let ret = unsafe { libc::madvise(ptr.cast(), len, libc::MADV_HUGEPAGE) };
+            if ret != 0 {
+                tracing::debug!(
+                    "madvise(MADV_HUGEPAGE) on `{}` failed: {}",
+                    memory_name,
+                    std::io::Error::last_os_error()
+                );
+            }
+        }
+        #[cfg(not(target_os = "linux"))]
+        {
+            let _ = mem_instance;
+            tracing::debug!("huge pages are only supported on Linux; ignoring for `{memory_name}`");
+        }
+    }
+
     /// Invoke the start function in the WASM module.
     /// In modules processed by Snapify, the start function is exported with the name `_start`.
     pub async fn start(&mut self) -> Result<()> {
@@ -208,6 +608,8 @@ impl KafuRuntimeInstance {
 
     /// Precondition: The program is suspended.
     /// Fills the provided buffers to avoid allocations; buffers are resized to match memory sizes.
+    /// Scratch ranges, free heap spans and the dead part of the shadow stack are zeroed in
+    /// `main_buf`.
     pub async fn get_snapshot_into(
         &mut self,
         main_buf: &mut Vec<u8>,
@@ -226,6 +628,10 @@ impl KafuRuntimeInstance {
         let main_slice = main_mem.data(&mut self.store);
         main_buf.resize(main_slice.len(), 0);
         main_buf.copy_from_slice(main_slice);
+        let scratch = self
+            .checkpoint_scratch()
+            .with_free_spans(main_buf, self.store.data().free_span_table);
+        scratch.zero(main_buf, 0);
 
         let snapify_mem = self
             .instance
@@ -241,6 +647,8 @@ impl KafuRuntimeInstance {
     /// Checkpoint globals and compute delta pages against the stored baseline (last restore).
     ///
     /// This avoids copying the full linear memory into a temporary Vec before diffing.
+    /// Scratch ranges, free heap spans and the dead part of the shadow stack are diffed and sent
+    /// as zeros.
     /// Returns:
     /// - delta pages for main memory
     /// - delta pages for snapify memory
@@ -265,6 +673,8 @@ impl KafuRuntimeInstance {
         else {
             return Ok(None);
         };
+        let scratch = self.checkpoint_scratch();
+        let free_span_table = self.store.data().free_span_table;
 
         let checkpoint_globals = self
             .instance
@@ -280,8 +690,9 @@ impl KafuRuntimeInstance {
                 .get_memory(&mut self.store, "memory")
                 .context("memory export `memory` not found")?;
             let main_slice = main_mem.data(&mut self.store);
+            let scratch = scratch.with_free_spans(main_slice, free_span_table);
             (
-                compute_memory_delta_pages(baseline_main.as_slice(), main_slice, "main"),
+                compute_memory_delta_pages(baseline_main.as_slice(), main_slice, &scratch, "main"),
                 main_slice.len(),
             )
         };
@@ -293,7 +704,12 @@ impl KafuRuntimeInstance {
                 .context("memory export `snapify_memory` not found")?;
             let snapify_slice = snapify_mem.data(&mut self.store);
             (
-                compute_memory_delta_pages(baseline_snapify.as_slice(), snapify_slice, "snapify"),
+                compute_memory_delta_pages(
+                    baseline_snapify.as_slice(),
+                    snapify_slice,
+                    &ScratchRanges::default(),
+                    "snapify",
+                ),
                 snapify_slice.len(),
             )
         };
@@ -319,10 +735,14 @@ impl KafuRuntimeInstance {
         &mut self,
         current_main_memory: &[u8],
     ) -> Option<SnapshotMemoryDelta> {
-        let baseline = self.store.data().baseline_main_memory.as_deref()?;
+        let scratch = self.checkpoint_scratch();
+        let store = self.store.data();
+        let baseline = store.baseline_main_memory.as_deref()?;
+        let scratch = scratch.with_free_spans(current_main_memory, store.free_span_table);
         Some(compute_memory_delta_pages(
             baseline,
             current_main_memory,
+            &scratch,
             "main",
         ))
     }
@@ -335,32 +755,65 @@ impl KafuRuntimeInstance {
         Some(compute_memory_delta_pages(
             baseline,
             current_snapify_memory,
+            &ScratchRanges::default(),
             "snapify",
         ))
     }
 
+    /// Returns the scratch ranges plus the dead part of the C shadow stack, which grows down
+    /// from `__stack_high`: [`__stack_low`, `__stack_pointer`). kafu clang exports both
+    /// globals; modules without them keep their whole stack in snapshots.
+    fn checkpoint_scratch(&mut self) -> ScratchRanges {
+        let mut scratch = self.store.data().scratch.clone();
+        if let (Some(low), Some(sp)) = (
+            self.global_u32("__stack_low"),
+            self.global_u32("__stack_pointer"),
+        ) {
+            scratch.mark(low as usize..sp as usize);
+        }
+        scratch
+    }
+
+    fn global_u32(&mut self, name: &str) -> Option<u32> {
+        let global = self.instance.get_global(&mut self.store, name)?;
+        global.get(&mut self.store).i32().map(|value| value as u32)
+    }
+
     pub fn get_store(&self) -> &Store<KafuStore> {
         &self.store
     }
 }
 
-fn compute_memory_delta_pages(baseline: &[u8], current: &[u8], label: &str) -> SnapshotMemoryDelta {
+fn compute_memory_delta_pages(
+    baseline: &[u8],
+    current: &[u8],
+    scratch: &ScratchRanges,
+    label: &str,
+) -> SnapshotMemoryDelta {
     let mut delta_pages = Vec::new();
     let overlap = baseline.len().min(current.len());
     let mut page_index = 0u32;
     let mut offset = 0;
     while offset < current.len() {
         let end = (offset + MAIN_MEMORY_PAGE_SIZE).min(current.len());
+        // Pages with scratch bytes are compared and sent with those bytes zeroed.
+        let masked = scratch.overlaps(offset..end).then(|| {
+            let mut page = current[offset..end].to_vec();
+            scratch.zero(&mut page, offset);
+            page
+        });
+        let page = masked.as_deref().unwrap_or(&current[offset..end]);
         let differs = if offset < overlap {
             let base_end = (offset + MAIN_MEMORY_PAGE_SIZE).min(baseline.len());
-            baseline[offset..base_end] != current[offset..base_end]
+            baseline[offset..base_end] != page[..base_end - offset]
         } else {
-            true
+            // New pages are zero-filled on the receiver, so all-zero ones can be left out.
+            masked.is_none() || page.iter().any(|&b| b != 0)
         };
         if differs {
             // Copy only pages that actually differ to reduce allocations and memcpy costs.
             // This is performance-critical for checkpoint on slower devices.
-            let page_data = current[offset..end].to_vec();
+            let page_data = masked.unwrap_or_else(|| current[offset..end].to_vec());
             delta_pages.push((page_index, page_data));
         }
         page_index += 1;
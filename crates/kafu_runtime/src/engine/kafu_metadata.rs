@@ -1,10 +1,20 @@
 use anyhow::Result;
 use std::collections::HashMap;
-use wasmparser::{Parser, Payload};
+use wasmparser::{Parser, Payload, TypeRef, ValType};
 
 #[derive(Debug, Clone)]
 pub struct KafuModuleMetadata {
-    pub functions: HashMap<u32, KafuFunctionMetadata>,
+    /// Function metadata indexed by function index (dense; `None` for functions without
+    /// KAFU_DEST), so migration points resolve their function with a single bounds-checked load.
+    pub functions: Vec<Option<KafuFunctionMetadata>>,
+    /// Signature of the `snapify.should_checkpoint` import.
+    pub migration_point_abi: MigrationPointAbi,
+}
+
+impl KafuModuleMetadata {
+    pub(crate) fn function(&self, func_idx: u32) -> Option<&KafuFunctionMetadata> {
+        self.functions.get(func_idx as usize)?.as_ref()
+    }
 }
 
 #[derive(Debug, Clone)]
@@ -15,11 +25,86 @@ pub struct KafuFunctionMetadata {
     pub dest: Option<String>,
 }
 
+/// Signature of the `snapify.should_checkpoint` import emitted by Snapify.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum MigrationPointAbi {
+    /// The module does not import `snapify.should_checkpoint`.
+    None,
+    /// `(reason: i32) -> i32`: the runtime captures a backtrace to find the calling
+    /// function and the stack depth.
+    Legacy,
+    /// `(reason: i32, func_idx: i32, stack_depth: i32) -> i32`: the guest passes the calling
+    /// function and the stack depth, so no backtrace is needed.
+    Indexed,
+}
+
+/// Rejects wasi-threads guests.
+///
+/// A snapshot holds a single Asyncify stack, and migration resumes a single `Store`; threads
+/// spawned through `wasi.thread-spawn` (which share linear memory with the main thread) would
+/// be lost or left running on the source node.
+fn ensure_single_threaded(import: &wasmparser::Import<'_>) -> Result<()> {
+    let shared_memory = matches!(import.ty, TypeRef::Memory(memory) if memory.shared);
+    if (import.module, import.name) == ("wasi", "thread-spawn") || shared_memory {
+        anyhow::bail!(
+            "wasi-threads modules are not supported: `{}.{}` imports {}; build without `-pthread` \
+             and the wasm32-wasip1-threads target",
+            import.module,
+            import.name,
+            if shared_memory {
+                "a shared memory"
+            } else {
+                "thread spawning"
+            }
+        );
+    }
+    Ok(())
+}
+
 /// Precondition: data is a binary of the WASM module.
 pub(crate) fn go(data: &[u8]) -> Result<KafuModuleMetadata> {
     let mut function_name_to_index_map = HashMap::new();
+    let mut func_types = Vec::new();
+    let mut migration_point_abi = MigrationPointAbi::None;
     for payload in Parser::new(0).parse_all(data) {
         match payload.expect("parse error") {
+            Payload::TypeSection(section) => {
+                for func_type in section.into_iter_err_on_gc_types() {
+                    func_types.push(func_type?);
+                }
+            }
+            Payload::ImportSection(section) => {
+                for import in section {
+                    let import = import?;
+                    ensure_single_threaded(&import)?;
+                    if import.module != "snapify" || import.name != "should_checkpoint" {
+                        continue;
+                    }
+                    let TypeRef::Func(type_idx) = import.ty else {
+                        continue;
+                    };
+                    let params = func_types
+                        .get(type_idx as usize)
+                        .map(|ty| ty.params())
+                        .unwrap_or_default();
+                    migration_point_abi = match params {
+                        [ValType::I32] => MigrationPointAbi::Legacy,
+                        [ValType::I32, ValType::I32, ValType::I32] => MigrationPointAbi::Indexed,
+                        _ => anyhow::bail!(
+                            "unsupported signature of `snapify.should_checkpoint`: {params:?}"
+                        ),
+                    };
+                }
+            }
+            Payload::MemorySection(section) => {
+                for memory in section {
+                    if memory?.shared {
+                        anyhow::bail!(
+                            "wasi-threads modules are not supported: the module defines a shared memory"
+                        );
+                    }
+                }
+            }
             Payload::ExportSection(section) => {
                 for entry in section.into_iter_with_offsets() {
                     let (_, export) = entry?;
@@ -35,7 +120,8 @@ pub(crate) fn go(data: &[u8]) -> Result<KafuModuleMetadata> {
         }
     }
 
-    let mut functions = HashMap::new();
+    let mut functions = Vec::new();
+    let mut num_dests = 0;
     // read the custom `name` section and find ".kafu_dest."
     for payload in Parser::new(0).parse_all(data) {
         match payload.expect("parse error") {
@@ -47,14 +133,18 @@ pub(crate) fn go(data: &[u8]) -> Result<KafuModuleMetadata> {
                     let ident = parts[2];
                     let dest = parts[3];
                     tracing::debug!("found DEST {}@{}", ident, dest);
-                    let index = function_name_to_index_map
+                    let index = *function_name_to_index_map
                         .get(ident)
-                        .expect("function not found");
+                        .expect("function not found") as usize;
                     let meta = KafuFunctionMetadata {
                         name: Some(ident.to_string()),
                         dest: Some(dest.to_string()),
                     };
-                    functions.insert(*index, meta);
+                    if functions.len() <= index {
+                        functions.resize(index + 1, None);
+                    }
+                    functions[index] = Some(meta);
+                    num_dests += 1;
                 }
             }
             Payload::End(_) => {
@@ -63,6 +153,13 @@ pub(crate) fn go(data: &[u8]) -> Result<KafuModuleMetadata> {
             _ => {}
         }
     }
-    tracing::debug!("Found {} KAFU_DEST", functions.len());
-    Ok(KafuModuleMetadata { functions })
+    tracing::debug!(
+        "Found {} KAFU_DEST (migration point ABI: {:?})",
+        num_dests,
+        migration_point_abi
+    );
+    Ok(KafuModuleMetadata {
+        functions,
+        migration_point_abi,
+    })
 }
@@ -1,17 +1,25 @@
 use anyhow::{Context as _, Result};
 use wasi_common::pipe::WritePipe;
 use wasi_common::sync;
-use wasmtime::{Caller, Linker, Store};
+use wasmtime::{Caller, Linker};
 
+use super::blob::link_blob_imports;
+use super::channel::link_channel_imports;
 use super::config::{LinkerConfig, LinkerSnapifyConfig};
+use super::kafu_metadata::MigrationPointAbi;
 use super::migration::handle_migration_point;
-use super::migration::InterruptReason;
+use super::migration::{
+    caller_from_backtrace, link_region_imports, publish_node_state, InterruptReason,
+    PendingMigration,
+};
+use super::scratch::link_scratch_imports;
 use super::store::KafuStore;
+use super::task::link_task_imports;
 
 pub(crate) fn link_imports(
     config: &LinkerConfig,
     linker: &mut Linker<KafuStore>,
-    store: &mut Store<KafuStore>,
+    migration_point_abi: MigrationPointAbi,
 ) -> Result<()> {
     if config.wasip1 {
         wasi_common::sync::add_to_linker(linker, |cx| &mut cx.libctx.wasi)?;
@@ -20,20 +28,44 @@ pub(crate) fn link_imports(
         link_wasi_nn_imports(linker)?;
     }
     if config.spectest {
-        link_spectest_imports(linker, store)?;
+        link_spectest_imports(linker)?;
     }
     if config.kafu_helper {
         link_kafu_helper_imports(linker)?;
+        link_task_imports(linker)?;
+        link_channel_imports(linker)?;
+        link_region_imports(linker)?;
+        link_scratch_imports(linker)?;
+        link_blob_imports(linker)?;
     }
     match config.snapify {
-        LinkerSnapifyConfig::Enabled => link_snapify_imports(linker)?,
-        LinkerSnapifyConfig::Dummy => link_snapify_imports_dummy(linker)?,
+        LinkerSnapifyConfig::Enabled => {
+            link_snapify_imports(linker, migration_point_abi, on_pending_migration)?
+        }
+        LinkerSnapifyConfig::Dummy => {
+            link_snapify_imports(linker, migration_point_abi, on_pending_migration_dummy)?
+        }
         LinkerSnapifyConfig::Disabled => {}
     }
     Ok(())
 }
 
-pub(crate) fn wasi_ctx(wasi_config: &super::config::WasiConfig) -> Result<wasi_common::WasiCtx> {
+/// Opens the directory that the guest sees as `/` (the current directory by default).
+pub(crate) fn open_preopened_dir(
+    wasi_config: &super::config::WasiConfig,
+) -> Result<cap_std::fs::Dir> {
+    let preopen = wasi_config
+        .preopened_dir
+        .clone()
+        .unwrap_or_else(|| ".".into());
+    let file = std::fs::File::open(preopen)?;
+    Ok(cap_std::fs::Dir::from_std_file(file))
+}
+
+pub(crate) fn wasi_ctx(
+    wasi_config: &super::config::WasiConfig,
+    preopened_dir: &cap_std::fs::Dir,
+) -> Result<wasi_common::WasiCtx> {
     let mut builder = sync::WasiCtxBuilder::new();
     builder.arg("program")?;
     for arg in wasi_config.args.iter() {
@@ -52,69 +84,114 @@ pub(crate) fn wasi_ctx(wasi_config: &super::config::WasiConfig) -> Result<wasi_c
         builder.inherit_stderr();
     }
 
-    let preopen = wasi_config
-        .preopened_dir
-        .clone()
-        .unwrap_or_else(|| ".".into());
-    let dir = cap_std::fs::Dir::from_std_file(std::fs::File::open(preopen)?);
-    builder.preopened_dir(dir, "/")?;
+    builder.preopened_dir(preopened_dir.try_clone()?, "/")?;
 
     Ok(builder.build())
 }
 
-fn link_snapify_imports(linker: &mut Linker<KafuStore>) -> Result<()> {
-    linker.func_wrap(
-        "snapify",
-        "should_checkpoint",
-        move |mut caller: Caller<'_, KafuStore>, reason: i32| -> i32 {
-            let reason = InterruptReason::new(reason);
-            match handle_migration_point(&mut caller, reason) {
-                Ok(Some(pending)) => {
-                    // Suspend the program.
-                    caller.data_mut().migration_ctx.pending_migration_request = Some(pending);
-                    1
-                }
-                Ok(None) => 0,
-                Err(e) => {
-                    tracing::warn!("failed to handle migration point: {e:#}");
-                    0
-                }
-            }
-        },
-    )?;
-    Ok(())
+/// Suspend the program.
+fn on_pending_migration(caller: &mut Caller<'_, KafuStore>, pending: PendingMigration) -> i32 {
+    caller.data_mut().migration_ctx.pending_migration_request = Some(pending);
+    1
 }
 
-/// Dummy implementation for singlenode emulation.
-fn link_snapify_imports_dummy(linker: &mut Linker<KafuStore>) -> Result<()> {
-    linker.func_wrap(
-        "snapify",
-        "should_checkpoint",
-        move |mut caller: Caller<'_, KafuStore>, reason: i32| -> i32 {
-            let reason = InterruptReason::new(reason);
-            match handle_migration_point(&mut caller, reason) {
-                Ok(Some(pending)) => {
-                    // For singlenode emulation, just switch node_id.
-                    caller.data_mut().node_id = pending.to_node_id;
-                    0
-                }
-                Ok(None) => 0,
-                Err(e) => {
-                    tracing::warn!("failed to handle migration point (dummy): {e:#}");
-                    0
-                }
-            }
-        },
-    )?;
+/// Dummy implementation for singlenode emulation: just switch node_id.
+fn on_pending_migration_dummy(
+    caller: &mut Caller<'_, KafuStore>,
+    pending: PendingMigration,
+) -> i32 {
+    caller.data_mut().node_id = pending.to_node_id;
+    if let Err(e) = publish_node_state(caller) {
+        tracing::warn!("failed to publish node state: {e:#}");
+    }
+    0
+}
+
+fn migration_point(
+    caller: &mut Caller<'_, KafuStore>,
+    reason: i32,
+    func_idx: u32,
+    stack_height: u32,
+    on_pending: fn(&mut Caller<'_, KafuStore>, PendingMigration) -> i32,
+) -> i32 {
+    if caller.data().is_task {
+        return 0;
+    }
+    let reason = InterruptReason::new(reason);
+    match handle_migration_point(caller, reason, func_idx, stack_height) {
+        Ok(Some(pending)) => on_pending(caller, pending),
+        Ok(None) => 0,
+        Err(e) => {
+            tracing::warn!("failed to handle migration point: {e:#}");
+            0
+        }
+    }
+}
+
+fn link_snapify_imports(
+    linker: &mut Linker<KafuStore>,
+    migration_point_abi: MigrationPointAbi,
+    on_pending: fn(&mut Caller<'_, KafuStore>, PendingMigration) -> i32,
+) -> Result<()> {
+    match migration_point_abi {
+        MigrationPointAbi::Indexed => {
+            linker.func_wrap(
+                "snapify",
+                "should_checkpoint",
+                move |mut caller: Caller<'_, KafuStore>,
+                      reason: i32,
+                      func_idx: i32,
+                      stack_depth: i32|
+                      -> i32 {
+                    migration_point(
+                        &mut caller,
+                        reason,
+                        func_idx as u32,
+                        stack_depth as u32,
+                        on_pending,
+                    )
+                },
+            )?;
+        }
+        MigrationPointAbi::Legacy | MigrationPointAbi::None => {
+            linker.func_wrap(
+                "snapify",
+                "should_checkpoint",
+                move |mut caller: Caller<'_, KafuStore>, reason: i32| -> i32 {
+                    match caller_from_backtrace(&caller) {
+                        Ok((func_idx, stack_height)) => {
+                            migration_point(&mut caller, reason, func_idx, stack_height, on_pending)
+                        }
+                        Err(e) => {
+                            tracing::warn!("failed to handle migration point: {e:#}");
+                            0
+                        }
+                    }
+                },
+            )?;
+        }
+    }
     Ok(())
 }
 
-fn link_spectest_imports<C: 'static>(linker: &mut Linker<C>, store: &mut Store<C>) -> Result<()> {
-    let config = wasmtime_wast::SpectestConfig {
-        use_shared_memory: false,
-        suppress_prints: false,
-    };
-    wasmtime_wast::link_spectest(linker, store, &config)?;
+/// Print functions of the `spectest` module (see `include/spectest.h`).
+///
+/// Defined with `func_wrap` rather than `wasmtime_wast::link_spectest`, which allocates
+/// globals, a table and a memory in a specific store and therefore cannot be pre-linked.
+fn link_spectest_imports<C: 'static>(linker: &mut Linker<C>) -> Result<()> {
+    linker.func_wrap("spectest", "print", || {})?;
+    linker.func_wrap("spectest", "print_i32", |val: i32| println!("{val}: i32"))?;
+    linker.func_wrap("spectest", "print_i64", |val: i64| println!("{val}: i64"))?;
+    linker.func_wrap("spectest", "print_f32", |val: f32| println!("{val}: f32"))?;
+    linker.func_wrap("spectest", "print_f64", |val: f64| println!("{val}: f64"))?;
+    linker.func_wrap("spectest", "print_i32_f32", |i: i32, f: f32| {
+        println!("{i}: i32");
+        println!("{f}: f32");
+    })?;
+    linker.func_wrap("spectest", "print_f64_f64", |a: f64, b: f64| {
+        println!("{a}: f64");
+        println!("{b}: f64");
+    })?;
     Ok(())
 }
 
@@ -1,9 +1,24 @@
+use std::sync::Arc;
+
 use anyhow::{Context as _, Result};
-use wasmtime::{Caller, WasmBacktrace};
+use wasmtime::{AsContextMut, Caller, Linker, WasmBacktrace};
 
 use super::kafu_metadata::KafuFunctionMetadata;
 
 use super::store::KafuStore;
+use super::task::{guest_memory, read_str};
+
+/// `KAFU_DEST` destination of `__kafu_region_enter` in kafu.h: the node passed to
+/// `kafu.region_target` just before.
+pub(crate) const REGION_BEGIN_DEST: &str = "__kafu_region_begin";
+
+/// `KAFU_DEST` destination of `__kafu_region_leave` in kafu.h: the node the innermost region was
+/// entered from.
+pub(crate) const REGION_END_DEST: &str = "__kafu_region_end";
+
+/// Stack height of the migration stack entry that records where a region was entered from.
+/// No frame has this height, so function exits inside the region never return to that node.
+pub(crate) const REGION_STACK_HEIGHT: u32 = u32::MAX;
 
 /// Pair of a WASM stack frame height and a node ID.
 #[derive(Debug, Clone)]
@@ -48,6 +63,9 @@ pub struct MigrationContext {
     /// FuncExit: pop from the stack on the source node.
     /// This information is also sent when issuing a migration request.
     pub(crate) migration_stack: Vec<MigrationStackEntry>,
+    /// Node of the region being entered (`KAFU_REGION_BEGIN` in kafu.h), until its migration
+    /// point runs.
+    pub(crate) region_target: Option<String>,
 }
 
 impl MigrationContext {
@@ -104,28 +122,201 @@ impl MigrationContext {
     }
 }
 
-pub(crate) fn handle_migration_point(
+/// Returns whether a migration to `to_node_id` must be refused because tasks spawned by the
+/// program are not joined yet. Their handles live in this instance's store and would not
+/// exist on the destination, so the program keeps running on the current node instead.
+fn refuse_with_unjoined_tasks(caller: &Caller<'_, KafuStore>, to_node_id: &str) -> bool {
+    let unjoined = caller.data().tasks.unjoined();
+    if unjoined == 0 {
+        return false;
+    }
+    tracing::warn!(
+        "{}: {} task(s) not joined; staying here instead of migrating to {}",
+        caller.data().node_id,
+        unjoined,
+        to_node_id
+    );
+    true
+}
+
+/// Enters a region (`KAFU_REGION_BEGIN` in kafu.h): migrates to the region's node and records
+/// where the region was entered from. Unlike a `KAFU_DEST` function, the region only returns
+/// there at `KAFU_REGION_END`, however many functions return in between.
+fn begin_region(
     caller: &mut Caller<'_, KafuStore>,
-    reason: InterruptReason,
+    meta: &KafuFunctionMetadata,
 ) -> Result<Option<PendingMigration>> {
+    let target = caller
+        .data_mut()
+        .migration_ctx
+        .region_target
+        .take()
+        .context("region entered without a target node")?;
+    let from_node_id = caller.data().node_id.clone();
+    let to_node_id = match &caller.data().cluster {
+        Some(cluster) => cluster
+            .select_node(&target, &from_node_id)
+            .unwrap_or_else(|| {
+                tracing::warn!(
+                    "region destination `{target}` names no reachable node; staying here"
+                );
+                from_node_id.clone()
+            }),
+        None => target,
+    };
+    caller
+        .data_mut()
+        .migration_ctx
+        .migration_stack
+        .push(MigrationStackEntry {
+            from_node_id: from_node_id.clone(),
+            wasm_stack_height: REGION_STACK_HEIGHT,
+        });
+    if to_node_id == from_node_id || refuse_with_unjoined_tasks(caller, &to_node_id) {
+        publish_node_state(&mut *caller)?;
+        return Ok(None);
+    }
+    tracing::info!(
+        "Migration {} -> {} (Entering region)",
+        from_node_id,
+        to_node_id
+    );
+    Ok(Some(PendingMigration {
+        func: meta.clone(),
+        to_node_id,
+        reason: InterruptReason::FuncEntry,
+    }))
+}
+
+/// Leaves the innermost region (`KAFU_REGION_END` in kafu.h), migrating back to the node it was
+/// entered from.
+fn end_region(
+    caller: &mut Caller<'_, KafuStore>,
+    meta: &KafuFunctionMetadata,
+) -> Result<Option<PendingMigration>> {
+    let migration_stack = &mut caller.data_mut().migration_ctx.migration_stack;
+    anyhow::ensure!(
+        migration_stack
+            .last()
+            .is_some_and(|entry| entry.wasm_stack_height == REGION_STACK_HEIGHT),
+        "KAFU_REGION_END without a matching KAFU_REGION_BEGIN in the same function"
+    );
+    let entry = migration_stack.pop().expect("checked above");
+    if entry.from_node_id == caller.data().node_id
+        || refuse_with_unjoined_tasks(caller, &entry.from_node_id)
+    {
+        publish_node_state(&mut *caller)?;
+        return Ok(None);
+    }
+    tracing::info!(
+        "Migration {} -> {} (Leaving region)",
+        caller.data().node_id,
+        entry.from_node_id
+    );
+    Ok(Some(PendingMigration {
+        func: meta.clone(),
+        to_node_id: entry.from_node_id,
+        reason: InterruptReason::FuncEntry,
+    }))
+}
+
+/// Links `kafu.region_target`, which sets the node of the next region entered
+/// (`KAFU_REGION_BEGIN` in kafu.h).
+pub(crate) fn link_region_imports(linker: &mut Linker<KafuStore>) -> Result<()> {
+    linker.func_wrap(
+        "kafu",
+        "region_target",
+        |mut caller: Caller<'_, KafuStore>, node_ptr: u32, node_len: u32| -> i32 {
+            let result = guest_memory(&mut caller, "memory")
+                .and_then(|memory| read_str(&caller, memory, node_ptr, node_len));
+            match result {
+                Ok(node_id) => {
+                    caller.data_mut().migration_ctx.region_target = Some(node_id);
+                    0
+                }
+                Err(e) => {
+                    tracing::warn!("failed to set region target: {e:#}");
+                    1
+                }
+            }
+        },
+    )?;
+    Ok(())
+}
+
+/// 64-bit FNV-1a hash of a node ID, as computed by `kafu_node_hash` in kafu.h.
+pub(crate) fn node_hash(node_id: &str) -> u64 {
+    node_id.bytes().fold(0xcbf2_9ce4_8422_2325, |hash, b| {
+        (hash ^ u64::from(b)).wrapping_mul(0x0100_0000_01b3)
+    })
+}
+
+/// Writes the current node and migration depth into the guest-visible node state
+/// (`kafu_node_state_t` in kafu.h), so the guest can skip migration points that cannot migrate.
+pub(crate) fn publish_node_state(mut store: impl AsContextMut<Data = KafuStore>) -> Result<()> {
+    let mut store = store.as_context_mut();
+    let data = store.data();
+    let Some((memory, addr)) = data.node_state else {
+        return Ok(());
+    };
+    let mut state = [0u8; 12];
+    state[..8].copy_from_slice(&node_hash(&data.node_id).to_le_bytes());
+    state[8..].copy_from_slice(&(data.migration_ctx.migration_stack.len() as u32).to_le_bytes());
+    memory
+        .write(&mut store, addr as usize, &state)
+        .context("failed to write node state")
+}
+
+/// Returns the function index of the Wasm caller and the current Wasm stack depth by walking
+/// the stack. Only used for modules built with the legacy `should_checkpoint(reason)` import.
+pub(crate) fn caller_from_backtrace(caller: &Caller<'_, KafuStore>) -> Result<(u32, u32)> {
     // Use WasmBacktrace (frame pointer walking) instead of debug_frames (guest_debug).
-    // frames()[0] is the wasm function that called into this host function.
-    let trace = WasmBacktrace::capture(&*caller);
+    // frames()[0] is the Snapify helper that called into this host function.
+    let trace = WasmBacktrace::capture(caller);
     let frames = trace.frames();
-    let caller_frame = frames.get(1).unwrap();
-    let func_idx = caller_frame.func_index();
+    let caller_frame = frames
+        .get(1)
+        .context("migration point called from outside a Wasm function")?;
+    Ok((caller_frame.func_index(), frames.len() as u32))
+}
 
-    let meta = caller
-        .data()
-        .module
+pub(crate) fn handle_migration_point(
+    caller: &mut Caller<'_, KafuStore>,
+    reason: InterruptReason,
+    func_idx: u32,
+    current_wasm_stack_height: u32,
+) -> Result<Option<PendingMigration>> {
+    let module = Arc::clone(&caller.data().module);
+    let meta = module
         .metadata
-        .functions
-        .get(&func_idx)
+        .function(func_idx)
         .with_context(|| format!("function metadata not found for func_idx={func_idx}"))?;
 
+    // Regions migrate on entry only: their exits return to the caller on the same node.
+    match (meta.dest.as_deref(), reason) {
+        (Some(REGION_BEGIN_DEST), InterruptReason::FuncEntry) => return begin_region(caller, meta),
+        (Some(REGION_END_DEST), InterruptReason::FuncEntry) => return end_region(caller, meta),
+        (Some(REGION_BEGIN_DEST | REGION_END_DEST), InterruptReason::FuncExit) => return Ok(None),
+        _ => {}
+    }
+
     let to_node_id = match reason {
-        InterruptReason::FuncEntry => match meta.dest.clone() {
-            Some(dest) => dest,
+        InterruptReason::FuncEntry => match &meta.dest {
+            // A placement group or "any" is resolved to a node now, from the current load.
+            Some(dest) => match &caller.data().cluster {
+                Some(cluster) => match cluster.select_node(dest, &caller.data().node_id) {
+                    Some(node_id) => node_id,
+                    None => {
+                        tracing::warn!(
+                            "migration destination `{}` names no reachable node (func={:?})",
+                            dest,
+                            meta.name
+                        );
+                        return Ok(None);
+                    }
+                },
+                None => dest.clone(),
+            },
             None => {
                 tracing::warn!(
                     "migration destination is not set (func={:?}, reason={:?})",
@@ -136,8 +327,8 @@ pub(crate) fn handle_migration_point(
             }
         },
         InterruptReason::FuncExit => {
-            // TODO: check if the migration should happen here.
-            // In some cases, the migration must not happen at all function exits.
+            // Whether this exit matches the migrated frame is decided by `should_migrate`,
+            // which compares the stack height recorded at FuncEntry.
             let Some(entry) = caller.data().migration_ctx.migration_stack.last() else {
                 return Ok(None);
             };
@@ -145,14 +336,6 @@ pub(crate) fn handle_migration_point(
         }
     };
 
-    // TODO: use actual wasm stack height when executing migration points at function-exit.
-    // This prevents misaligned migration at function-exit.
-    // In the following example, if migration should happen at the exit of the first call to f.
-    // ```c
-    // KAFU_DEST("foo")
-    // void f() { if (rand() % 2 == 0) { return; } else { f(); } }
-    // ```
-    let current_wasm_stack_height = 0;
     let from_node_id = caller.data().node_id.clone();
     let should_migrate = caller.data().migration_ctx.should_migrate(
         &from_node_id,
@@ -160,7 +343,19 @@ pub(crate) fn handle_migration_point(
         current_wasm_stack_height,
         &to_node_id,
     );
-    if should_migrate {
+    if should_migrate && refuse_with_unjoined_tasks(caller, &to_node_id) {
+        // The frame that migrated here is returning, so its entry goes even though the
+        // program stays.
+        if reason == InterruptReason::FuncExit {
+            caller.data_mut().migration_ctx.on_migrate(
+                &from_node_id,
+                reason,
+                current_wasm_stack_height,
+            );
+            publish_node_state(&mut *caller)?;
+        }
+        Ok(None)
+    } else if should_migrate {
         let meta = meta.clone();
         tracing::info!(
             "Migration {} -> {} ({} {})",
@@ -4,18 +4,38 @@
 //! (`kafu_serve`, `kafu_singlenode`, etc.) while splitting implementation into
 //! focused submodules.
 
+mod aot;
+mod blob;
+mod channel;
 mod config;
 mod instance;
 mod kafu_metadata;
 mod linker;
 mod migration;
+mod models;
 mod module;
+mod placement;
+mod scratch;
 mod store;
+mod task;
 
-pub use config::{KafuRuntimeConfig, LinkerConfig, LinkerSnapifyConfig, WasiConfig};
+pub use aot::precompile;
+pub use blob::{BlobDigest, BlobStore};
+pub use channel::{ChannelTable, Received, DEFAULT_CHANNEL_CAPACITY};
+pub use config::{
+    new_wasmtime_config, KafuRuntimeConfig, LinkerConfig, LinkerSnapifyConfig, WasiConfig,
+};
 pub use instance::{
-    apply_memory_delta, apply_memory_delta_into, apply_memory_delta_into_sized, KafuRuntimeInstance,
+    apply_memory_delta, apply_memory_delta_into, apply_memory_delta_into_sized,
+    KafuRuntimeInstance, KafuRuntimePre,
 };
+pub use kafu_config::EngineConfig;
 pub use migration::{InterruptReason, MigrationStackEntry, PendingMigration};
 pub use module::WasmModule;
+pub use placement::{select_node, NodeLoad};
+pub use scratch::ScratchRanges;
 pub use store::{KafuStore, MAIN_MEMORY_PAGE_SIZE};
+pub use task::{
+    ClusterBackend, ClusterFuture, LocalCluster, Task, TaskFuture, TaskInput, MAX_ACTORS,
+    MAX_CONCURRENT_TASKS,
+};
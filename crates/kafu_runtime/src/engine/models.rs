@@ -0,0 +1,78 @@
+//! Models preloaded into wasi-nn (`nodes.<id>.models` in the Kafu config).
+//!
+//! Each model is parsed once, when the module is pre-linked, and its graph is shared by every
+//! instance of the node. Guests get it with `wasi_nn_load_by_name`, so the model bytes never
+//! enter their memory, and a program that migrates to the node finds the graph ready.
+
+use std::collections::HashMap;
+
+use anyhow::{Context as _, Result};
+use kafu_config::ModelConfig;
+use wasmtime_wasi_nn::backend;
+use wasmtime_wasi_nn::wit::{ExecutionTarget, GraphEncoding};
+use wasmtime_wasi_nn::{Graph, GraphRegistry, Registry};
+
+/// Graphs of the preloaded models, by name.
+#[derive(Clone, Default)]
+pub(crate) struct ModelRegistry {
+    graphs: HashMap<String, Graph>,
+}
+
+impl ModelRegistry {
+    /// Loads every model, and warms it up by creating one execution context.
+    pub(crate) fn load(models: &[(String, ModelConfig)]) -> Result<Self> {
+        let mut graphs = HashMap::new();
+        for (name, model) in models {
+            let graph =
+                load_model(model).with_context(|| format!("failed to load model `{name}`"))?;
+            tracing::info!(
+                "Loaded model `{name}` ({}) from {}",
+                model.encoding.as_str(),
+                model.path.display()
+            );
+            graphs.insert(name.clone(), graph);
+        }
+        Ok(Self { graphs })
+    }
+
+    /// Returns a wasi-nn registry for one instance. The graphs are shared, not copied.
+    pub(crate) fn registry(&self) -> Registry {
+        Registry::from(self.clone())
+    }
+}
+
+impl GraphRegistry for ModelRegistry {
+    fn get(&self, name: &str) -> Option<&Graph> {
+        self.graphs.get(name)
+    }
+
+    fn get_mut(&mut self, name: &str) -> Option<&mut Graph> {
+        self.graphs.get_mut(name)
+    }
+}
+
+fn load_model(model: &ModelConfig) -> Result<Graph> {
+    let encoding: GraphEncoding = model.encoding.as_str().parse()?;
+    let mut backend = backend::list()
+        .into_iter()
+        .find(|backend| backend.encoding() == encoding)
+        .with_context(|| format!("no wasi-nn backend for {}", model.encoding.as_str()))?;
+    let graph = if model.path.is_dir() {
+        backend
+            .as_dir_loadable()
+            .with_context(|| {
+                format!(
+                    "the {} backend cannot load a model directory",
+                    model.encoding.as_str()
+                )
+            })?
+            .load_from_dir(&model.path, ExecutionTarget::Cpu)?
+    } else {
+        let bytes = std::fs::read(&model.path)
+            .with_context(|| format!("failed to read {}", model.path.display()))?;
+        backend.load(&[&bytes], ExecutionTarget::Cpu)?
+    };
+    // Backends set up their session state when the first execution context is created.
+    drop(graph.init_execution_context()?);
+    Ok(graph)
+}
@@ -1,16 +1,33 @@
 use anyhow::Result;
 
+use super::aot;
 use super::kafu_metadata::{self, KafuModuleMetadata};
 
 pub struct WasmModule {
     pub(crate) wasm: Vec<u8>,
     pub(crate) metadata: KafuModuleMetadata,
+    /// Precompiled module (from `kafu compile`) used instead of compiling `wasm` at startup.
+    pub(crate) precompiled: Option<Vec<u8>>,
 }
 
 impl WasmModule {
     /// Create a new `WasmModule` from a WASM binary.
     pub async fn new(wasm: Vec<u8>) -> Result<Self> {
         let metadata = kafu_metadata::go(&wasm)?;
-        Ok(Self { wasm, metadata })
+        Ok(Self {
+            wasm,
+            metadata,
+            precompiled: None,
+        })
+    }
+
+    /// Create a new `WasmModule` from a WASM binary and its AOT artifact produced by `kafu compile`.
+    ///
+    /// The artifact must have been compiled from the same WASM binary.
+    pub async fn new_with_aot_artifact(wasm: Vec<u8>, artifact: &[u8]) -> Result<Self> {
+        let precompiled = aot::artifact_payload(artifact, &wasm)?.to_vec();
+        let mut module = Self::new(wasm).await?;
+        module.precompiled = Some(precompiled);
+        Ok(module)
     }
 }
@@ -0,0 +1,53 @@
+//! Load-aware choice of the node for a `KAFU_DEST` destination that names several nodes
+//! (a placement group, or `"any"`).
+
+use std::time::Duration;
+
+/// Load of a node, as reported through heartbeats.
+#[derive(Debug, Clone, Copy, Default, PartialEq, Eq)]
+pub struct NodeLoad {
+    /// Tasks executing on the node.
+    pub running_tasks: u32,
+    /// Tasks waiting for a free task slot on the node.
+    pub queued_tasks: u32,
+    /// Round-trip time of the last heartbeat between the coordinator and the node.
+    pub latency: Option<Duration>,
+    /// The coordinator's last heartbeat to the node failed.
+    pub unreachable: bool,
+}
+
+impl NodeLoad {
+    fn busy(&self) -> u32 {
+        self.running_tasks + self.queued_tasks
+    }
+}
+
+/// Picks the least loaded of `candidates`: fewest running and queued tasks, then `current` (so
+/// that the program stays where it is unless another node is less busy), then the lowest
+/// latency. Nodes without a report count as idle, with an unknown latency. Unreachable nodes are
+/// never picked.
+///
+/// A single candidate (an explicit node ID) is always returned as is, whatever its load: only a
+/// choice between several nodes is load-aware. Returns `None` if there are no candidates, or no
+/// reachable one among several.
+pub fn select_node<'a>(
+    candidates: &[&'a str],
+    current: &str,
+    load: impl Fn(&str) -> Option<NodeLoad>,
+) -> Option<&'a str> {
+    if let &[node] = candidates {
+        return Some(node);
+    }
+    candidates
+        .iter()
+        .map(|&node| (node, load(node).unwrap_or_default()))
+        .filter(|(_, load)| !load.unreachable)
+        .min_by_key(|(node, load)| {
+            (
+                load.busy(),
+                *node != current,
+                load.latency.unwrap_or(Duration::MAX),
+            )
+        })
+        .map(|(node, _)| node)
+}
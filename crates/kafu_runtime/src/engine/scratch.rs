@@ -0,0 +1,187 @@
+//! Scratch memory (`kafu_mark_scratch` and `kafu_discard` in kafu_memory.h).
+//!
+//! Scratch ranges of the main memory hold data that is dead at migration points, such as
+//! decoded images or intermediate tensors. They are zeroed in snapshots and deltas, so they
+//! cost almost no bandwidth: zero pages compress to almost nothing, and unchanged zero pages
+//! are not sent at all.
+//!
+//! Guest allocators can also publish the free parts of their heap in a table in linear memory
+//! (`__kafu_free_spans` in kafu_memory.h); at each checkpoint, those spans count as scratch too.
+
+use std::ops::Range;
+
+use anyhow::Result;
+use wasmtime::{Caller, Linker};
+
+use super::store::KafuStore;
+use super::task::{check_range, guest_memory};
+
+/// Capacity of the guest's free-span table (`KAFU_MAX_FREE_SPANS` in kafu_memory.h).
+pub(crate) const MAX_FREE_SPANS: usize = 256;
+
+/// Set of scratch ranges of the main memory.
+#[derive(Debug, Clone, Default, PartialEq, Eq)]
+pub struct ScratchRanges {
+    /// Sorted, disjoint and non-adjacent.
+    ranges: Vec<Range<usize>>,
+}
+
+impl ScratchRanges {
+    pub fn is_empty(&self) -> bool {
+        self.ranges.is_empty()
+    }
+
+    pub fn iter(&self) -> impl Iterator<Item = Range<usize>> + '_ {
+        self.ranges.iter().cloned()
+    }
+
+    /// Adds `range`, merging it with the ranges it overlaps or touches.
+    pub fn mark(&mut self, range: Range<usize>) {
+        if range.is_empty() {
+            return;
+        }
+        let mut merged = range;
+        self.ranges.retain(|r| {
+            if r.start <= merged.end && merged.start <= r.end {
+                merged = merged.start.min(r.start)..merged.end.max(r.end);
+                false
+            } else {
+                true
+            }
+        });
+        let index = self.ranges.partition_point(|r| r.start < merged.start);
+        self.ranges.insert(index, merged);
+    }
+
+    /// Removes `range`, splitting the ranges it cuts through.
+    pub fn unmark(&mut self, range: Range<usize>) {
+        if range.is_empty() {
+            return;
+        }
+        let mut kept = Vec::with_capacity(self.ranges.len() + 1);
+        for r in self.ranges.drain(..) {
+            if r.end <= range.start || range.end <= r.start {
+                kept.push(r);
+                continue;
+            }
+            if r.start < range.start {
+                kept.push(r.start..range.start);
+            }
+            if range.end < r.end {
+                kept.push(range.end..r.end);
+            }
+        }
+        self.ranges = kept;
+    }
+
+    /// Returns whether any byte of `range` is scratch.
+    pub fn overlaps(&self, range: Range<usize>) -> bool {
+        let index = self.ranges.partition_point(|r| r.end <= range.start);
+        self.ranges.get(index).is_some_and(|r| r.start < range.end)
+    }
+
+    /// Zeroes the scratch bytes of `data`, which holds the memory from `offset` on.
+    pub fn zero(&self, data: &mut [u8], offset: usize) {
+        let end = offset + data.len();
+        let first = self.ranges.partition_point(|r| r.end <= offset);
+        for r in &self.ranges[first..] {
+            if r.start >= end {
+                break;
+            }
+            data[r.start.max(offset) - offset..r.end.min(end) - offset].fill(0);
+        }
+    }
+
+    /// Returns these ranges plus the free spans listed in the guest's free-span table at
+    /// `table` (`kafu_free_spans_t` in kafu_memory.h), if any. Spans outside `memory` are
+    /// ignored.
+    pub(crate) fn with_free_spans(&self, memory: &[u8], table: Option<u32>) -> ScratchRanges {
+        let mut ranges = self.clone();
+        let Some(table) = table else {
+            return ranges;
+        };
+        let read_u32 = |addr: usize| {
+            memory
+                .get(addr..addr + 4)
+                .map(|bytes| u32::from_le_bytes(bytes.try_into().unwrap()))
+        };
+        let table = table as usize;
+        let Some(count) = read_u32(table) else {
+            tracing::warn!("free-span table at {table:#x} is outside the memory");
+            return ranges;
+        };
+        for i in 0..(count as usize).min(MAX_FREE_SPANS) {
+            let entry = table + 4 + i * 8;
+            let (Some(offset), Some(len)) = (read_u32(entry), read_u32(entry + 4)) else {
+                break;
+            };
+            let span = offset as usize..offset as usize + len as usize;
+            if span.end <= memory.len() {
+                ranges.mark(span);
+            }
+        }
+        ranges
+    }
+}
+
+/// Checks that `len` bytes at `ptr` are in the main memory and returns them as a range.
+fn guest_range(caller: &mut Caller<'_, KafuStore>, ptr: u32, len: u32) -> Result<Range<usize>> {
+    let memory = guest_memory(caller, "memory")?;
+    check_range(memory.data_size(&caller), ptr, len)?;
+    Ok(ptr as usize..ptr as usize + len as usize)
+}
+
+/// Links the scratch memory functions of the `kafu` import module (see `include/kafu_memory.h`).
+pub(crate) fn link_scratch_imports(linker: &mut Linker<KafuStore>) -> Result<()> {
+    linker.func_wrap(
+        "kafu",
+        "mark_scratch",
+        |mut caller: Caller<'_, KafuStore>, ptr: u32, len: u32| -> i32 {
+            match guest_range(&mut caller, ptr, len) {
+                Ok(range) => {
+                    caller.data_mut().scratch.mark(range);
+                    0
+                }
+                Err(e) => {
+                    tracing::warn!("failed to mark scratch memory: {e:#}");
+                    1
+                }
+            }
+        },
+    )?;
+    linker.func_wrap(
+        "kafu",
+        "unmark_scratch",
+        |mut caller: Caller<'_, KafuStore>, ptr: u32, len: u32| -> i32 {
+            match guest_range(&mut caller, ptr, len) {
+                Ok(range) => {
+                    caller.data_mut().scratch.unmark(range);
+                    0
+                }
+                Err(e) => {
+                    tracing::warn!("failed to unmark scratch memory: {e:#}");
+                    1
+                }
+            }
+        },
+    )?;
+    linker.func_wrap(
+        "kafu",
+        "discard",
+        |mut caller: Caller<'_, KafuStore>, ptr: u32, len: u32| -> i32 {
+            let result = guest_range(&mut caller, ptr, len).and_then(|range| {
+                let memory = guest_memory(&mut caller, "memory")?;
+                memory.data_mut(&mut caller)[range].fill(0);
+                Ok(())
+            });
+            match result {
+                Ok(()) => 0,
+                Err(e) => {
+                    tracing::warn!("failed to discard memory: {e:#}");
+                    1
+                }
+            }
+        },
+    )?;
+    Ok(())
+}
@@ -1,13 +1,16 @@
 use std::sync::Arc;
 
 use wasi_common::WasiCtx;
+use wasmtime::Memory;
 use wasmtime_wasi_nn::witx::WasiNnCtx;
-use wasmtime_wast::WastContext;
 
 use crate::witx;
 
+use super::blob::BlobStore;
 use super::migration::MigrationContext;
 use super::module::WasmModule;
+use super::scratch::ScratchRanges;
+use super::task::{ClusterBackend, TaskTable};
 
 pub(crate) struct KafuLibraryContext {
     /// WASI context and the implementation.
@@ -16,8 +19,6 @@ pub(crate) struct KafuLibraryContext {
     pub(crate) wasi_nn: WasiNnCtx,
     /// Kafu helper context and the implementation.
     pub(crate) kafu_helper: witx::KafuHelperCtx,
-    /// Spectest context and the implementation.
-    pub(crate) _wast: WastContext,
 }
 
 /// Wasm page size (64KB). Used for main memory delta encoding.
@@ -28,10 +29,28 @@ pub struct KafuStore {
     pub(crate) node_id: String,
     // Wasm module info
     pub(crate) module: Arc<WasmModule>,
-    /// WASI/WASI-NN/kafu_helper/spectest contexts.
+    /// WASI/WASI-NN/kafu_helper contexts.
     pub(crate) libctx: KafuLibraryContext,
     /// Execution-related context (migration, etc.).
     pub migration_ctx: MigrationContext,
+    /// Location of the guest-visible node state (`__kafu_node_state` in kafu.h), if exported.
+    pub(crate) node_state: Option<(Memory, u32)>,
+    /// Runs tasks spawned by the guest; `None` when the embedder did not provide a cluster.
+    pub(crate) cluster: Option<Arc<dyn ClusterBackend>>,
+    /// Tasks spawned by the guest and not joined yet.
+    pub(crate) tasks: TaskTable,
+    /// Whether this instance runs a task. Tasks run to completion on the node they were sent
+    /// to, so migration points inside them are ignored.
+    pub(crate) is_task: bool,
+    /// Scratch ranges of the main memory, left out of snapshots and deltas.
+    pub(crate) scratch: ScratchRanges,
+    /// Address of the guest allocator's free-span table (`__kafu_free_spans` in kafu_memory.h),
+    /// if exported.
+    pub(crate) free_span_table: Option<u32>,
+    /// Immutable blobs held by this node, shared by all of its instances.
+    pub(crate) blobs: Arc<BlobStore>,
+    /// The directory the guest sees as `/` through WASI. Blobs are loaded from it too.
+    pub(crate) preopened_dir: Arc<cap_std::fs::Dir>,
     /// Baseline main memory at last restore; used to compute delta for migration.
     pub(crate) baseline_main_memory: Option<Arc<Vec<u8>>>,
     /// Baseline snapify memory at last restore; used to compute delta for migration.
@@ -46,4 +65,8 @@ impl KafuStore {
     pub fn get_migration_ctx(&self) -> &MigrationContext {
         &self.migration_ctx
     }
+
+    pub fn get_scratch_ranges(&self) -> &ScratchRanges {
+        &self.scratch
+    }
 }
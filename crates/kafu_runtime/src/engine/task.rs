@@ -0,0 +1,619 @@
+//! Remote tasks (`KAFU_SPAWN` in kafu.h).
+//!
+//! A task runs a guest function on another node, in its own instance, while the caller keeps
+//! running. A task started with `KAFU_SPAWN` starts from a copy of the caller's memories and
+//! globals; one started with `KAFU_OFFLOAD` only receives its input region, in a pristine
+//! instance. When the caller joins a task, its output region is copied back into the caller's
+//! memory.
+//!
+//! An actor (`KAFU_ACTOR` in kafu.h) is an instance that stays alive on the node that created
+//! it. Its methods are argument-only tasks run one at a time in that instance, so its state
+//! persists between calls while the caller's memory never moves.
+
+use std::collections::HashMap;
+use std::future::Future;
+use std::pin::Pin;
+use std::sync::{Arc, Weak};
+
+use anyhow::{Context as _, Result};
+use kafu_config::KafuConfig;
+use tokio::task::JoinHandle;
+use wasmtime::{Caller, Extern, Linker, Memory};
+
+use super::blob::BlobDigest;
+use super::channel::Received;
+use super::instance::KafuRuntimePre;
+use super::placement::{select_node, NodeLoad};
+use super::store::KafuStore;
+
+/// Upper bound on tasks executing at the same time on one node.
+pub const MAX_CONCURRENT_TASKS: u32 = 8;
+
+/// Upper bound on actors living on one node.
+pub const MAX_ACTORS: u32 = 8;
+
+/// Name of the table export used to resolve guest function pointers
+/// (`kafu clang` links with `--export-table`).
+pub(crate) const FUNCTION_TABLE_EXPORT: &str = "__indirect_function_table";
+
+/// Export called once before an argument-only task, so that the guest runs its constructors
+/// (wasm-ld wraps exports of command modules with `__wasm_call_ctors`).
+pub(crate) const TASK_INIT_EXPORT: &str = "__kafu_init";
+
+/// A guest function call to run on some node.
+///
+/// The function has the signature
+/// `void fn(const void *in, uint32_t in_len, void *out, uint32_t out_len)` and is identified by
+/// its function pointer, i.e. its index in the module's function table.
+#[derive(Debug, Clone)]
+pub struct Task {
+    pub function: u32,
+    pub input: TaskInput,
+    pub out_len: u32,
+    /// Actor (on the target node) to run the task in, instead of a fresh instance.
+    /// Requires [`TaskInput::Arguments`].
+    pub actor: Option<u64>,
+}
+
+#[derive(Debug, Clone)]
+pub enum TaskInput {
+    /// Copy of the caller's memories, taken after `snapify_checkpoint_globals`.
+    /// `in_ptr` and `out_ptr` are addresses in that copy.
+    Snapshot {
+        main_memory: Vec<u8>,
+        snapify_memory: Vec<u8>,
+        in_ptr: u32,
+        in_len: u32,
+        out_ptr: u32,
+    },
+    /// Only the contents of the caller's input region. The task runs in a pristine instance,
+    /// with the input and output regions placed by the runtime.
+    Arguments { input: Vec<u8> },
+}
+
+pub type ClusterFuture<T> = Pin<Box<dyn Future<Output = Result<T>> + Send>>;
+
+pub type TaskFuture = ClusterFuture<Vec<u8>>;
+
+/// Runs tasks on the nodes of a cluster.
+pub trait ClusterBackend: Send + Sync {
+    /// Runs `task` on `node_id` and resolves to the task's output region.
+    fn run_task(&self, node_id: &str, task: Task) -> TaskFuture;
+
+    /// Creates an actor on `node_id` and resolves to its ID (never 0).
+    fn create_actor(&self, node_id: &str) -> ClusterFuture<u64>;
+
+    /// Destroys an actor created by [`ClusterBackend::create_actor`].
+    fn destroy_actor(&self, node_id: &str, actor: u64) -> ClusterFuture<()>;
+
+    /// Returns the nodes of a placement group (see `KafuConfig::get_placement_group_nodes`).
+    fn group_nodes(&self, group: &str) -> Vec<String>;
+
+    /// Resolves a `KAFU_DEST` destination (a node ID, a placement group or `"any"`) to the node
+    /// that a function entered on `current` should run on. Returns `None` if `dest` names no node.
+    fn select_node(&self, dest: &str, current: &str) -> Option<String>;
+
+    /// Creates channel `name` on its home node `home`, holding up to `capacity` messages.
+    fn channel_open(&self, home: &str, name: &str, capacity: u32) -> ClusterFuture<()>;
+
+    /// Sends a message to a channel, resolving once it has been queued on `home`.
+    fn channel_send(&self, home: &str, name: &str, message: Vec<u8>) -> ClusterFuture<()>;
+
+    /// Receives the next message of a channel if it is at most `max_len` bytes.
+    fn channel_recv(&self, home: &str, name: &str, max_len: u32) -> ClusterFuture<Received>;
+
+    /// Closes a channel: receivers get the queued messages, then the end of the channel.
+    fn channel_close(&self, home: &str, name: &str) -> ClusterFuture<()>;
+
+    /// Fetches a blob that this node does not hold from the other nodes, or resolves to `None`
+    /// if none of them holds it.
+    fn fetch_blob(&self, digest: BlobDigest) -> ClusterFuture<Option<Vec<u8>>>;
+}
+
+/// Runs every task in this process, emulating `node_id` (single-node mode, and tasks that a
+/// node sends to itself).
+pub struct LocalCluster {
+    runtime_pre: Weak<KafuRuntimePre>,
+    kafu_config: Option<Arc<KafuConfig>>,
+}
+
+impl LocalCluster {
+    pub fn new(runtime_pre: &Arc<KafuRuntimePre>) -> Self {
+        Self {
+            runtime_pre: Arc::downgrade(runtime_pre),
+            kafu_config: None,
+        }
+    }
+
+    /// Resolves placement groups from `kafu_config`. Without it, every group is empty and
+    /// `KAFU_DEST` destinations are taken as node IDs.
+    pub fn with_config(mut self, kafu_config: Arc<KafuConfig>) -> Self {
+        self.kafu_config = Some(kafu_config);
+        self
+    }
+
+    /// Returns the current load of this node.
+    pub fn node_load(&self) -> NodeLoad {
+        self.runtime_pre
+            .upgrade()
+            .map(|runtime_pre| runtime_pre.load())
+            .unwrap_or_default()
+    }
+}
+
+impl ClusterBackend for LocalCluster {
+    fn run_task(&self, node_id: &str, task: Task) -> TaskFuture {
+        let runtime_pre = self.runtime_pre.clone();
+        let node_id = node_id.to_string();
+        Box::pin(async move {
+            let runtime_pre = runtime_pre.upgrade().context("runtime has been dropped")?;
+            runtime_pre.run_task(&node_id, task).await
+        })
+    }
+
+    fn create_actor(&self, node_id: &str) -> ClusterFuture<u64> {
+        let runtime_pre = self.runtime_pre.clone();
+        let node_id = node_id.to_string();
+        Box::pin(async move {
+            let runtime_pre = runtime_pre.upgrade().context("runtime has been dropped")?;
+            runtime_pre.create_actor(&node_id).await
+        })
+    }
+
+    fn destroy_actor(&self, _node_id: &str, actor: u64) -> ClusterFuture<()> {
+        let runtime_pre = self.runtime_pre.clone();
+        Box::pin(async move {
+            let runtime_pre = runtime_pre.upgrade().context("runtime has been dropped")?;
+            runtime_pre.destroy_actor(actor).await
+        })
+    }
+
+    fn group_nodes(&self, group: &str) -> Vec<String> {
+        self.kafu_config
+            .as_ref()
+            .map(|config| {
+                config
+                    .get_placement_group_nodes(group)
+                    .into_iter()
+                    .map(str::to_string)
+                    .collect()
+            })
+            .unwrap_or_default()
+    }
+
+    fn select_node(&self, dest: &str, current: &str) -> Option<String> {
+        // All emulated nodes share this process, so there is no load to tell them apart.
+        let Some(config) = &self.kafu_config else {
+            return Some(dest.to_string());
+        };
+        select_node(&config.get_destination_nodes(dest), current, |_| None).map(str::to_string)
+    }
+
+    fn channel_open(&self, _home: &str, name: &str, capacity: u32) -> ClusterFuture<()> {
+        let runtime_pre = self.runtime_pre.clone();
+        let name = name.to_string();
+        Box::pin(async move {
+            let runtime_pre = runtime_pre.upgrade().context("runtime has been dropped")?;
+            runtime_pre.channels().open(&name, capacity);
+            Ok(())
+        })
+    }
+
+    fn channel_send(&self, _home: &str, name: &str, message: Vec<u8>) -> ClusterFuture<()> {
+        let runtime_pre = self.runtime_pre.clone();
+        let name = name.to_string();
+        Box::pin(async move {
+            let runtime_pre = runtime_pre.upgrade().context("runtime has been dropped")?;
+            runtime_pre.channels().send(&name, message).await
+        })
+    }
+
+    fn channel_recv(&self, _home: &str, name: &str, max_len: u32) -> ClusterFuture<Received> {
+        let runtime_pre = self.runtime_pre.clone();
+        let name = name.to_string();
+        Box::pin(async move {
+            let runtime_pre = runtime_pre.upgrade().context("runtime has been dropped")?;
+            Ok(runtime_pre.channels().recv(&name, max_len).await)
+        })
+    }
+
+    fn channel_close(&self, _home: &str, name: &str) -> ClusterFuture<()> {
+        let runtime_pre = self.runtime_pre.clone();
+        let name = name.to_string();
+        Box::pin(async move {
+            let runtime_pre = runtime_pre.upgrade().context("runtime has been dropped")?;
+            runtime_pre.channels().close(&name);
+            Ok(())
+        })
+    }
+
+    fn fetch_blob(&self, _digest: BlobDigest) -> ClusterFuture<Option<Vec<u8>>> {
+        // All emulated nodes share the blob store of this process.
+        Box::pin(async { Ok(None) })
+    }
+}
+
+struct RunningTask {
+    handle: JoinHandle<Result<Vec<u8>>>,
+    out_ptr: u32,
+    out_len: u32,
+}
+
+/// Tasks spawned by an instance and not joined yet, by handle.
+#[derive(Default)]
+pub(crate) struct TaskTable {
+    next_handle: u32,
+    running: HashMap<u32, RunningTask>,
+}
+
+impl TaskTable {
+    fn insert(&mut self, task: RunningTask) -> u32 {
+        // Handle 0 is reserved for "failed to spawn".
+        self.next_handle = self.next_handle.wrapping_add(1).max(1);
+        self.running.insert(self.next_handle, task);
+        self.next_handle
+    }
+
+    /// Number of tasks not joined yet. Their handles only exist in this instance, so the
+    /// program does not migrate while there are any.
+    pub(crate) fn unjoined(&self) -> usize {
+        self.running.len()
+    }
+}
+
+impl Drop for TaskTable {
+    /// Cancels the tasks that were never joined, which drops their remote instances.
+    fn drop(&mut self) {
+        for task in self.running.values() {
+            task.handle.abort();
+        }
+    }
+}
+
+pub(crate) fn guest_memory(caller: &mut Caller<'_, KafuStore>, name: &str) -> Result<Memory> {
+    caller
+        .get_export(name)
+        .and_then(Extern::into_memory)
+        .with_context(|| format!("memory export `{name}` not found"))
+}
+
+pub(crate) fn check_range(memory_len: usize, ptr: u32, len: u32) -> Result<()> {
+    let end = ptr as usize + len as usize;
+    anyhow::ensure!(
+        end <= memory_len,
+        "guest range {ptr:#x}+{len} is out of bounds"
+    );
+    Ok(())
+}
+
+pub(crate) fn read_str(
+    caller: &Caller<'_, KafuStore>,
+    memory: Memory,
+    ptr: u32,
+    len: u32,
+) -> Result<String> {
+    let data = memory.data(&caller);
+    check_range(data.len(), ptr, len)?;
+    Ok(std::str::from_utf8(&data[ptr as usize..][..len as usize])?.to_string())
+}
+
+#[allow(clippy::too_many_arguments)]
+async fn spawn(
+    caller: &mut Caller<'_, KafuStore>,
+    snapshot: bool,
+    function: u32,
+    node_ptr: u32,
+    node_len: u32,
+    in_ptr: u32,
+    in_len: u32,
+    out_ptr: u32,
+    out_len: u32,
+) -> Result<u32> {
+    let cluster = cluster_backend(caller)?;
+    let memory = guest_memory(caller, "memory")?;
+    let node_id = read_str(caller, memory, node_ptr, node_len)?;
+    let memory_len = memory.data_size(&caller);
+    check_range(memory_len, in_ptr, in_len)?;
+    check_range(memory_len, out_ptr, out_len)?;
+
+    let input = if snapshot {
+        // Save the globals (stack pointer, etc.) into snapify_memory so the task sees them too.
+        let checkpoint_globals = caller
+            .get_export("snapify_checkpoint_globals")
+            .and_then(Extern::into_func)
+            .context("export `snapify_checkpoint_globals` not found")?
+            .typed::<(), ()>(&caller)?;
+        checkpoint_globals.call_async(&mut *caller, ()).await?;
+        let main_memory = memory.data(&caller).to_vec();
+        let snapify_memory = guest_memory(caller, "snapify_memory")?
+            .data(&caller)
+            .to_vec();
+        TaskInput::Snapshot {
+            main_memory,
+            snapify_memory,
+            in_ptr,
+            in_len,
+            out_ptr,
+        }
+    } else {
+        TaskInput::Arguments {
+            input: memory.data(&caller)[in_ptr as usize..][..in_len as usize].to_vec(),
+        }
+    };
+
+    let task = Task {
+        function,
+        input,
+        out_len,
+        actor: None,
+    };
+    tracing::debug!(
+        "{}: Spawning task (function={}) on {}",
+        caller.data().node_id,
+        function,
+        node_id
+    );
+    let handle = tokio::spawn(cluster.run_task(&node_id, task));
+    Ok(caller.data_mut().tasks.insert(RunningTask {
+        handle,
+        out_ptr,
+        out_len,
+    }))
+}
+
+async fn join(caller: &mut Caller<'_, KafuStore>, handle: u32) -> Result<()> {
+    let task = caller
+        .data_mut()
+        .tasks
+        .running
+        .remove(&handle)
+        .with_context(|| format!("unknown task handle {handle}"))?;
+    let output = task.handle.await.context("task panicked")??;
+    anyhow::ensure!(
+        output.len() <= task.out_len as usize,
+        "task returned {} bytes for a {}-byte output region",
+        output.len(),
+        task.out_len
+    );
+    let memory = guest_memory(caller, "memory")?;
+    memory.write(&mut *caller, task.out_ptr as usize, &output)?;
+    Ok(())
+}
+
+pub(crate) fn cluster_backend(caller: &Caller<'_, KafuStore>) -> Result<Arc<dyn ClusterBackend>> {
+    caller
+        .data()
+        .cluster
+        .clone()
+        .context("remote tasks are not available in this runtime")
+}
+
+async fn create_actor(
+    caller: &mut Caller<'_, KafuStore>,
+    node_ptr: u32,
+    node_len: u32,
+) -> Result<u64> {
+    let cluster = cluster_backend(caller)?;
+    let memory = guest_memory(caller, "memory")?;
+    let node_id = read_str(caller, memory, node_ptr, node_len)?;
+    cluster.create_actor(&node_id).await
+}
+
+#[allow(clippy::too_many_arguments)]
+async fn call_actor(
+    caller: &mut Caller<'_, KafuStore>,
+    node_ptr: u32,
+    node_len: u32,
+    actor: u64,
+    function: u32,
+    in_ptr: u32,
+    in_len: u32,
+    out_ptr: u32,
+    out_len: u32,
+) -> Result<()> {
+    let cluster = cluster_backend(caller)?;
+    let memory = guest_memory(caller, "memory")?;
+    let node_id = read_str(caller, memory, node_ptr, node_len)?;
+    let data = memory.data(&caller);
+    check_range(data.len(), in_ptr, in_len)?;
+    check_range(data.len(), out_ptr, out_len)?;
+    let task = Task {
+        function,
+        input: TaskInput::Arguments {
+            input: data[in_ptr as usize..][..in_len as usize].to_vec(),
+        },
+        out_len,
+        actor: Some(actor),
+    };
+    let output = cluster.run_task(&node_id, task).await?;
+    anyhow::ensure!(
+        output.len() <= out_len as usize,
+        "actor returned {} bytes for a {}-byte output region",
+        output.len(),
+        out_len
+    );
+    memory.write(&mut *caller, out_ptr as usize, &output)?;
+    Ok(())
+}
+
+async fn destroy_actor(
+    caller: &mut Caller<'_, KafuStore>,
+    node_ptr: u32,
+    node_len: u32,
+    actor: u64,
+) -> Result<()> {
+    let cluster = cluster_backend(caller)?;
+    let memory = guest_memory(caller, "memory")?;
+    let node_id = read_str(caller, memory, node_ptr, node_len)?;
+    cluster.destroy_actor(&node_id, actor).await
+}
+
+/// Writes the NUL-terminated IDs of the nodes in `group` back to back into the guest buffer and
+/// returns their number.
+fn group_nodes(
+    caller: &mut Caller<'_, KafuStore>,
+    group_ptr: u32,
+    group_len: u32,
+    buf_ptr: u32,
+    buf_len: u32,
+) -> Result<u32> {
+    let cluster = cluster_backend(caller)?;
+    let memory = guest_memory(caller, "memory")?;
+    let group = read_str(caller, memory, group_ptr, group_len)?;
+    let nodes = cluster.group_nodes(&group);
+    let mut buf = Vec::new();
+    for node in &nodes {
+        buf.extend_from_slice(node.as_bytes());
+        buf.push(0);
+    }
+    anyhow::ensure!(
+        buf.len() <= buf_len as usize,
+        "{}-byte buffer is too small for the nodes of group `{group}`",
+        buf_len
+    );
+    memory.write(&mut *caller, buf_ptr as usize, &buf)?;
+    Ok(nodes.len() as u32)
+}
+
+/// Links the `kafu` import module (see `include/kafu.h`).
+pub(crate) fn link_task_imports(linker: &mut Linker<KafuStore>) -> Result<()> {
+    for (name, snapshot) in [("spawn", true), ("offload", false)] {
+        linker.func_wrap_async(
+            "kafu",
+            name,
+            move |mut caller: Caller<'_, KafuStore>,
+                  (function, node_ptr, node_len, in_ptr, in_len, out_ptr, out_len): (
+                u32,
+                u32,
+                u32,
+                u32,
+                u32,
+                u32,
+                u32,
+            )| {
+                Box::new(async move {
+                    match spawn(
+                        &mut caller,
+                        snapshot,
+                        function,
+                        node_ptr,
+                        node_len,
+                        in_ptr,
+                        in_len,
+                        out_ptr,
+                        out_len,
+                    )
+                    .await
+                    {
+                        Ok(handle) => handle,
+                        Err(e) => {
+                            tracing::warn!("failed to spawn task: {e:#}");
+                            0
+                        }
+                    }
+                })
+            },
+        )?;
+    }
+    linker.func_wrap_async(
+        "kafu",
+        "join",
+        |mut caller: Caller<'_, KafuStore>, (handle,): (u32,)| {
+            Box::new(async move {
+                match join(&mut caller, handle).await {
+                    Ok(()) => 0i32,
+                    Err(e) => {
+                        tracing::warn!("task {handle} failed: {e:#}");
+                        1
+                    }
+                }
+            })
+        },
+    )?;
+    linker.func_wrap_async(
+        "kafu",
+        "actor_create",
+        |mut caller: Caller<'_, KafuStore>, (node_ptr, node_len): (u32, u32)| {
+            Box::new(async move {
+                match create_actor(&mut caller, node_ptr, node_len).await {
+                    Ok(actor) => actor as i64,
+                    Err(e) => {
+                        tracing::warn!("failed to create actor: {e:#}");
+                        0
+                    }
+                }
+            })
+        },
+    )?;
+    linker.func_wrap_async(
+        "kafu",
+        "actor_call",
+        |mut caller: Caller<'_, KafuStore>,
+         (node_ptr, node_len, actor, function, in_ptr, in_len, out_ptr, out_len): (
+            u32,
+            u32,
+            u64,
+            u32,
+            u32,
+            u32,
+            u32,
+            u32,
+        )| {
+            Box::new(async move {
+                match call_actor(
+                    &mut caller,
+                    node_ptr,
+                    node_len,
+                    actor,
+                    function,
+                    in_ptr,
+                    in_len,
+                    out_ptr,
+                    out_len,
+                )
+                .await
+                {
+                    Ok(()) => 0i32,
+                    Err(e) => {
+                        tracing::warn!("call to actor {actor} failed: {e:#}");
+                        1
+                    }
+                }
+            })
+        },
+    )?;
+    linker.func_wrap_async(
+        "kafu",
+        "actor_destroy",
+        |mut caller: Caller<'_, KafuStore>, (node_ptr, node_len, actor): (u32, u32, u64)| {
+            Box::new(async move {
+                match destroy_actor(&mut caller, node_ptr, node_len, actor).await {
+                    Ok(()) => 0i32,
+                    Err(e) => {
+                        tracing::warn!("failed to destroy actor {actor}: {e:#}");
+                        1
+                    }
+                }
+            })
+        },
+    )?;
+    linker.func_wrap(
+        "kafu",
+        "group_nodes",
+        |mut caller: Caller<'_, KafuStore>,
+         group_ptr: u32,
+         group_len: u32,
+         buf_ptr: u32,
+         buf_len: u32|
+         -> i32 {
+            match group_nodes(&mut caller, group_ptr, group_len, buf_ptr, buf_len) {
+                Ok(count) => count as i32,
+                Err(e) => {
+                    tracing::warn!("failed to resolve placement group: {e:#}");
+                    -1
+                }
+            }
+        },
+    )?;
+    Ok(())
+}
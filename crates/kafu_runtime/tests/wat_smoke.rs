@@ -1,9 +1,35 @@
+use std::path::PathBuf;
 use std::sync::{Arc, RwLock};
 
+use kafu_config::{ModelConfig, ModelEncoding};
 use kafu_runtime::engine::{
-    KafuRuntimeConfig, KafuRuntimeInstance, LinkerConfig, LinkerSnapifyConfig, WasiConfig,
-    WasmModule,
+    select_node, ChannelTable, EngineConfig, KafuRuntimeConfig, KafuRuntimeInstance,
+    KafuRuntimePre, LinkerConfig, LinkerSnapifyConfig, LocalCluster, NodeLoad, Received,
+    WasiConfig, WasmModule,
 };
+use sha2::{Digest, Sha256};
+
+/// Configuration of the tests below: `linker_config`, and defaults for everything else.
+fn test_config(node_id: &str, linker_config: LinkerConfig) -> KafuRuntimeConfig {
+    KafuRuntimeConfig {
+        node_id: node_id.to_string(),
+        wasi_config: WasiConfig::default(),
+        linker_config,
+        engine_config: EngineConfig::default(),
+        models: vec![],
+    }
+}
+
+/// Links the Kafu host functions if `kafu_helper` is set, and no WASI.
+fn linker_config(kafu_helper: bool, snapify: LinkerSnapifyConfig) -> LinkerConfig {
+    LinkerConfig {
+        wasip1: false,
+        wasi_nn: false,
+        spectest: false,
+        kafu_helper,
+        snapify,
+    }
+}
 
 #[tokio::test]
 async fn wat_can_run_start() -> anyhow::Result<()> {
@@ -27,6 +53,8 @@ async fn wat_can_run_start() -> anyhow::Result<()> {
             kafu_helper: false,
             snapify: LinkerSnapifyConfig::Disabled,
         },
+        engine_config: EngineConfig::default(),
+        models: vec![],
     };
 
     let mut instance = KafuRuntimeInstance::new(module, &config).await?;
@@ -74,6 +102,8 @@ async fn wasip1_hello_world_stdout_matches() -> anyhow::Result<()> {
             kafu_helper: false,
             snapify: LinkerSnapifyConfig::Disabled,
         },
+        engine_config: EngineConfig::default(),
+        models: vec![],
     };
 
     let mut instance = KafuRuntimeInstance::new(module, &config).await?;
@@ -83,3 +113,795 @@ async fn wasip1_hello_world_stdout_matches() -> anyhow::Result<()> {
     assert_eq!(out, "hello world\n");
     Ok(())
 }
+
+#[tokio::test]
+async fn pre_linked_module_can_instantiate_repeatedly() -> anyhow::Result<()> {
+    // Two memories, like a Snapify-processed module (`memory` + `snapify_memory`).
+    let wat_src = r#"
+(module
+  (memory (export "memory") 1)
+  (memory (export "snapify_memory") 1)
+  (func (export "snapify_checkpoint_globals"))
+  (func (export "_start")
+    (i32.store (memory 0) (i32.const 0) (i32.const 42)))
+)
+"#;
+
+    let wasm = wat::parse_str(wat_src)?;
+    let module = Arc::new(WasmModule::new(wasm).await?);
+
+    let config = test_config(
+        "test-node",
+        LinkerConfig {
+            wasip1: false,
+            wasi_nn: false,
+            spectest: true,
+            kafu_helper: false,
+            snapify: LinkerSnapifyConfig::Disabled,
+        },
+    );
+
+    let pre = KafuRuntimePre::new(module, &config)?;
+    // More iterations than pooled slots: slots must be recycled (and reset) when instances
+    // are dropped.
+    for _ in 0..16 {
+        let mut instance = pre.instantiate().await?;
+        let (main, _) = instance.get_snapshot().await?;
+        assert_eq!(&main[..4], &[0; 4]);
+        instance.start().await?;
+        let (main, _) = instance.get_snapshot().await?;
+        assert_eq!(&main[..4], &42i32.to_le_bytes());
+    }
+    Ok(())
+}
+
+#[tokio::test]
+async fn indexed_migration_point_switches_node_without_backtrace() -> anyhow::Result<()> {
+    // `foo` (func index 1) is a KAFU_DEST function for node2. Its migration points pass the
+    // function index and stack depth explicitly.
+    let wat_src = r#"
+(module
+  (import "snapify" "should_checkpoint"
+    (func $should_checkpoint (param i32 i32 i32) (result i32)))
+  (func $foo (export "foo")
+    (drop (call $should_checkpoint (i32.const 0) (i32.const 1) (i32.const 2)))
+    (drop (call $should_checkpoint (i32.const 1) (i32.const 1) (i32.const 2))))
+  (func (export "_start")
+    (call $foo))
+  (@custom ".kafu_dest.foo.node2" "")
+)
+"#;
+
+    let wasm = wat::parse_str(wat_src)?;
+    let module = Arc::new(WasmModule::new(wasm).await?);
+
+    let config = test_config("node1", linker_config(false, LinkerSnapifyConfig::Dummy));
+
+    let mut instance = KafuRuntimeInstance::new(module, &config).await?;
+    instance.start().await?;
+    // Entered node2 at depth 2 and returned to node1 at the same depth.
+    assert_eq!(instance.get_store().data().get_node_id(), "node1");
+    assert!(instance
+        .get_store()
+        .data()
+        .get_migration_ctx()
+        .get_migration_stack()
+        .is_empty());
+    Ok(())
+}
+
+#[tokio::test]
+async fn region_stays_on_its_node_across_calls() -> anyhow::Result<()> {
+    // Mirrors KAFU_REGION_BEGIN("node2") / KAFU_REGION_END() in kafu.h around two calls to `f`,
+    // a KAFU_DEST function for node2. `_start` records the current node hash (published at
+    // address 16) after the calls, at 32, and after the region, at 40.
+    let wat_src = r#"
+(module
+  (import "snapify" "should_checkpoint"
+    (func $should_checkpoint (param i32 i32 i32) (result i32)))
+  (import "kafu" "region_target" (func $region_target (param i32 i32) (result i32)))
+  (memory (export "memory") 1)
+  (memory (export "snapify_memory") 1)
+  (data (i32.const 0) "node2")
+  (global (export "__kafu_node_state") i32 (i32.const 16))
+  (func $enter (export "__kafu_region_enter")
+    (drop (call $should_checkpoint (i32.const 0) (i32.const 3) (i32.const 2)))
+    (drop (call $should_checkpoint (i32.const 1) (i32.const 3) (i32.const 2))))
+  (func $leave (export "__kafu_region_leave")
+    (drop (call $should_checkpoint (i32.const 0) (i32.const 4) (i32.const 2)))
+    (drop (call $should_checkpoint (i32.const 1) (i32.const 4) (i32.const 2))))
+  (func $f (export "f")
+    (drop (call $should_checkpoint (i32.const 0) (i32.const 5) (i32.const 2)))
+    (drop (call $should_checkpoint (i32.const 1) (i32.const 5) (i32.const 2))))
+  (func (export "snapify_checkpoint_globals"))
+  (func (export "_start")
+    (drop (call $region_target (i32.const 0) (i32.const 5)))
+    (call $enter)
+    (call $f)
+    (call $f)
+    (i64.store (i32.const 32) (i64.load (i32.const 16)))
+    (call $leave)
+    (i64.store (i32.const 40) (i64.load (i32.const 16))))
+  (@custom ".kafu_dest.__kafu_region_enter.__kafu_region_begin" "")
+  (@custom ".kafu_dest.__kafu_region_leave.__kafu_region_end" "")
+  (@custom ".kafu_dest.f.node2" "")
+)
+"#;
+
+    let wasm = wat::parse_str(wat_src)?;
+    let module = Arc::new(WasmModule::new(wasm).await?);
+
+    let config = test_config("node1", linker_config(true, LinkerSnapifyConfig::Dummy));
+
+    let mut instance = KafuRuntimeInstance::new(module, &config).await?;
+    instance.start().await?;
+    let hash = |node: &[u8]| {
+        node.iter().fold(0xcbf2_9ce4_8422_2325u64, |hash, b| {
+            (hash ^ u64::from(*b)).wrapping_mul(0x0100_0000_01b3)
+        })
+    };
+    let (main, _) = instance.get_snapshot().await?;
+    // Still on node2 after `f` returned, back on node1 after the region.
+    assert_eq!(&main[32..40], &hash(b"node2").to_le_bytes());
+    assert_eq!(&main[40..48], &hash(b"node1").to_le_bytes());
+    assert!(instance
+        .get_store()
+        .data()
+        .get_migration_ctx()
+        .get_migration_stack()
+        .is_empty());
+    Ok(())
+}
+
+#[tokio::test]
+async fn scratch_memory_is_left_out_of_snapshots() -> anyhow::Result<()> {
+    // Mirrors kafu_memory.h: `_start` marks [100, 108) as scratch, unmarks [104, 106) and
+    // discards [300, 308).
+    let wat_src = r#"
+(module
+  (import "kafu" "mark_scratch" (func $mark_scratch (param i32 i32) (result i32)))
+  (import "kafu" "unmark_scratch" (func $unmark_scratch (param i32 i32) (result i32)))
+  (import "kafu" "discard" (func $discard (param i32 i32) (result i32)))
+  (memory (export "memory") 1)
+  (memory (export "snapify_memory") 1)
+  (data (i32.const 100) "scratch!")
+  (data (i32.const 200) "live")
+  (data (i32.const 300) "dead")
+  (func (export "snapify_checkpoint_globals"))
+  (func (export "_start")
+    (drop (call $mark_scratch (i32.const 100) (i32.const 8)))
+    (drop (call $unmark_scratch (i32.const 104) (i32.const 2)))
+    (drop (call $discard (i32.const 300) (i32.const 8)))
+    ;; Out of bounds: fails without marking anything.
+    (i32.store (i32.const 400) (call $mark_scratch (i32.const 65535) (i32.const 2))))
+)
+"#;
+
+    let wasm = wat::parse_str(wat_src)?;
+    let module = Arc::new(WasmModule::new(wasm).await?);
+
+    let config = test_config("node1", linker_config(true, LinkerSnapifyConfig::Dummy));
+
+    let mut instance = KafuRuntimeInstance::new(module, &config).await?;
+    instance.start().await?;
+    let ranges: Vec<_> = instance
+        .get_store()
+        .data()
+        .get_scratch_ranges()
+        .iter()
+        .collect();
+    assert_eq!(ranges, vec![100..104, 106..108]);
+    let (main, _) = instance.get_snapshot().await?;
+    assert_eq!(&main[100..108], b"\0\0\0\0tc\0\0");
+    assert_eq!(&main[200..204], b"live");
+    assert_eq!(&main[300..308], &[0; 8]);
+    assert_eq!(&main[400..404], &1u32.to_le_bytes());
+    Ok(())
+}
+
+#[tokio::test]
+async fn blobs_are_read_by_digest() -> anyhow::Result<()> {
+    // Mirrors kafu_blob.h: `_start` stores "hello world" as a blob, then reads its size and its
+    // last five bytes back. Reading a blob that no node holds fails.
+    let wat_src = r#"
+(module
+  (import "kafu" "blob_put" (func $blob_put (param i32 i32 i32) (result i32)))
+  (import "kafu" "blob_size" (func $blob_size (param i32) (result i64)))
+  (import "kafu" "blob_read" (func $blob_read (param i32 i64 i32 i32) (result i64)))
+  (memory (export "memory") 1)
+  (memory (export "snapify_memory") 1)
+  (data (i32.const 100) "hello world")
+  (func (export "snapify_checkpoint_globals"))
+  (func (export "_start")
+    (i32.store (i32.const 300) (call $blob_put (i32.const 100) (i32.const 11) (i32.const 200)))
+    (i64.store (i32.const 304) (call $blob_size (i32.const 200)))
+    (i64.store (i32.const 312)
+      (call $blob_read (i32.const 200) (i64.const 6) (i32.const 400) (i32.const 16)))
+    (i64.store (i32.const 320) (call $blob_size (i32.const 600))))
+)
+"#;
+
+    let wasm = wat::parse_str(wat_src)?;
+    let module = Arc::new(WasmModule::new(wasm).await?);
+
+    let config = test_config("node1", linker_config(true, LinkerSnapifyConfig::Dummy));
+
+    let mut instance = KafuRuntimeInstance::new(module, &config).await?;
+    instance.start().await?;
+    let (main, _) = instance.get_snapshot().await?;
+    assert_eq!(&main[200..232], Sha256::digest(b"hello world").as_slice());
+    assert_eq!(&main[300..304], &0u32.to_le_bytes());
+    assert_eq!(&main[304..312], &11i64.to_le_bytes());
+    assert_eq!(&main[312..320], &5i64.to_le_bytes());
+    assert_eq!(&main[400..406], b"world\0");
+    assert_eq!(&main[320..328], &(-1i64).to_le_bytes());
+    Ok(())
+}
+
+#[tokio::test]
+async fn blobs_load_files_inside_the_preopened_dir_only() -> anyhow::Result<()> {
+    // `_start` loads "/data.txt", which is in the preopened directory, and "../secret.txt",
+    // which is next to it.
+    let wat_src = r#"
+(module
+  (import "kafu" "blob_load" (func $blob_load (param i32 i32 i32) (result i32)))
+  (memory (export "memory") 1)
+  (memory (export "snapify_memory") 1)
+  (data (i32.const 0) "/data.txt")
+  (data (i32.const 32) "../secret.txt")
+  (func (export "snapify_checkpoint_globals"))
+  (func (export "_start")
+    (i32.store (i32.const 300) (call $blob_load (i32.const 0) (i32.const 9) (i32.const 200)))
+    (i32.store (i32.const 304) (call $blob_load (i32.const 32) (i32.const 13) (i32.const 240))))
+)
+"#;
+
+    let dir = std::env::temp_dir().join(format!("kafu-blob-load-{}", std::process::id()));
+    let root = dir.join("root");
+    std::fs::create_dir_all(&root)?;
+    std::fs::write(root.join("data.txt"), b"hello")?;
+    std::fs::write(dir.join("secret.txt"), b"secret")?;
+
+    let wasm = wat::parse_str(wat_src)?;
+    let module = Arc::new(WasmModule::new(wasm).await?);
+
+    let mut config = test_config("node1", linker_config(true, LinkerSnapifyConfig::Dummy));
+    config.wasi_config.preopened_dir = Some(root);
+
+    let mut instance = KafuRuntimeInstance::new(module, &config).await?;
+    let result = instance.start().await;
+    std::fs::remove_dir_all(&dir)?;
+    result?;
+    let (main, _) = instance.get_snapshot().await?;
+    assert_eq!(&main[300..304], &0u32.to_le_bytes());
+    assert_eq!(&main[200..232], Sha256::digest(b"hello").as_slice());
+    assert_eq!(&main[304..308], &1u32.to_le_bytes());
+    Ok(())
+}
+
+/// A config that preloads `model` under the name `classifier`.
+fn model_config(model: ModelConfig) -> KafuRuntimeConfig {
+    let mut config = test_config("node1", linker_config(false, LinkerSnapifyConfig::Disabled));
+    config.models = vec![("classifier".to_string(), model)];
+    config
+}
+
+#[tokio::test]
+async fn missing_model_file_fails_pre_linking() -> anyhow::Result<()> {
+    let wasm = wat::parse_str(r#"(module (func (export "_start")))"#)?;
+    let module = Arc::new(WasmModule::new(wasm).await?);
+
+    let config = model_config(ModelConfig {
+        path: PathBuf::from("/nonexistent/classifier.onnx"),
+        encoding: ModelEncoding::Onnx,
+    });
+    let err = KafuRuntimePre::new(module, &config)
+        .err()
+        .expect("a missing model must fail");
+    let message = format!("{err:#}");
+    assert!(
+        message.contains("failed to load model `classifier`"),
+        "{message}"
+    );
+    assert!(
+        message.contains("/nonexistent/classifier.onnx"),
+        "{message}"
+    );
+    Ok(())
+}
+
+#[tokio::test]
+async fn model_without_backend_fails_pre_linking() -> anyhow::Result<()> {
+    let wasm = wat::parse_str(r#"(module (func (export "_start")))"#)?;
+    let module = Arc::new(WasmModule::new(wasm).await?);
+
+    // No wasi-nn backend for ggml is built in; the encoding is checked before the file.
+    let config = model_config(ModelConfig {
+        path: PathBuf::from("/nonexistent/classifier.gguf"),
+        encoding: ModelEncoding::Ggml,
+    });
+    let err = KafuRuntimePre::new(module, &config)
+        .err()
+        .expect("an encoding without a backend must fail");
+    let message = format!("{err:#}");
+    assert!(
+        message.contains("failed to load model `classifier`"),
+        "{message}"
+    );
+    assert!(message.contains("ggml"), "{message}");
+    Ok(())
+}
+
+#[tokio::test]
+async fn models_are_looked_up_by_name() -> anyhow::Result<()> {
+    // `_start` stores the errno of `load_by_name("classifier")` at address 16.
+    let wat_src = r#"
+(module
+  (import "wasi_ephemeral_nn" "load_by_name"
+    (func $load_by_name (param i32 i32 i32) (result i32)))
+  (memory (export "memory") 1)
+  (memory (export "snapify_memory") 1)
+  (data (i32.const 0) "classifier")
+  (func (export "snapify_checkpoint_globals"))
+  (func (export "_start")
+    (i32.store (i32.const 16) (call $load_by_name (i32.const 0) (i32.const 10) (i32.const 32))))
+)
+"#;
+
+    let wasm = wat::parse_str(wat_src)?;
+    let module = Arc::new(WasmModule::new(wasm).await?);
+
+    // No model is preloaded, so the name is not found.
+    let config = test_config(
+        "node1",
+        LinkerConfig {
+            wasip1: false,
+            wasi_nn: true,
+            spectest: false,
+            kafu_helper: false,
+            snapify: LinkerSnapifyConfig::Disabled,
+        },
+    );
+
+    let mut instance = KafuRuntimeInstance::new(module, &config).await?;
+    instance.start().await?;
+    let (main, _) = instance.get_snapshot().await?;
+    assert_ne!(&main[16..20], &0u32.to_le_bytes());
+    Ok(())
+}
+
+#[tokio::test]
+async fn free_heap_spans_are_left_out_of_snapshots() -> anyhow::Result<()> {
+    // Mirrors `__kafu_free_spans` in kafu_memory.h: the table lives at address 512 and lists
+    // [100, 108) as free, plus a released span.
+    let wat_src = r#"
+(module
+  (memory (export "memory") 1)
+  (memory (export "snapify_memory") 1)
+  (data (i32.const 100) "freebyte")
+  (data (i32.const 200) "live")
+  (data (i32.const 512)
+    "\02\00\00\00" "\64\00\00\00" "\08\00\00\00" "\ff\ff\ff\ff" "\00\00\00\00")
+  (global (export "__kafu_free_spans") i32 (i32.const 512))
+  (func (export "snapify_checkpoint_globals"))
+  (func (export "_start"))
+)
+"#;
+
+    let wasm = wat::parse_str(wat_src)?;
+    let module = Arc::new(WasmModule::new(wasm).await?);
+
+    let config = test_config("node1", linker_config(false, LinkerSnapifyConfig::Disabled));
+
+    let mut instance = KafuRuntimeInstance::new(module, &config).await?;
+    let (main, _) = instance.get_snapshot().await?;
+    assert_eq!(&main[100..108], &[0; 8]);
+    assert_eq!(&main[200..204], b"live");
+    assert_eq!(&main[512..516], &2u32.to_le_bytes());
+    Ok(())
+}
+
+#[tokio::test]
+async fn shadow_stack_below_stack_pointer_is_left_out_of_snapshots() -> anyhow::Result<()> {
+    // The shadow stack spans [1024, 4096) and the stack pointer is at 3072, as exported by
+    // `kafu clang`.
+    let wat_src = r#"
+(module
+  (memory (export "memory") 1)
+  (memory (export "snapify_memory") 1)
+  (global (export "__stack_pointer") (mut i32) (i32.const 3072))
+  (global (export "__stack_low") i32 (i32.const 1024))
+  (data (i32.const 2048) "dead")
+  (data (i32.const 3072) "live")
+  (func (export "snapify_checkpoint_globals"))
+  (func (export "_start"))
+)
+"#;
+
+    let wasm = wat::parse_str(wat_src)?;
+    let module = Arc::new(WasmModule::new(wasm).await?);
+
+    let config = test_config("node1", linker_config(false, LinkerSnapifyConfig::Disabled));
+
+    let mut instance = KafuRuntimeInstance::new(module, &config).await?;
+    let (main, _) = instance.get_snapshot().await?;
+    assert_eq!(&main[2048..2052], &[0; 4]);
+    assert_eq!(&main[3072..3076], b"live");
+    Ok(())
+}
+
+#[tokio::test]
+async fn node_state_is_published_to_guest() -> anyhow::Result<()> {
+    // Mirrors `__kafu_node_state` in kafu.h, whose address kafu clang exports: the state lives
+    // at address 16.
+    let wat_src = r#"
+(module
+  (memory (export "memory") 1)
+  (memory (export "snapify_memory") 1)
+  (global (export "__kafu_node_state") i32 (i32.const 16))
+  (func (export "snapify_checkpoint_globals"))
+  (func (export "_start"))
+)
+"#;
+
+    let wasm = wat::parse_str(wat_src)?;
+    let module = Arc::new(WasmModule::new(wasm).await?);
+
+    let config = test_config("node1", linker_config(false, LinkerSnapifyConfig::Disabled));
+
+    let mut instance = KafuRuntimeInstance::new(module, &config).await?;
+    let (main, _) = instance.get_snapshot().await?;
+    // 64-bit FNV-1a of "node1", as computed by `kafu_node_hash`.
+    let expected = b"node1".iter().fold(0xcbf2_9ce4_8422_2325u64, |hash, b| {
+        (hash ^ u64::from(*b)).wrapping_mul(0x0100_0000_01b3)
+    });
+    assert_eq!(&main[16..24], &expected.to_le_bytes());
+    assert_eq!(&main[24..28], &0u32.to_le_bytes());
+    Ok(())
+}
+
+#[tokio::test]
+async fn wasi_threads_modules_are_rejected() -> anyhow::Result<()> {
+    let wat_src = r#"
+(module
+  (import "env" "memory" (memory 1 1 shared))
+  (import "wasi" "thread-spawn" (func (param i32) (result i32)))
+  (func (export "_start"))
+)
+"#;
+
+    let wasm = wat::parse_str(wat_src)?;
+    let err = WasmModule::new(wasm)
+        .await
+        .err()
+        .expect("module must be rejected");
+    assert!(err.to_string().contains("wasi-threads"));
+    Ok(())
+}
+
+#[tokio::test]
+async fn spawned_task_output_is_copied_back() -> anyhow::Result<()> {
+    // Mirrors KAFU_SPAWN in kafu.h: `$double` (function pointer 1) reads the i32 at `in` and
+    // writes twice its value to `out`, on node2.
+    let wat_src = r#"
+(module
+  (import "kafu" "spawn"
+    (func $spawn (param i32 i32 i32 i32 i32 i32 i32) (result i32)))
+  (import "kafu" "join" (func $join (param i32) (result i32)))
+  (memory (export "memory") 1)
+  (memory (export "snapify_memory") 1)
+  (table (export "__indirect_function_table") 2 funcref)
+  (elem (i32.const 1) $double)
+  (data (i32.const 0) "node2")
+  (data (i32.const 16) "\15\00\00\00")
+  (func $double (param $in i32) (param $in_len i32) (param $out i32) (param $out_len i32)
+    (i32.store (local.get $out) (i32.mul (i32.load (local.get $in)) (i32.const 2))))
+  (func (export "snapify_checkpoint_globals"))
+  (func (export "snapify_restore_globals"))
+  (func (export "_start")
+    (if (call $join
+          (call $spawn (i32.const 1) (i32.const 0) (i32.const 5)
+                       (i32.const 16) (i32.const 4) (i32.const 32) (i32.const 4)))
+      (then unreachable)))
+)
+"#;
+
+    let wasm = wat::parse_str(wat_src)?;
+    let module = Arc::new(WasmModule::new(wasm).await?);
+
+    let config = test_config("node1", linker_config(true, LinkerSnapifyConfig::Disabled));
+
+    let pre = Arc::new(KafuRuntimePre::new(module, &config)?);
+    pre.set_cluster(Arc::new(LocalCluster::new(&pre)))?;
+    let mut instance = pre.instantiate().await?;
+    instance.start().await?;
+    let (main, _) = instance.get_snapshot().await?;
+    assert_eq!(&main[32..36], &42u32.to_le_bytes());
+    Ok(())
+}
+
+#[tokio::test]
+async fn program_does_not_migrate_with_unjoined_tasks() -> anyhow::Result<()> {
+    // `_start` spawns `$double` as in `spawned_task_output_is_copied_back`, then calls `f`, a
+    // KAFU_DEST function for node2, before joining. `f` records the node hash (published at
+    // address 64) at 80.
+    let wat_src = r#"
+(module
+  (import "snapify" "should_checkpoint"
+    (func $should_checkpoint (param i32 i32 i32) (result i32)))
+  (import "kafu" "spawn"
+    (func $spawn (param i32 i32 i32 i32 i32 i32 i32) (result i32)))
+  (import "kafu" "join" (func $join (param i32) (result i32)))
+  (memory (export "memory") 1)
+  (memory (export "snapify_memory") 1)
+  (table (export "__indirect_function_table") 2 funcref)
+  (elem (i32.const 1) $double)
+  (global (export "__kafu_node_state") i32 (i32.const 64))
+  (data (i32.const 0) "node2")
+  (data (i32.const 16) "\15\00\00\00")
+  (func $double (param $in i32) (param $in_len i32) (param $out i32) (param $out_len i32)
+    (i32.store (local.get $out) (i32.mul (i32.load (local.get $in)) (i32.const 2))))
+  (func $f (export "f")
+    (drop (call $should_checkpoint (i32.const 0) (i32.const 4) (i32.const 2)))
+    (i64.store (i32.const 80) (i64.load (i32.const 64)))
+    (drop (call $should_checkpoint (i32.const 1) (i32.const 4) (i32.const 2))))
+  (func (export "snapify_checkpoint_globals"))
+  (func (export "snapify_restore_globals"))
+  (func (export "_start") (local $task i32)
+    (local.set $task
+      (call $spawn (i32.const 1) (i32.const 0) (i32.const 5)
+                   (i32.const 16) (i32.const 4) (i32.const 32) (i32.const 4)))
+    (call $f)
+    (if (call $join (local.get $task))
+      (then unreachable)))
+  (@custom ".kafu_dest.f.node2" "")
+)
+"#;
+
+    let wasm = wat::parse_str(wat_src)?;
+    let module = Arc::new(WasmModule::new(wasm).await?);
+
+    let config = test_config("node1", linker_config(true, LinkerSnapifyConfig::Dummy));
+
+    let pre = Arc::new(KafuRuntimePre::new(module, &config)?);
+    pre.set_cluster(Arc::new(LocalCluster::new(&pre)))?;
+    let mut instance = pre.instantiate().await?;
+    instance.start().await?;
+    let (main, _) = instance.get_snapshot().await?;
+    let node1 = b"node1".iter().fold(0xcbf2_9ce4_8422_2325u64, |hash, b| {
+        (hash ^ u64::from(*b)).wrapping_mul(0x0100_0000_01b3)
+    });
+    assert_eq!(&main[80..88], &node1.to_le_bytes());
+    assert_eq!(&main[32..36], &42u32.to_le_bytes());
+    assert_eq!(instance.get_store().data().get_node_id(), "node1");
+    Ok(())
+}
+
+#[tokio::test]
+async fn offloaded_task_runs_on_its_arguments_only() -> anyhow::Result<()> {
+    // Mirrors KAFU_OFFLOAD in kafu.h. `__kafu_init` stands in for the constructors: it stores
+    // the factor 3 at address 8, which the caller never sets. `$scale` multiplies its input by it.
+    let wat_src = r#"
+(module
+  (import "kafu" "offload"
+    (func $offload (param i32 i32 i32 i32 i32 i32 i32) (result i32)))
+  (import "kafu" "join" (func $join (param i32) (result i32)))
+  (memory (export "memory") 1)
+  (memory (export "snapify_memory") 1)
+  (table (export "__indirect_function_table") 2 funcref)
+  (elem (i32.const 1) $scale)
+  (data (i32.const 0) "node2")
+  (data (i32.const 16) "\0e\00\00\00")
+  (func (export "__kafu_init")
+    (i32.store (i32.const 8) (i32.const 3)))
+  (func $scale (param $in i32) (param $in_len i32) (param $out i32) (param $out_len i32)
+    (i32.store (local.get $out) (i32.mul (i32.load (local.get $in)) (i32.load (i32.const 8)))))
+  (func (export "snapify_checkpoint_globals"))
+  (func (export "_start")
+    (if (call $join
+          (call $offload (i32.const 1) (i32.const 0) (i32.const 5)
+                         (i32.const 16) (i32.const 4) (i32.const 32) (i32.const 4)))
+      (then unreachable)))
+)
+"#;
+
+    let wasm = wat::parse_str(wat_src)?;
+    let module = Arc::new(WasmModule::new(wasm).await?);
+
+    let config = test_config("node1", linker_config(true, LinkerSnapifyConfig::Disabled));
+
+    let pre = Arc::new(KafuRuntimePre::new(module, &config)?);
+    pre.set_cluster(Arc::new(LocalCluster::new(&pre)))?;
+    let mut instance = pre.instantiate().await?;
+    instance.start().await?;
+    let (main, _) = instance.get_snapshot().await?;
+    assert_eq!(&main[32..36], &42u32.to_le_bytes());
+    // The caller's own memory is untouched apart from the output region.
+    assert_eq!(&main[8..12], &0u32.to_le_bytes());
+    Ok(())
+}
+
+#[tokio::test]
+async fn actor_state_persists_across_calls() -> anyhow::Result<()> {
+    // Mirrors KAFU_ACTOR in kafu.h: `$count` (function pointer 1) increments a counter at
+    // address 8 of the actor's memory and returns it. The caller's own counter stays at 0.
+    let wat_src = r#"
+(module
+  (import "kafu" "actor_create" (func $create (param i32 i32) (result i64)))
+  (import "kafu" "actor_call"
+    (func $call (param i32 i32 i64 i32 i32 i32 i32 i32) (result i32)))
+  (import "kafu" "actor_destroy" (func $destroy (param i32 i32 i64) (result i32)))
+  (memory (export "memory") 1)
+  (memory (export "snapify_memory") 1)
+  (table (export "__indirect_function_table") 2 funcref)
+  (elem (i32.const 1) $count)
+  (data (i32.const 0) "node2")
+  (func $count (param $in i32) (param $in_len i32) (param $out i32) (param $out_len i32)
+    (i32.store (i32.const 8) (i32.add (i32.load (i32.const 8)) (i32.const 1)))
+    (i32.store (local.get $out) (i32.load (i32.const 8))))
+  (func (export "snapify_checkpoint_globals"))
+  (func (export "_start")
+    (local $actor i64)
+    (local.set $actor (call $create (i32.const 0) (i32.const 5)))
+    (if (i64.eqz (local.get $actor)) (then unreachable))
+    (if (call $call (i32.const 0) (i32.const 5) (local.get $actor) (i32.const 1)
+                    (i32.const 16) (i32.const 0) (i32.const 32) (i32.const 4))
+      (then unreachable))
+    (if (call $call (i32.const 0) (i32.const 5) (local.get $actor) (i32.const 1)
+                    (i32.const 16) (i32.const 0) (i32.const 36) (i32.const 4))
+      (then unreachable))
+    (if (call $destroy (i32.const 0) (i32.const 5) (local.get $actor))
+      (then unreachable)))
+)
+"#;
+
+    let wasm = wat::parse_str(wat_src)?;
+    let module = Arc::new(WasmModule::new(wasm).await?);
+
+    let config = test_config("node1", linker_config(true, LinkerSnapifyConfig::Disabled));
+
+    let pre = Arc::new(KafuRuntimePre::new(module, &config)?);
+    pre.set_cluster(Arc::new(LocalCluster::new(&pre)))?;
+    let mut instance = pre.instantiate().await?;
+    instance.start().await?;
+    let (main, _) = instance.get_snapshot().await?;
+    assert_eq!(&main[32..36], &1u32.to_le_bytes());
+    assert_eq!(&main[36..40], &2u32.to_le_bytes());
+    assert_eq!(&main[8..12], &0u32.to_le_bytes());
+    Ok(())
+}
+
+#[tokio::test]
+async fn channel_streams_messages_to_a_concurrent_task() -> anyhow::Result<()> {
+    // Mirrors kafu_channel_* in kafu.h. `$consume` (function pointer 1) runs as a task and sums
+    // the bytes it receives from channel "c" until it is closed. The channel holds one message,
+    // so the caller can only send the next byte once the task has taken the previous one.
+    let wat_src = r#"
+(module
+  (import "kafu" "offload"
+    (func $offload (param i32 i32 i32 i32 i32 i32 i32) (result i32)))
+  (import "kafu" "join" (func $join (param i32) (result i32)))
+  (import "kafu" "channel_open" (func $open (param i32 i32 i32 i32 i32) (result i32)))
+  (import "kafu" "channel_send" (func $send (param i32 i32 i32 i32 i32 i32) (result i32)))
+  (import "kafu" "channel_recv" (func $recv (param i32 i32 i32 i32 i32 i32) (result i32)))
+  (import "kafu" "channel_close" (func $close (param i32 i32 i32 i32) (result i32)))
+  (memory (export "memory") 1)
+  (memory (export "snapify_memory") 1)
+  (table (export "__indirect_function_table") 2 funcref)
+  (elem (i32.const 1) $consume)
+  (data (i32.const 0) "c")
+  (data (i32.const 8) "node1")
+  (data (i32.const 16) "node2")
+  (data (i32.const 32) "\05\07\1e")
+  (func $consume (param $in i32) (param $in_len i32) (param $out i32) (param $out_len i32)
+    (local $sum i32)
+    (block $closed
+      (loop $next
+        (br_if $closed (i32.lt_s (call $recv (i32.const 0) (i32.const 1) (i32.const 8)
+                                             (i32.const 5) (i32.const 64) (i32.const 16))
+                                 (i32.const 0)))
+        (local.set $sum (i32.add (local.get $sum) (i32.load8_u (i32.const 64))))
+        (br $next)))
+    (i32.store (local.get $out) (local.get $sum)))
+  (func (export "snapify_checkpoint_globals"))
+  (func (export "_start")
+    (local $task i32)
+    (local $i i32)
+    (if (call $open (i32.const 0) (i32.const 1) (i32.const 8) (i32.const 5) (i32.const 1))
+      (then unreachable))
+    (local.set $task (call $offload (i32.const 1) (i32.const 16) (i32.const 5)
+                                    (i32.const 0) (i32.const 0) (i32.const 48) (i32.const 4)))
+    (if (i32.eqz (local.get $task)) (then unreachable))
+    (loop $next
+      (if (call $send (i32.const 0) (i32.const 1) (i32.const 8) (i32.const 5)
+                      (i32.add (i32.const 32) (local.get $i)) (i32.const 1))
+        (then unreachable))
+      (local.set $i (i32.add (local.get $i) (i32.const 1)))
+      (br_if $next (i32.lt_u (local.get $i) (i32.const 3))))
+    (if (call $close (i32.const 0) (i32.const 1) (i32.const 8) (i32.const 5))
+      (then unreachable))
+    (if (call $join (local.get $task)) (then unreachable)))
+)
+"#;
+
+    let wasm = wat::parse_str(wat_src)?;
+    let module = Arc::new(WasmModule::new(wasm).await?);
+
+    let config = test_config("node1", linker_config(true, LinkerSnapifyConfig::Disabled));
+
+    let pre = Arc::new(KafuRuntimePre::new(module, &config)?);
+    pre.set_cluster(Arc::new(LocalCluster::new(&pre)))?;
+    let mut instance = pre.instantiate().await?;
+    instance.start().await?;
+    let (main, _) = instance.get_snapshot().await?;
+    assert_eq!(&main[48..52], &42u32.to_le_bytes());
+    Ok(())
+}
+
+#[tokio::test]
+async fn channel_message_too_long_for_the_buffer_stays_queued() -> anyhow::Result<()> {
+    let channels = ChannelTable::default();
+    channels.send("c", b"abc".to_vec()).await?;
+    channels.send("c", b"d".to_vec()).await?;
+    assert_eq!(channels.recv("c", 2).await, Received::TooLong(3));
+    assert_eq!(
+        channels.recv("c", 3).await,
+        Received::Message(b"abc".to_vec())
+    );
+    assert_eq!(
+        channels.recv("c", 3).await,
+        Received::Message(b"d".to_vec())
+    );
+    channels.close("c");
+    assert_eq!(channels.recv("c", 3).await, Received::Closed);
+    Ok(())
+}
+
+#[test]
+fn group_destinations_pick_the_least_loaded_node() {
+    let busy = NodeLoad {
+        running_tasks: 2,
+        queued_tasks: 1,
+        latency: None,
+        unreachable: false,
+    };
+    let near = NodeLoad {
+        latency: Some(std::time::Duration::from_millis(1)),
+        ..NodeLoad::default()
+    };
+    let loads = |node: &str| match node {
+        "edge1" => Some(busy),
+        "edge3" => Some(near),
+        _ => None,
+    };
+    let edge = ["edge1", "edge2", "edge3"];
+    // Idle nodes win over busy ones; among idle nodes, the known-near one wins.
+    assert_eq!(select_node(&edge, "cloud1", loads), Some("edge3"));
+    // The current node wins ties, so the program does not migrate needlessly.
+    assert_eq!(select_node(&edge, "edge2", loads), Some("edge2"));
+    assert_eq!(select_node(&[], "edge2", loads), None);
+}
+
+#[test]
+fn group_destinations_skip_unreachable_nodes() {
+    let unreachable = NodeLoad {
+        unreachable: true,
+        ..NodeLoad::default()
+    };
+    let busy = NodeLoad {
+        running_tasks: 1,
+        ..NodeLoad::default()
+    };
+    let loads = |node: &str| match node {
+        "edge1" => Some(unreachable),
+        "edge2" => Some(busy),
+        _ => None,
+    };
+    let edge = ["edge1", "edge2"];
+    // edge1 runs no tasks, but its last heartbeat failed: the busy edge2 is picked instead, even
+    // when the program is on edge1.
+    assert_eq!(select_node(&edge, "cloud1", loads), Some("edge2"));
+    assert_eq!(select_node(&edge, "edge1", loads), Some("edge2"));
+    // An explicit node ID resolves to itself even after a missed heartbeat.
+    assert_eq!(select_node(&["edge1"], "cloud1", loads), Some("edge1"));
+}
@@ -8,8 +8,11 @@ use tonic_health::{
 };
 
 use crate::grpc::kafu_proto::{
-    CheckSnapshotCacheRequest, CheckSnapshotCacheResponse, HeartbeatRequest, HeartbeatResponse,
-    MigrateRequest, MigrateResponse, ShutdownRequest, ShutdownResponse,
+    ChannelMessage, CheckSnapshotCacheRequest, CheckSnapshotCacheResponse, CreateActorRequest,
+    CreateActorResponse, DestroyActorRequest, DestroyActorResponse, GetBlobRequest,
+    GetBlobResponse, HeartbeatRequest, HeartbeatResponse, MigrateRequest, MigrateResponse,
+    OpenChannelRequest, OpenChannelResponse, RecvChannelRequest, RecvChannelResponse,
+    RunTaskRequest, RunTaskResponse, SendChannelResponse, ShutdownRequest, ShutdownResponse,
     command_client::CommandClient,
 };
 use crate::{
@@ -21,9 +24,13 @@ const GRPC_CONNECT_TIMEOUT: Duration = Duration::from_secs(3);
 const GRPC_RPC_TIMEOUT: Duration = Duration::from_secs(10);
 
 async fn connect_with_timeouts(endpoint: Endpoint) -> KafuResult<tonic::transport::Channel> {
+    connect(endpoint.timeout(GRPC_RPC_TIMEOUT)).await
+}
+
+/// Connects without a per-RPC timeout, for RPCs that run guest code of unbounded duration.
+async fn connect(endpoint: Endpoint) -> KafuResult<tonic::transport::Channel> {
     let endpoint = endpoint
         .connect_timeout(GRPC_CONNECT_TIMEOUT)
-        .timeout(GRPC_RPC_TIMEOUT)
         .tcp_keepalive(Some(Duration::from_secs(30)));
 
     match timeout(GRPC_CONNECT_TIMEOUT, endpoint.connect()).await {
@@ -56,6 +63,84 @@ pub async fn send_migration_request(
     Ok(response.into_inner())
 }
 
+pub async fn run_task(request: RunTaskRequest, endpoint: Endpoint) -> KafuResult<RunTaskResponse> {
+    let channel = connect(endpoint).await?;
+    let mut client = CommandClient::new(channel)
+        .max_decoding_message_size(MAX_MESSAGE_SIZE)
+        .max_encoding_message_size(MAX_MESSAGE_SIZE);
+    let response = client.run_task(request).await?;
+    Ok(response.into_inner())
+}
+
+pub async fn create_actor(
+    request: CreateActorRequest,
+    endpoint: Endpoint,
+) -> KafuResult<CreateActorResponse> {
+    let channel = connect(endpoint).await?;
+    let mut client = CommandClient::new(channel);
+    let response = client.create_actor(request).await?;
+    Ok(response.into_inner())
+}
+
+pub async fn destroy_actor(
+    request: DestroyActorRequest,
+    endpoint: Endpoint,
+) -> KafuResult<DestroyActorResponse> {
+    let channel = connect_with_timeouts(endpoint).await?;
+    let mut client = CommandClient::new(channel);
+    let response = client.destroy_actor(request).await?;
+    Ok(response.into_inner())
+}
+
+pub async fn open_channel(
+    request: OpenChannelRequest,
+    endpoint: Endpoint,
+) -> KafuResult<OpenChannelResponse> {
+    let channel = connect_with_timeouts(endpoint).await?;
+    let mut client = CommandClient::new(channel);
+    let response = client.open_channel(request).await?;
+    Ok(response.into_inner())
+}
+
+/// Sends `messages` over one `SendChannel` stream, until `messages` ends.
+pub async fn send_channel(
+    messages: impl tokio_stream::Stream<Item = ChannelMessage> + Send + 'static,
+    endpoint: Endpoint,
+) -> KafuResult<SendChannelResponse> {
+    let channel = connect(endpoint).await?;
+    let mut client = CommandClient::new(channel)
+        .max_decoding_message_size(MAX_MESSAGE_SIZE)
+        .max_encoding_message_size(MAX_MESSAGE_SIZE);
+    let response = client.send_channel(messages).await?;
+    Ok(response.into_inner())
+}
+
+/// Connects for [`recv_channel`]. The connection is meant to be kept and reused for every
+/// receive from the node.
+pub async fn recv_channel_connection(endpoint: Endpoint) -> KafuResult<tonic::transport::Channel> {
+    connect(endpoint).await
+}
+
+pub async fn recv_channel(
+    request: RecvChannelRequest,
+    connection: tonic::transport::Channel,
+) -> KafuResult<RecvChannelResponse> {
+    let mut client = CommandClient::new(connection)
+        .max_decoding_message_size(MAX_MESSAGE_SIZE)
+        .max_encoding_message_size(MAX_MESSAGE_SIZE);
+    let response = client.recv_channel(request).await?;
+    Ok(response.into_inner())
+}
+
+pub async fn get_blob(request: GetBlobRequest, endpoint: Endpoint) -> KafuResult<GetBlobResponse> {
+    let channel = connect(endpoint).await?;
+    let mut client = CommandClient::new(channel)
+        .max_decoding_message_size(MAX_MESSAGE_SIZE)
+        .max_encoding_message_size(MAX_MESSAGE_SIZE);
+    let response = client.get_blob(request).await?;
+    Ok(response.into_inner())
+}
+
 pub async fn send_shutdown_request(
     request: ShutdownRequest,
     endpoint: Endpoint,
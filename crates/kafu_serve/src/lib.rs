@@ -12,6 +12,7 @@ mod liveness;
 mod migration;
 mod runtime;
 mod service;
+mod tasks;
 
 mod testing;
 
@@ -34,7 +35,8 @@ use clap::Parser as _;
 use grpc::kafu_proto::command_server::CommandServer;
 use kafu_config::{KafuConfig, WasmLocation};
 use kafu_runtime::engine::{
-    KafuRuntimeConfig, KafuRuntimeInstance, LinkerConfig, WasiConfig, WasmModule,
+    KafuRuntimeConfig, KafuRuntimeInstance, KafuRuntimePre, LinkerConfig, LocalCluster, WasiConfig,
+    WasmModule,
 };
 use sha2::{Digest, Sha256};
 use tokio::{
@@ -77,6 +79,12 @@ fn make_runtime_config(node_id: &str, kafu_config: &KafuConfig) -> Arc<KafuRunti
         node_id: node_id.to_string(),
         wasi_config: WasiConfig::create_from_kafu_config(kafu_config),
         linker_config: LinkerConfig::default(),
+        engine_config: kafu_config
+            .nodes
+            .get(node_id)
+            .and_then(|node| node.engine.clone())
+            .unwrap_or_default(),
+        models: kafu_config.get_node_models(node_id),
     })
 }
 
@@ -101,18 +109,50 @@ async fn load_wasm_binary(kafu_config: &KafuConfig) -> Result<Vec<u8>, KafuError
     }
 }
 
-async fn build_wasm_module(wasm_binary: Vec<u8>) -> Result<Arc<WasmModule>, KafuError> {
-    let wasm = WasmModule::new(wasm_binary)
-        .await
-        .map_err(KafuError::WasmInstantiationError)?;
+/// Reads the AOT artifact for this node when the node has an `aot` section.
+fn load_aot_artifact(
+    kafu_config: &KafuConfig,
+    node_id: &str,
+) -> Result<Option<Vec<u8>>, KafuError> {
+    let Some(path) = kafu_config.get_aot_artifact_path(node_id) else {
+        return Ok(None);
+    };
+    tracing::info!("{}: Loading AOT artifact {}", node_id, path.display());
+    let artifact = std::fs::read(&path).map_err(|e| {
+        KafuError::WasmInstantiationError(anyhow::anyhow!(
+            "Failed to read AOT artifact {} (run `kafu compile` first): {e}",
+            path.display()
+        ))
+    })?;
+    Ok(Some(artifact))
+}
+
+async fn build_wasm_module(
+    wasm_binary: Vec<u8>,
+    aot_artifact: Option<Vec<u8>>,
+) -> Result<Arc<WasmModule>, KafuError> {
+    let wasm = match aot_artifact {
+        Some(artifact) => WasmModule::new_with_aot_artifact(wasm_binary, &artifact).await,
+        None => WasmModule::new(wasm_binary).await,
+    }
+    .map_err(KafuError::WasmInstantiationError)?;
     Ok(Arc::new(wasm))
 }
 
-async fn create_runtime_instance(
+fn create_runtime_pre(
     wasm_module: Arc<WasmModule>,
     runtime_config: Arc<KafuRuntimeConfig>,
+) -> Result<Arc<KafuRuntimePre>, KafuError> {
+    let runtime_pre = KafuRuntimePre::new(wasm_module, &runtime_config)
+        .map_err(|e| KafuError::WasmInstantiationError(anyhow::anyhow!("{e}")))?;
+    Ok(Arc::new(runtime_pre))
+}
+
+async fn create_runtime_instance(
+    runtime_pre: &KafuRuntimePre,
 ) -> Result<Arc<tokio::sync::Mutex<KafuRuntimeInstance>>, KafuError> {
-    let instance = KafuRuntimeInstance::new(wasm_module, &runtime_config)
+    let instance = runtime_pre
+        .instantiate()
         .await
         .map_err(|e| KafuError::WasmInstantiationError(anyhow::anyhow!("{e}")))?;
     Ok(Arc::new(tokio::sync::Mutex::new(instance)))
@@ -175,6 +215,8 @@ struct LeaderTasksArgs {
     snapshot_cache: crate::service::SnapshotCache,
     snapshot_buffers: Arc<Mutex<(Vec<u8>, Vec<u8>)>>,
     wasm_sha256: [u8; 32],
+    runtime_pre: Arc<KafuRuntimePre>,
+    node_loads: Arc<tasks::NodeLoads>,
 }
 
 async fn start_leader_tasks(args: LeaderTasksArgs) {
@@ -187,6 +229,8 @@ async fn start_leader_tasks(args: LeaderTasksArgs) {
         snapshot_cache,
         snapshot_buffers,
         wasm_sha256,
+        runtime_pre,
+        node_loads,
     } = args;
     let followers_expect_push_heartbeat = matches!(
         kafu_config.cluster.heartbeat.follower_on_coordinator_lost,
@@ -201,6 +245,8 @@ async fn start_leader_tasks(args: LeaderTasksArgs) {
             Arc::clone(&kafu_config),
             shutdown_tx.clone(),
             Arc::clone(&execution_started),
+            runtime_pre,
+            node_loads,
         ));
     }
 
@@ -271,7 +317,8 @@ pub async fn run() -> Result<(), Box<dyn std::error::Error>> {
     let runtime_config = make_runtime_config(&cli.node_id, &kafu_config);
     let wasm_binary = load_wasm_binary(&kafu_config).await?;
     let wasm_sha256: [u8; 32] = Sha256::digest(&wasm_binary).into();
-    let wasm_module = build_wasm_module(wasm_binary).await?;
+    let aot_artifact = load_aot_artifact(&kafu_config, &cli.node_id)?;
+    let wasm_module = build_wasm_module(wasm_binary, aot_artifact).await?;
 
     let node_id = &cli.node_id;
     let node_config = resolve_node_config(&kafu_config, node_id)?;
@@ -283,7 +330,27 @@ pub async fn run() -> Result<(), Box<dyn std::error::Error>> {
     tracing::info!("{}: Server is listening on {}:", node_id, bind_address);
 
     // Create runtime for all nodes (leader runs start(); followers receive restore() on migrate).
-    let runtime = create_runtime_instance(Arc::clone(&wasm_module), runtime_config).await?;
+    let runtime_pre = create_runtime_pre(Arc::clone(&wasm_module), runtime_config)?;
+    let node_loads = Arc::new(tasks::NodeLoads::default());
+    runtime_pre
+        .set_cluster(Arc::new(tasks::GrpcCluster::new(
+            node_id,
+            Arc::clone(&kafu_config),
+            wasm_sha256,
+            LocalCluster::new(&runtime_pre),
+            Arc::clone(&node_loads),
+        )))
+        .map_err(KafuError::WasmInstantiationError)?;
+    let runtime = create_runtime_instance(&runtime_pre).await?;
+    // Actors belong to the program run: drop the ones the program left once the node shuts down.
+    {
+        let runtime_pre = Arc::clone(&runtime_pre);
+        let mut shutdown_rx = shutdown_tx.subscribe();
+        tokio::spawn(async move {
+            let _ = shutdown_rx.recv().await;
+            runtime_pre.drop_actors().await;
+        });
+    }
     let (health_reporter, health_service) = init_health_services().await;
 
     let snapshot_buffers = Arc::new(Mutex::new((Vec::new(), Vec::new())));
@@ -291,10 +358,12 @@ pub async fn run() -> Result<(), Box<dyn std::error::Error>> {
         node_id,
         Arc::clone(&kafu_config),
         Arc::clone(&runtime),
+        Arc::clone(&runtime_pre),
         shutdown_tx.clone(),
         leader_heartbeat_tx,
         snapshot_buffers.clone(),
         wasm_sha256,
+        Arc::clone(&node_loads),
     );
     let snapshot_cache = Arc::clone(&kafu_service.snapshot_cache);
 
@@ -325,6 +394,8 @@ pub async fn run() -> Result<(), Box<dyn std::error::Error>> {
             snapshot_cache: Arc::clone(&snapshot_cache),
             snapshot_buffers: Arc::clone(&snapshot_buffers),
             wasm_sha256,
+            runtime_pre,
+            node_loads,
         })
         .await;
     }
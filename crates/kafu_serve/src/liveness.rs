@@ -8,6 +8,7 @@ use std::{
 };
 
 use kafu_config::KafuConfig;
+use kafu_runtime::engine::KafuRuntimePre;
 use tokio::{
     sync::{broadcast, watch},
     task::JoinSet,
@@ -15,13 +16,14 @@ use tokio::{
 };
 use tonic::transport::Endpoint;
 
-use crate::grpc::kafu_proto::HeartbeatRequest;
+use crate::grpc::kafu_proto::{HeartbeatRequest, HeartbeatResponse};
 use crate::{
     cluster::request_cluster_shutdown_and_exit,
     constants::LEADER_EXECUTION_HEALTH_SERVICE,
     error::{KafuError, KafuResult},
     grpc,
     service::LeaderHeartbeatState,
+    tasks::NodeLoads,
 };
 
 pub async fn wait_for_other_nodes_healthy(
@@ -437,11 +439,15 @@ pub async fn run_coordinator_loss_monitor(
 }
 
 // On the leader, periodically send heartbeat RPCs to all peers (best-effort; failures are logged).
+// Heartbeats also carry node loads: each peer reports its own in the response, and the leader
+// passes the whole table on with the next heartbeat.
 pub async fn run_leader_heartbeat_sender(
     leader_id: String,
     kafu_config: Arc<KafuConfig>,
     shutdown_tx: broadcast::Sender<()>,
     execution_started: Arc<AtomicBool>,
+    runtime_pre: Arc<KafuRuntimePre>,
+    node_loads: Arc<NodeLoads>,
 ) {
     let heartbeat_interval = Duration::from_millis(kafu_config.cluster.heartbeat.interval_ms);
     const RPC_TIMEOUT: Duration = Duration::from_secs(2);
@@ -459,7 +465,13 @@ pub async fn run_leader_heartbeat_sender(
             _ = ticker.tick() => {}
         }
 
-        let mut join_set: JoinSet<(String, String, Result<(), KafuError>)> = JoinSet::new();
+        let mut join_set: JoinSet<(
+            String,
+            String,
+            Result<HeartbeatResponse, KafuError>,
+            Duration,
+        )> = JoinSet::new();
+        let loads = node_loads.reports(&leader_id, runtime_pre.load());
 
         for (peer_id, node_config) in kafu_config.nodes.iter() {
             if *peer_id == leader_id {
@@ -469,17 +481,20 @@ pub async fn run_leader_heartbeat_sender(
             let endpoint_str = format!("http://{}:{}", node_config.address, node_config.port);
             let leader_id_ = leader_id.clone();
             let execution_started = execution_started.load(Ordering::Relaxed);
+            let loads = loads.clone();
 
             join_set.spawn(async move {
                 let req = HeartbeatRequest {
                     from_node_id: leader_id_.clone(),
                     execution_started,
+                    loads,
                 };
 
+                let sent_at = tokio::time::Instant::now();
                 let res = match Endpoint::from_shared(endpoint_str.clone()) {
                     Ok(ep) => {
                         let ep = ep.connect_timeout(RPC_TIMEOUT).timeout(RPC_TIMEOUT);
-                        grpc::client::send_heartbeat(req, ep).await.map(|_r| ())
+                        grpc::client::send_heartbeat(req, ep).await
                     }
                     Err(e) => Err(KafuError::HealthCheckFailed {
                         node_id: peer_id.clone(),
@@ -488,14 +503,20 @@ pub async fn run_leader_heartbeat_sender(
                     }),
                 };
 
-                (peer_id, endpoint_str, res)
+                (peer_id, endpoint_str, res, sent_at.elapsed())
             });
         }
 
         while let Some(r) = join_set.join_next().await {
             match r {
-                Ok((_peer_id, _endpoint_str, Ok(()))) => {}
-                Ok((peer_id, endpoint_str, Err(e))) => {
+                Ok((peer_id, _endpoint_str, Ok(response), latency)) => {
+                    if let Some(load) = &response.load {
+                        node_loads.update(&leader_id, load);
+                    }
+                    node_loads.set_latency(&peer_id, latency);
+                }
+                Ok((peer_id, endpoint_str, Err(e), _latency)) => {
+                    node_loads.set_unreachable(&peer_id);
                     tracing::debug!(
                         "{}: Heartbeat to {} ({}) failed: {}",
                         leader_id,
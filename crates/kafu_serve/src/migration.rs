@@ -9,7 +9,7 @@ use tonic::transport::Endpoint;
 use crate::{
     error::{KafuError, KafuResult},
     grpc,
-    grpc::kafu_proto::{MemoryDeltaPage, MigrateRequest, MigrationStackEntry},
+    grpc::kafu_proto::{MemoryDeltaPage, MemoryRange, MigrateRequest, MigrationStackEntry},
     service::SnapshotCache,
 };
 
@@ -60,6 +60,7 @@ struct PrepareMigrationRequestArgs<'a> {
     endpoint: Endpoint,
     kafu_config: &'a KafuConfig,
     migration_stack: &'a [MigrationStackEntry],
+    scratch_ranges: &'a [MemoryRange],
     main_buf: &'a mut Vec<u8>,
     snapify_buf: &'a mut Vec<u8>,
     wasm_sha256: &'a [u8],
@@ -200,11 +201,13 @@ fn log_payload(
     );
 }
 
+#[allow(clippy::too_many_arguments)]
 async fn prepare_full_snapshot_request(
     instance: &mut KafuRuntimeInstance,
     node_id: &str,
     kafu_config: &KafuConfig,
     migration_stack: &[MigrationStackEntry],
+    scratch_ranges: &[MemoryRange],
     main_buf: &mut Vec<u8>,
     snapify_buf: &mut Vec<u8>,
     wasm_sha256: &[u8],
@@ -234,6 +237,12 @@ async fn prepare_full_snapshot_request(
         // Requires clone to keep baseline for reverse migration.
         (main_memory.clone(), false, main_memory)
     };
+    // Asyncify only uses the beginning of snapify_memory; the zero-filled rest compresses away.
+    let (snapshot_snapify_memory, snapshot_snapify_memory_compressed) = if use_compression {
+        compress_if_smaller(snapify_memory.as_slice())
+    } else {
+        (snapify_memory.clone(), false)
+    };
 
     tracing::debug!(
         "{}: Snapshot sizes - main: {} bytes ({} KB), snapify: {} bytes ({} KB), total: {} bytes ({} KB)",
@@ -242,13 +251,14 @@ async fn prepare_full_snapshot_request(
         main_memory_size / 1024,
         snapify_memory_size,
         snapify_memory_size / 1024,
-        snapshot_main_memory.len() + snapify_memory_size,
-        (snapshot_main_memory.len() + snapify_memory_size) / 1024
+        snapshot_main_memory.len() + snapshot_snapify_memory.len(),
+        (snapshot_main_memory.len() + snapshot_snapify_memory.len()) / 1024
     );
 
     let req = MigrateRequest {
         wasm_sha256: wasm_sha256.to_vec(),
         migration_stack: migration_stack.to_vec(),
+        scratch_ranges: scratch_ranges.to_vec(),
         main_memory: Some(crate::grpc::kafu_proto::MemoryImage {
             data: snapshot_main_memory,
             compressed: snapshot_main_memory_compressed,
@@ -256,8 +266,8 @@ async fn prepare_full_snapshot_request(
             delta_pages: vec![],
         }),
         snapify_memory: Some(crate::grpc::kafu_proto::MemoryImage {
-            data: snapify_memory.clone(),
-            compressed: false,
+            data: snapshot_snapify_memory,
+            compressed: snapshot_snapify_memory_compressed,
             pages: (snapify_memory_size / WASM_PAGE_SIZE) as u64,
             delta_pages: vec![],
         }),
@@ -306,6 +316,7 @@ async fn prepare_migration_request(
                 args.node_id,
                 args.kafu_config,
                 args.migration_stack,
+                args.scratch_ranges,
                 args.main_buf,
                 args.snapify_buf,
                 args.wasm_sha256,
@@ -352,6 +363,7 @@ async fn prepare_migration_request(
             let req = MigrateRequest {
                 wasm_sha256: args.wasm_sha256.to_vec(),
                 migration_stack: args.migration_stack.to_vec(),
+                scratch_ranges: args.scratch_ranges.to_vec(),
                 main_memory: Some(crate::grpc::kafu_proto::MemoryImage {
                     data: vec![],
                     compressed: false,
@@ -385,6 +397,7 @@ async fn prepare_migration_request(
         args.node_id,
         args.kafu_config,
         args.migration_stack,
+        args.scratch_ranges,
         args.main_buf,
         args.snapify_buf,
         args.wasm_sha256,
@@ -437,6 +450,16 @@ pub async fn send_migration_request(
             wasm_stack_height: entry.wasm_stack_height,
         })
         .collect::<Vec<_>>();
+    let scratch_ranges = instance
+        .get_store()
+        .data()
+        .get_scratch_ranges()
+        .iter()
+        .map(|range| MemoryRange {
+            offset: range.start as u64,
+            len: range.len() as u64,
+        })
+        .collect::<Vec<_>>();
 
     let res = {
         let mut attempt: usize = 1;
@@ -469,6 +492,7 @@ pub async fn send_migration_request(
                     endpoint: endpoint.clone(),
                     kafu_config,
                     migration_stack: &migration_stack,
+                    scratch_ranges: &scratch_ranges,
                     main_buf,
                     snapify_buf,
                     wasm_sha256,
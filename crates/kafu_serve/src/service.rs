@@ -1,18 +1,24 @@
 use std::sync::Arc;
 
 use kafu_config::KafuConfig;
-use kafu_runtime::engine::{KafuRuntimeInstance, apply_memory_delta_into_sized};
+use kafu_runtime::engine::{
+    KafuRuntimeInstance, KafuRuntimePre, Received, Task, TaskInput, apply_memory_delta_into_sized,
+};
 use lz4_flex::block::decompress_size_prepended;
 use tokio::sync::{Mutex, broadcast, watch};
-use tonic::{Request, Response, Status};
+use tonic::{Request, Response, Status, Streaming};
 
 use crate::{
     grpc::kafu_proto::{
-        CheckSnapshotCacheRequest, CheckSnapshotCacheResponse, HeartbeatRequest, HeartbeatResponse,
-        MemoryImage, MigrateRequest, MigrateResponse, ShutdownRequest, ShutdownResponse,
-        command_server::Command,
+        ChannelMessage, CheckSnapshotCacheRequest, CheckSnapshotCacheResponse, CreateActorRequest,
+        CreateActorResponse, DestroyActorRequest, DestroyActorResponse, GetBlobRequest,
+        GetBlobResponse, HeartbeatRequest, HeartbeatResponse, MemoryImage, MigrateRequest,
+        MigrateResponse, OpenChannelRequest, OpenChannelResponse, RecvChannelRequest,
+        RecvChannelResponse, RunTaskRequest, RunTaskResponse, SendChannelResponse, ShutdownRequest,
+        ShutdownResponse, command_server::Command,
     },
     runtime::{self, SnapshotBuffers},
+    tasks::{NodeLoads, node_load_report},
 };
 
 #[derive(Clone, Debug)]
@@ -46,6 +52,8 @@ pub struct KafuService {
     pub kafu_config: Arc<KafuConfig>,
     /// Single runtime instance per server process.
     pub runtime: Arc<Mutex<KafuRuntimeInstance>>,
+    /// Pre-linked module used to create a fresh instance for each incoming migration.
+    pub runtime_pre: Arc<KafuRuntimePre>,
     pub shutdown_tx: broadcast::Sender<()>,
     pub leader_heartbeat_tx: watch::Sender<LeaderHeartbeatState>,
     /// Cache of received main memory snapshots by SHA-256 hash; enables delta-based migration.
@@ -58,22 +66,28 @@ pub struct KafuService {
     pub reconstruct_snapify_buf: Mutex<Vec<u8>>,
     /// SHA-256 digest (32 bytes) of the loaded Wasm binary, used to verify migration requests.
     pub wasm_sha256: [u8; 32],
+    /// Load of the other nodes, updated from the leader's heartbeats.
+    pub node_loads: Arc<NodeLoads>,
 }
 
 impl KafuService {
+    #[allow(clippy::too_many_arguments)]
     pub fn new(
         node_id: &str,
         kafu_config: Arc<KafuConfig>,
         runtime: Arc<Mutex<KafuRuntimeInstance>>,
+        runtime_pre: Arc<KafuRuntimePre>,
         shutdown_tx: broadcast::Sender<()>,
         leader_heartbeat_tx: watch::Sender<LeaderHeartbeatState>,
         snapshot_buffers: SnapshotBuffers,
         wasm_sha256: [u8; 32],
+        node_loads: Arc<NodeLoads>,
     ) -> Self {
         Self {
             node_id: node_id.to_string(),
             kafu_config,
             runtime,
+            runtime_pre,
             shutdown_tx,
             leader_heartbeat_tx,
             snapshot_cache: Arc::new(Mutex::new(None)),
@@ -81,10 +95,38 @@ impl KafuService {
             reconstruct_buf: Mutex::new(Vec::new()),
             reconstruct_snapify_buf: Mutex::new(Vec::new()),
             wasm_sha256,
+            node_loads,
         }
     }
 }
 
+/// Decodes a full memory image (no delta pages) into a buffer of `pages` Wasm pages.
+fn decode_full_memory_image(label: &str, img: &MemoryImage) -> Result<Vec<u8>, Status> {
+    if img.pages == 0 || !img.delta_pages.is_empty() {
+        return Err(Status::invalid_argument(format!(
+            "{label} memory must be a full image with non-zero pages"
+        )));
+    }
+    let target_len = (img.pages as usize)
+        .checked_mul(65536)
+        .ok_or_else(|| Status::invalid_argument("Requested memory pages overflow"))?;
+    let mut data = if img.compressed {
+        decompress_size_prepended(&img.data)
+            .map_err(|e| Status::invalid_argument(format!("{label} memory decompress: {}", e)))?
+    } else {
+        img.data.clone()
+    };
+    if data.len() > target_len {
+        return Err(Status::invalid_argument(format!(
+            "{label} memory size {} exceeds requested {}",
+            data.len(),
+            target_len
+        )));
+    }
+    data.resize(target_len, 0);
+    Ok(data)
+}
+
 #[tonic::async_trait]
 impl Command for KafuService {
     async fn heartbeat(
@@ -101,8 +143,14 @@ impl Command for KafuService {
             execution_started: request.execution_started,
         };
         let _ = self.leader_heartbeat_tx.send_replace(state);
+        for report in &request.loads {
+            self.node_loads.update(&self.node_id, report);
+        }
 
-        Ok(Response::new(HeartbeatResponse { accepted: true }))
+        Ok(Response::new(HeartbeatResponse {
+            accepted: true,
+            load: Some(node_load_report(&self.node_id, &self.runtime_pre.load())),
+        }))
     }
 
     async fn shutdown(
@@ -135,6 +183,178 @@ impl Command for KafuService {
         Ok(Response::new(CheckSnapshotCacheResponse { has_cache }))
     }
 
+    async fn run_task(
+        &self,
+        request: Request<RunTaskRequest>,
+    ) -> Result<Response<RunTaskResponse>, Status> {
+        let request = request.into_inner();
+        if request.wasm_sha256.as_slice() != self.wasm_sha256 {
+            return Err(Status::failed_precondition(
+                "Wasm SHA-256 mismatch between task sender and receiver",
+            ));
+        }
+        let input = match (&request.main_memory, &request.snapify_memory) {
+            (Some(main_img), Some(snapify_img)) => {
+                tracing::debug!(
+                    "{}: Received task from {} (function={} main: pages={} data={}B)",
+                    self.node_id,
+                    request.from_node_id,
+                    request.function,
+                    main_img.pages,
+                    main_img.data.len()
+                );
+                TaskInput::Snapshot {
+                    main_memory: decode_full_memory_image("main", main_img)?,
+                    snapify_memory: decode_full_memory_image("snapify", snapify_img)?,
+                    in_ptr: request.in_ptr,
+                    in_len: request.in_len,
+                    out_ptr: request.out_ptr,
+                }
+            }
+            (None, None) => {
+                tracing::debug!(
+                    "{}: Received task from {} (function={} input={}B)",
+                    self.node_id,
+                    request.from_node_id,
+                    request.function,
+                    request.input.len()
+                );
+                TaskInput::Arguments {
+                    input: request.input,
+                }
+            }
+            _ => {
+                return Err(Status::invalid_argument(
+                    "main_memory and snapify_memory must be sent together",
+                ));
+            }
+        };
+        let task = Task {
+            function: request.function,
+            input,
+            out_len: request.out_len,
+            actor: (request.actor_id != 0).then_some(request.actor_id),
+        };
+        let output = self
+            .runtime_pre
+            .run_task(&self.node_id, task)
+            .await
+            .map_err(|e| Status::internal(format!("Task failed: {e:#}")))?;
+        Ok(Response::new(RunTaskResponse { output }))
+    }
+
+    async fn create_actor(
+        &self,
+        request: Request<CreateActorRequest>,
+    ) -> Result<Response<CreateActorResponse>, Status> {
+        let request = request.into_inner();
+        if request.wasm_sha256.as_slice() != self.wasm_sha256 {
+            return Err(Status::failed_precondition(
+                "Wasm SHA-256 mismatch between actor creator and host",
+            ));
+        }
+        let actor_id = self
+            .runtime_pre
+            .create_actor(&self.node_id)
+            .await
+            .map_err(|e| Status::resource_exhausted(format!("Failed to create actor: {e:#}")))?;
+        tracing::debug!(
+            "{}: Created actor {} for {}",
+            self.node_id,
+            actor_id,
+            request.from_node_id
+        );
+        Ok(Response::new(CreateActorResponse { actor_id }))
+    }
+
+    async fn destroy_actor(
+        &self,
+        request: Request<DestroyActorRequest>,
+    ) -> Result<Response<DestroyActorResponse>, Status> {
+        let request = request.into_inner();
+        self.runtime_pre
+            .destroy_actor(request.actor_id)
+            .await
+            .map_err(|e| Status::not_found(format!("{e:#}")))?;
+        Ok(Response::new(DestroyActorResponse {}))
+    }
+
+    async fn open_channel(
+        &self,
+        request: Request<OpenChannelRequest>,
+    ) -> Result<Response<OpenChannelResponse>, Status> {
+        let request = request.into_inner();
+        self.runtime_pre
+            .channels()
+            .open(&request.name, request.capacity);
+        Ok(Response::new(OpenChannelResponse {}))
+    }
+
+    async fn send_channel(
+        &self,
+        request: Request<Streaming<ChannelMessage>>,
+    ) -> Result<Response<SendChannelResponse>, Status> {
+        let mut messages = request.into_inner();
+        let channels = self.runtime_pre.channels();
+        while let Some(message) = messages.message().await? {
+            if message.close {
+                channels.close(&message.name);
+                continue;
+            }
+            channels
+                .send(&message.name, message.data)
+                .await
+                .map_err(|e| Status::failed_precondition(format!("{e:#}")))?;
+        }
+        Ok(Response::new(SendChannelResponse {}))
+    }
+
+    async fn recv_channel(
+        &self,
+        request: Request<RecvChannelRequest>,
+    ) -> Result<Response<RecvChannelResponse>, Status> {
+        let request = request.into_inner();
+        let response = match self
+            .runtime_pre
+            .channels()
+            .recv(&request.name, request.max_len)
+            .await
+        {
+            Received::Message(data) => RecvChannelResponse {
+                data,
+                ..Default::default()
+            },
+            Received::TooLong(len) => RecvChannelResponse {
+                too_long: len,
+                ..Default::default()
+            },
+            Received::Closed => RecvChannelResponse {
+                closed: true,
+                ..Default::default()
+            },
+        };
+        Ok(Response::new(response))
+    }
+
+    async fn get_blob(
+        &self,
+        request: Request<GetBlobRequest>,
+    ) -> Result<Response<GetBlobResponse>, Status> {
+        let request = request.into_inner();
+        let digest = request
+            .digest
+            .try_into()
+            .map_err(|_| Status::invalid_argument("blob digest must be 32 bytes"))?;
+        let response = match self.runtime_pre.blobs().get(&digest) {
+            Some(blob) => GetBlobResponse {
+                found: true,
+                data: blob.to_vec(),
+            },
+            None => GetBlobResponse::default(),
+        };
+        Ok(Response::new(response))
+    }
+
     async fn migrate(
         &self,
         request: Request<MigrateRequest>,
@@ -146,6 +366,7 @@ impl Command for KafuService {
         let node_id_for_error = node_id.clone();
         let shutdown_tx = self.shutdown_tx.clone();
         let runtime = Arc::clone(&self.runtime);
+        let runtime_pre = Arc::clone(&self.runtime_pre);
         let snapshot_cache = Arc::clone(&self.snapshot_cache);
         let snapshot_buffers = self.snapshot_buffers.clone();
         let main_img: MemoryImage = request
@@ -206,6 +427,17 @@ impl Command for KafuService {
                 wasm_stack_height: entry.wasm_stack_height,
             })
             .collect();
+        let mut scratch_ranges = kafu_runtime::engine::ScratchRanges::default();
+        for range in &request.scratch_ranges {
+            let end = range.offset.saturating_add(range.len);
+            if end > requested_main_len as u64 {
+                return Err(Status::invalid_argument(format!(
+                    "Scratch range {}..{} exceeds main memory size {}",
+                    range.offset, end, requested_main_len
+                )));
+            }
+            scratch_ranges.mark(range.offset as usize..end as usize);
+        }
 
         let (mut main_memory, mut snapify_memory) = {
             if uses_delta {
@@ -389,6 +621,15 @@ impl Command for KafuService {
         let handle = tokio::spawn(async move {
             {
                 let mut instance = runtime.lock().await;
+                // Restore into a fresh instance so no state (e.g. grown memories) leaks from a
+                // previous execution on this node; the old slot is returned to the pool.
+                match runtime_pre.instantiate().await {
+                    Ok(fresh) => *instance = fresh,
+                    Err(e) => {
+                        tracing::error!("{}: Failed to instantiate for restore: {:?}", node_id, e);
+                        return;
+                    }
+                }
                 if let Err(e) = instance
                     .restore(migration_stack, main_memory, snapify_memory)
                     .await
@@ -396,6 +637,7 @@ impl Command for KafuService {
                     tracing::error!("{}: Failed to restore snapshot: {:?}", node_id, e);
                     return;
                 }
+                instance.set_scratch_ranges(scratch_ranges);
                 if let Err(e) = instance.resume().await {
                     tracing::error!("{}: Failed to resume after restore: {:?}", node_id, e);
                     return;
@@ -0,0 +1,434 @@
+use std::collections::HashMap;
+use std::sync::{Arc, Mutex};
+use std::time::Duration;
+
+use anyhow::Context as _;
+use kafu_config::KafuConfig;
+use kafu_runtime::engine::{
+    BlobDigest, ClusterBackend, ClusterFuture, LocalCluster, NodeLoad, Received, Task, TaskFuture,
+    TaskInput, select_node,
+};
+use lz4_flex::block::compress_prepend_size;
+use tokio::{sync::mpsc, task::JoinHandle};
+use tokio_stream::wrappers::ReceiverStream;
+use tonic::transport::Endpoint;
+
+use crate::{
+    grpc,
+    grpc::kafu_proto::{
+        ChannelMessage, CreateActorRequest, DestroyActorRequest, GetBlobRequest, MemoryImage,
+        NodeLoadReport, OpenChannelRequest, RecvChannelRequest, RunTaskRequest,
+    },
+};
+
+const WASM_PAGE_SIZE: usize = 65536;
+
+/// Messages buffered on the sending node for each outgoing channel stream.
+const CHANNEL_SEND_BUFFER: usize = 4;
+
+/// Latest load of the other nodes, gathered through heartbeats: the leader collects it from the
+/// responses and passes the whole table on to every follower.
+#[derive(Default)]
+pub struct NodeLoads {
+    loads: Mutex<HashMap<String, NodeLoad>>,
+}
+
+impl NodeLoads {
+    pub fn get(&self, node_id: &str) -> Option<NodeLoad> {
+        self.loads.lock().unwrap().get(node_id).copied()
+    }
+
+    /// Records a report, unless it is about `own_node_id`, whose load is known first-hand.
+    pub fn update(&self, own_node_id: &str, report: &NodeLoadReport) {
+        if report.node_id == own_node_id {
+            return;
+        }
+        let load = NodeLoad {
+            running_tasks: report.running_tasks,
+            queued_tasks: report.queued_tasks,
+            latency: (report.latency_us != 0).then(|| Duration::from_micros(report.latency_us)),
+            unreachable: report.unreachable,
+        };
+        self.loads
+            .lock()
+            .unwrap()
+            .insert(report.node_id.clone(), load);
+    }
+
+    /// Records a heartbeat to `node_id` that succeeded: sets its latency, keeping its last
+    /// reported tasks, and marks it reachable.
+    pub fn set_latency(&self, node_id: &str, latency: Duration) {
+        let mut loads = self.loads.lock().unwrap();
+        let load = loads.entry(node_id.to_string()).or_default();
+        load.latency = Some(latency);
+        load.unreachable = false;
+    }
+
+    /// Records a heartbeat to `node_id` that failed. The node is not picked for placement groups
+    /// until a heartbeat succeeds again.
+    pub fn set_unreachable(&self, node_id: &str) {
+        self.loads
+            .lock()
+            .unwrap()
+            .entry(node_id.to_string())
+            .or_default()
+            .unreachable = true;
+    }
+
+    /// Returns the reports of every node, with `own_load` for `own_node_id`.
+    pub fn reports(&self, own_node_id: &str, own_load: NodeLoad) -> Vec<NodeLoadReport> {
+        let loads = self.loads.lock().unwrap();
+        std::iter::once((own_node_id, &own_load))
+            .chain(loads.iter().map(|(node_id, load)| (node_id.as_str(), load)))
+            .map(|(node_id, load)| node_load_report(node_id, load))
+            .collect()
+    }
+}
+
+pub fn node_load_report(node_id: &str, load: &NodeLoad) -> NodeLoadReport {
+    NodeLoadReport {
+        node_id: node_id.to_string(),
+        running_tasks: load.running_tasks,
+        queued_tasks: load.queued_tasks,
+        latency_us: load.latency.map_or(0, |latency| latency.as_micros() as u64),
+        unreachable: load.unreachable,
+    }
+}
+
+/// Runs tasks and actors spawned on this node: on the node itself through `local`, and on other
+/// nodes through the `RunTask`, `CreateActor` and `DestroyActor` RPCs.
+///
+/// Messages to a channel on another node go through one `SendChannel` stream per channel, so
+/// that sends are pipelined instead of waiting for a round trip each.
+///
+/// `KAFU_DEST` destinations that name several nodes go to the least loaded one in `node_loads`.
+///
+/// Blobs missing on this node are fetched from the other nodes, in turn, through `GetBlob`.
+pub struct GrpcCluster {
+    node_id: String,
+    kafu_config: Arc<KafuConfig>,
+    wasm_sha256: [u8; 32],
+    local: LocalCluster,
+    node_loads: Arc<NodeLoads>,
+    /// Outgoing channel streams, by home node and channel name.
+    channel_streams: Mutex<HashMap<(String, String), ChannelStream>>,
+    /// Connections for `RecvChannel`, by home node, reused from receive to receive.
+    recv_connections: Arc<Mutex<HashMap<String, tonic::transport::Channel>>>,
+}
+
+struct ChannelStream {
+    sender: mpsc::Sender<ChannelMessage>,
+    task: StreamTask,
+}
+
+type StreamTask = JoinHandle<anyhow::Result<()>>;
+
+impl GrpcCluster {
+    pub fn new(
+        node_id: &str,
+        kafu_config: Arc<KafuConfig>,
+        wasm_sha256: [u8; 32],
+        local: LocalCluster,
+        node_loads: Arc<NodeLoads>,
+    ) -> Self {
+        Self {
+            node_id: node_id.to_string(),
+            kafu_config,
+            wasm_sha256,
+            local,
+            node_loads,
+            channel_streams: Mutex::new(HashMap::new()),
+            recv_connections: Arc::default(),
+        }
+    }
+
+    fn endpoint(&self, node_id: &str) -> anyhow::Result<Endpoint> {
+        let node_config = self
+            .kafu_config
+            .nodes
+            .get(node_id)
+            .ok_or_else(|| anyhow::anyhow!("unknown node `{node_id}`"))?;
+        Ok(Endpoint::from_shared(format!(
+            "http://{}:{}",
+            node_config.address, node_config.port
+        ))?)
+    }
+
+    /// Returns the sender of the stream to channel `name` on `home`, opening the stream if needed.
+    ///
+    /// If the previous stream has ended, a new one is opened and the task of the old one is
+    /// returned too, so that the caller reports a failure through [`stream_ended`]: messages
+    /// buffered for a failed stream are lost, and the guest must learn about it.
+    fn channel_sender(
+        &self,
+        home: &str,
+        name: &str,
+    ) -> anyhow::Result<(mpsc::Sender<ChannelMessage>, Option<StreamTask>)> {
+        let mut streams = self.channel_streams.lock().unwrap();
+        let key = (home.to_string(), name.to_string());
+        let ended = match streams.remove(&key) {
+            Some(stream) if !stream.task.is_finished() => {
+                let sender = stream.sender.clone();
+                streams.insert(key, stream);
+                return Ok((sender, None));
+            }
+            stream => stream.map(|stream| stream.task),
+        };
+        let endpoint = self.endpoint(home)?;
+        let (sender, receiver) = mpsc::channel(CHANNEL_SEND_BUFFER);
+        let task = tokio::spawn(async move {
+            grpc::client::send_channel(ReceiverStream::new(receiver), endpoint).await?;
+            Ok(())
+        });
+        streams.insert(
+            key,
+            ChannelStream {
+                sender: sender.clone(),
+                task,
+            },
+        );
+        Ok((sender, ended))
+    }
+}
+
+/// Returns the error of an ended channel stream, if it failed.
+async fn stream_ended(home: &str, task: Option<StreamTask>) -> anyhow::Result<()> {
+    let Some(task) = task else {
+        return Ok(());
+    };
+    task.await?.with_context(|| {
+        format!("channel stream to `{home}` failed; messages sent before this one may be lost")
+    })
+}
+
+fn memory_image(data: Vec<u8>, use_compression: bool) -> MemoryImage {
+    let pages = (data.len() / WASM_PAGE_SIZE) as u64;
+    let compressed = use_compression.then(|| compress_prepend_size(&data));
+    match compressed {
+        Some(compressed) if compressed.len() < data.len() => MemoryImage {
+            data: compressed,
+            compressed: true,
+            pages,
+            delta_pages: vec![],
+        },
+        _ => MemoryImage {
+            data,
+            compressed: false,
+            pages,
+            delta_pages: vec![],
+        },
+    }
+}
+
+impl ClusterBackend for GrpcCluster {
+    fn run_task(&self, node_id: &str, task: Task) -> TaskFuture {
+        if node_id == self.node_id {
+            return self.local.run_task(node_id, task);
+        }
+        let endpoint = self.endpoint(node_id);
+        let use_compression = self.kafu_config.cluster.migration.memory_compression;
+        let from_node_id = self.node_id.clone();
+        let wasm_sha256 = self.wasm_sha256.to_vec();
+        Box::pin(async move {
+            let endpoint = endpoint?;
+            let mut request = RunTaskRequest {
+                wasm_sha256,
+                from_node_id,
+                function: task.function,
+                out_len: task.out_len,
+                actor_id: task.actor.unwrap_or(0),
+                ..Default::default()
+            };
+            match task.input {
+                TaskInput::Snapshot {
+                    main_memory,
+                    snapify_memory,
+                    in_ptr,
+                    in_len,
+                    out_ptr,
+                } => {
+                    request.main_memory = Some(memory_image(main_memory, use_compression));
+                    request.snapify_memory = Some(memory_image(snapify_memory, use_compression));
+                    request.in_ptr = in_ptr;
+                    request.in_len = in_len;
+                    request.out_ptr = out_ptr;
+                }
+                TaskInput::Arguments { input } => {
+                    request.in_len = input.len() as u32;
+                    request.input = input;
+                }
+            }
+            let response = grpc::client::run_task(request, endpoint).await?;
+            Ok(response.output)
+        })
+    }
+
+    fn create_actor(&self, node_id: &str) -> ClusterFuture<u64> {
+        if node_id == self.node_id {
+            return self.local.create_actor(node_id);
+        }
+        let endpoint = self.endpoint(node_id);
+        let request = CreateActorRequest {
+            wasm_sha256: self.wasm_sha256.to_vec(),
+            from_node_id: self.node_id.clone(),
+        };
+        Box::pin(async move {
+            let response = grpc::client::create_actor(request, endpoint?).await?;
+            Ok(response.actor_id)
+        })
+    }
+
+    fn destroy_actor(&self, node_id: &str, actor: u64) -> ClusterFuture<()> {
+        if node_id == self.node_id {
+            return self.local.destroy_actor(node_id, actor);
+        }
+        let endpoint = self.endpoint(node_id);
+        Box::pin(async move {
+            let request = DestroyActorRequest { actor_id: actor };
+            grpc::client::destroy_actor(request, endpoint?).await?;
+            Ok(())
+        })
+    }
+
+    fn group_nodes(&self, group: &str) -> Vec<String> {
+        self.kafu_config
+            .get_placement_group_nodes(group)
+            .into_iter()
+            .map(str::to_string)
+            .collect()
+    }
+
+    fn select_node(&self, dest: &str, current: &str) -> Option<String> {
+        let candidates = self.kafu_config.get_destination_nodes(dest);
+        let own_load = self.local.node_load();
+        select_node(&candidates, current, |node_id| {
+            if node_id == self.node_id {
+                Some(own_load)
+            } else {
+                self.node_loads.get(node_id)
+            }
+        })
+        .map(str::to_string)
+    }
+
+    fn channel_open(&self, home: &str, name: &str, capacity: u32) -> ClusterFuture<()> {
+        if home == self.node_id {
+            return self.local.channel_open(home, name, capacity);
+        }
+        let endpoint = self.endpoint(home);
+        let request = OpenChannelRequest {
+            name: name.to_string(),
+            capacity,
+        };
+        Box::pin(async move {
+            grpc::client::open_channel(request, endpoint?).await?;
+            Ok(())
+        })
+    }
+
+    fn channel_send(&self, home: &str, name: &str, message: Vec<u8>) -> ClusterFuture<()> {
+        if home == self.node_id {
+            return self.local.channel_send(home, name, message);
+        }
+        let sender = self.channel_sender(home, name);
+        let message = ChannelMessage {
+            name: name.to_string(),
+            data: message,
+            close: false,
+        };
+        let home = home.to_string();
+        Box::pin(async move {
+            let (sender, ended) = sender?;
+            stream_ended(&home, ended).await?;
+            // Resolves once the message is buffered; a full channel on `home` stops the stream,
+            // which fills the buffer and holds back this sender. If the stream fails, the next
+            // send reports it.
+            sender
+                .send(message)
+                .await
+                .map_err(|_| anyhow::anyhow!("channel stream to `{home}` was closed"))
+        })
+    }
+
+    fn channel_recv(&self, home: &str, name: &str, max_len: u32) -> ClusterFuture<Received> {
+        if home == self.node_id {
+            return self.local.channel_recv(home, name, max_len);
+        }
+        let endpoint = self.endpoint(home);
+        let connections = Arc::clone(&self.recv_connections);
+        let connection = connections.lock().unwrap().get(home).cloned();
+        let home = home.to_string();
+        let request = RecvChannelRequest {
+            name: name.to_string(),
+            max_len,
+        };
+        Box::pin(async move {
+            let connection = match connection {
+                Some(connection) => connection,
+                None => {
+                    let connection = grpc::client::recv_channel_connection(endpoint?).await?;
+                    connections.lock().unwrap().insert(home, connection.clone());
+                    connection
+                }
+            };
+            let response = grpc::client::recv_channel(request, connection).await?;
+            Ok(if response.closed {
+                Received::Closed
+            } else if response.too_long != 0 {
+                Received::TooLong(response.too_long)
+            } else {
+                Received::Message(response.data)
+            })
+        })
+    }
+
+    fn channel_close(&self, home: &str, name: &str) -> ClusterFuture<()> {
+        if home == self.node_id {
+            return self.local.channel_close(home, name);
+        }
+        // Close in-band, after the messages already sent, then wait for the stream to finish.
+        let key = (home.to_string(), name.to_string());
+        let stream = self
+            .channel_sender(home, name)
+            .map(|(_, ended)| (self.channel_streams.lock().unwrap().remove(&key), ended));
+        let message = ChannelMessage {
+            name: name.to_string(),
+            data: vec![],
+            close: true,
+        };
+        Box::pin(async move {
+            let (stream, ended) = stream?;
+            stream_ended(&key.0, ended).await?;
+            let ChannelStream { sender, task } = stream.context("channel stream vanished")?;
+            sender
+                .send(message)
+                .await
+                .map_err(|_| anyhow::anyhow!("channel stream to `{}` was closed", key.0))?;
+            drop(sender);
+            task.await?
+        })
+    }
+
+    fn fetch_blob(&self, digest: BlobDigest) -> ClusterFuture<Option<Vec<u8>>> {
+        let endpoints: Vec<_> = self
+            .kafu_config
+            .nodes
+            .keys()
+            .filter(|node_id| **node_id != self.node_id)
+            .map(|node_id| (node_id.clone(), self.endpoint(node_id)))
+            .collect();
+        Box::pin(async move {
+            for (node_id, endpoint) in endpoints {
+                let request = GetBlobRequest {
+                    digest: digest.to_vec(),
+                };
+                match grpc::client::get_blob(request, endpoint?).await {
+                    Ok(response) if response.found => return Ok(Some(response.data)),
+                    Ok(_) => {}
+                    Err(e) => tracing::warn!("failed to fetch blob from {node_id}: {e:#}"),
+                }
+            }
+            Ok(None)
+        })
+    }
+}
@@ -7,7 +7,7 @@ use std::{net::SocketAddr, sync::Arc, time::Duration};
 use anyhow::Context as _;
 use kafu_config::KafuConfig;
 use kafu_runtime::engine::{
-    KafuRuntimeConfig, KafuRuntimeInstance, LinkerConfig, WasiConfig, WasmModule,
+    KafuRuntimeConfig, KafuRuntimePre, LinkerConfig, WasiConfig, WasmModule,
 };
 use tokio::{sync::broadcast, task::JoinHandle};
 use tonic::transport::Server;
@@ -83,8 +83,19 @@ pub async fn start_test_grpc_server(
         node_id: node_id.to_string(),
         wasi_config: WasiConfig::create_from_kafu_config(&kafu_config),
         linker_config: LinkerConfig::default(),
+        engine_config: kafu_config
+            .nodes
+            .get(node_id)
+            .and_then(|node| node.engine.clone())
+            .unwrap_or_default(),
+        models: kafu_config.get_node_models(node_id),
     };
-    let instance = KafuRuntimeInstance::new(Arc::clone(&wasm_module), &runtime_config)
+    let runtime_pre = Arc::new(
+        KafuRuntimePre::new(Arc::clone(&wasm_module), &runtime_config)
+            .context("failed to link runtime module")?,
+    );
+    let instance = runtime_pre
+        .instantiate()
         .await
         .context("failed to create runtime instance")?;
     let runtime = Arc::new(tokio::sync::Mutex::new(instance));
@@ -94,10 +105,12 @@ pub async fn start_test_grpc_server(
         node_id,
         Arc::clone(&kafu_config),
         runtime,
+        runtime_pre,
         shutdown_tx.clone(),
         leader_heartbeat_tx,
         snapshot_buffers,
         wasm_sha256,
+        Arc::default(),
     );
 
     // Graceful shutdown is driven by a broadcast signal.
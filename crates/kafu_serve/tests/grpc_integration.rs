@@ -100,9 +100,16 @@ async fn heartbeat_updates_state_and_shutdown_stops_server() -> anyhow::Result<(
     let hb = HeartbeatRequest {
         from_node_id: "leader-1".to_string(),
         execution_started: true,
+        loads: vec![],
     };
     let resp = send_heartbeat(hb, endpoint.clone()).await?;
     assert!(resp.accepted);
+    // The response reports the node's own load; nothing runs on it yet.
+    let load = resp
+        .load
+        .expect("heartbeat response carries the node's load");
+    assert_eq!(load.running_tasks, 0);
+    assert_eq!(load.queued_tasks, 0);
 
     leader_hb_rx.changed().await?;
     let st = leader_hb_rx.borrow().clone();
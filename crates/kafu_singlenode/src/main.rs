@@ -2,10 +2,10 @@ use std::{path::PathBuf, sync::Arc};
 
 use anyhow::Result;
 use clap::{Parser, Subcommand};
-use kafu_config::{KafuConfig, WasmLocation};
+use kafu_config::{KafuConfig, ModelConfig, WasmLocation};
 
 use kafu_runtime::engine::{
-    KafuRuntimeConfig, KafuRuntimeInstance, LinkerConfig, LinkerSnapifyConfig, WasiConfig,
+    KafuRuntimeConfig, KafuRuntimePre, LinkerConfig, LinkerSnapifyConfig, LocalCluster, WasiConfig,
     WasmModule,
 };
 use tracing_subscriber::{EnvFilter, fmt, layer::SubscriberExt as _, util::SubscriberInitExt as _};
@@ -64,6 +64,20 @@ async fn load_wasm_binary(config: &KafuConfig) -> Result<Vec<u8>> {
     }
 }
 
+/// Returns the models of every node: all nodes run in this process, so a function can load any
+/// of them wherever its `KAFU_DEST` points. The first node that names a model wins.
+fn all_node_models(config: &KafuConfig) -> Vec<(String, ModelConfig)> {
+    let mut models: Vec<(String, ModelConfig)> = vec![];
+    for node_id in config.nodes.keys() {
+        for (name, model) in config.get_node_models(node_id) {
+            if !models.iter().any(|(known, _)| *known == name) {
+                models.push((name, model));
+            }
+        }
+    }
+    models
+}
+
 async fn run_service(config: &KafuConfig) -> Result<()> {
     let wasm = load_wasm_binary(config)
         .await
@@ -81,6 +95,9 @@ async fn run_service(config: &KafuConfig) -> Result<()> {
             kafu_helper: true,
             snapify: LinkerSnapifyConfig::Dummy,
         },
+        // All nodes share one engine here; use the start node's tuning.
+        engine_config: config.nodes[0].engine.clone().unwrap_or_default(),
+        models: all_node_models(config),
     };
 
     let wasm = WasmModule::new(wasm)
@@ -88,7 +105,16 @@ async fn run_service(config: &KafuConfig) -> Result<()> {
         .map_err(|e| anyhow::anyhow!("Failed to load WASM module: {}", e))?;
 
     tracing::info!("Program is starting on {}", runtime_config.node_id);
-    let mut runtime = KafuRuntimeInstance::new(Arc::new(wasm), &runtime_config)
+    let runtime_pre = Arc::new(
+        KafuRuntimePre::new(Arc::new(wasm), &runtime_config)
+            .map_err(|e| anyhow::anyhow!("Failed to link WASM module: {}", e))?,
+    );
+    // Every node is emulated in this process, so tasks run here too.
+    runtime_pre.set_cluster(Arc::new(
+        LocalCluster::new(&runtime_pre).with_config(Arc::new(config.clone())),
+    ))?;
+    let mut runtime = runtime_pre
+        .instantiate()
         .await
         .map_err(|e| anyhow::anyhow!("Failed to create runtime instance: {}", e))?;
 
@@ -96,6 +122,7 @@ async fn run_service(config: &KafuConfig) -> Result<()> {
         .start()
         .await
         .map_err(|e| anyhow::anyhow!("Failed to execute WASM module: {}", e))?;
+    runtime_pre.drop_actors().await;
 
     let store = runtime.get_store();
     tracing::info!("Program finished on {}", store.data().get_node_id());
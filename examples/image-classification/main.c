@@ -98,6 +98,7 @@ static void compute_softmax(const float *input, float *output, int size) {
 KAFU_DEST(run_inference, "edge")
 KAFU_EXPORT(run_inference)
 int run_inference(char **out_result_label) {
+  const char *MODEL_NAME = "squeezenet";
   const char *MODEL_PATH = "fixture/models/squeezenet1.1-7.onnx";
   const char *LABELS_PATH = "fixture/labels/squeezenet1.1-7.txt";
   const char *IMG_PATH = "fixture/images/dog.jpg";
@@ -107,10 +108,16 @@ int run_inference(char **out_result_label) {
   uint8_t *output_buffer = NULL;
   float *softmax_output = NULL;
 
+  // Use the model preloaded by the node (see kafu-config.yaml), or read it from the file.
   graph g;
-  wasi_nn_error err = load_graph_from_onnx_file(MODEL_PATH, &g);
-  if (err != WASI_NN_ERROR_NAME(success)) {
-    goto cleanup;
+  wasi_nn_error err = wasi_nn_load_by_name(MODEL_NAME, strlen(MODEL_NAME), &g);
+  if (err == WASI_NN_ERROR_NAME(success)) {
+    printf("Loaded preloaded graph: %s\n", MODEL_NAME);
+  } else {
+    err = load_graph_from_onnx_file(MODEL_PATH, &g);
+    if (err != WASI_NN_ERROR_NAME(success)) {
+      goto cleanup;
+    }
   }
 
   graph_execution_context exec_ctx;
@@ -5,14 +5,21 @@
 
 // Kafu Attributes for Aspect-Oriented Programming
 #pragma once
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 // The KAFU_DEST attribute.
+// Besides the `.kafu_dest.<ident>.<dest>` custom section, this defines an exported marker
+// function so the metadata survives `--gc-sections`; kafu clang restores the section from the
+// marker after linking. The marker is weak, like the region markers below, so that a KAFU_DEST
+// in a header shared by several translation units does not define it twice.
 #define KAFU_DEST(ident, dest)                                                                     \
-  __asm__(".section .custom_section..kafu_dest." #ident "." dest ",\"\",@\n");
+  __asm__(".section .custom_section..kafu_dest." #ident "." dest ",\"\",@\n");                     \
+  __attribute__((weak, used, export_name("__kafu_dest." #ident "." dest))) void                    \
+  __kafu_dest_##ident(void) {}
 
 // The KAFU_EXPORT attribute.
 // Do not attach `static` to the function to make its symbol visible to the runtime.
@@ -23,6 +30,320 @@ extern "C" {
 #define KAFU_EXPORT(ident) __attribute__((used, export_name(#ident), noinline))
 #endif
 
+// State of the node the program is currently running on.
+// The runtime writes it when the program starts, after every restore and after every migration.
+// kafu clang guards the migration points of KAFU_DEST functions with the checks of
+// kafu_should_check_entry and kafu_should_check_exit, so that the ones that cannot migrate do not
+// call into the host.
+typedef struct {
+  // Hash of the current node ID (see kafu_node_hash).
+  uint64_t node_hash;
+  // Number of KAFU_DEST calls that migrated and have not returned yet, plus the number of
+  // regions that have not ended yet.
+  // While it is zero, no function exit can migrate back.
+  uint32_t migration_depth;
+} kafu_node_state_t;
+
+// Data shared with the runtime, here and in the other Kafu headers, is defined weak so that every
+// translation unit can include the header, and `used` so that it survives `--gc-sections`.
+// kafu clang exports it with `--export-if-defined`, which makes wasm-ld export a global holding
+// its address; the runtime reads and writes it through that address.
+__attribute__((weak, used)) kafu_node_state_t __kafu_node_state;
+
+// 64-bit FNV-1a hash of a node ID. Must match the runtime's and kafu clang's implementations.
+static inline uint64_t kafu_node_hash(const char *node_id) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (; *node_id; node_id++) {
+    hash ^= (uint8_t)*node_id;
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// Returns non-zero if the program is currently running on `node_id`.
+static inline int kafu_on_node(const char *node_id) {
+  return __kafu_node_state.node_hash == kafu_node_hash(node_id);
+}
+
+// Returns non-zero if entering a function with `KAFU_DEST(..., dest)` may migrate. Always true
+// for a placement group, whose name is not a node ID.
+static inline int kafu_should_check_entry(const char *dest) { return !kafu_on_node(dest); }
+
+// Returns non-zero if a function exit may migrate back: some KAFU_DEST call has migrated and not
+// returned yet, or a region has not ended yet.
+static inline int kafu_should_check_exit(void) {
+  return __kafu_node_state.migration_depth != 0;
+}
+
+// Remote tasks (fork-join).
+// A task runs `fn(in, in_len, out, out_len)` on another node, in its own instance, while the
+// caller keeps running. The task starts from a copy of the caller's memory, so `in` and any data
+// it points to can be used as is. When the task is joined, the `out_len` bytes at `out` are
+// copied back into the caller's memory; everything else the task writes is discarded.
+typedef void (*kafu_task_fn_t)(const void *in, uint32_t in_len, void *out, uint32_t out_len);
+
+// Handle of a spawned task. 0 means the task could not be started.
+typedef int32_t kafu_task_t;
+
+__attribute__((import_module("kafu"), import_name("spawn"))) kafu_task_t
+__kafu_spawn(kafu_task_fn_t fn, const char *node, uint32_t node_len, const void *in,
+             uint32_t in_len, void *out, uint32_t out_len);
+
+__attribute__((import_module("kafu"), import_name("join"))) int32_t __kafu_join(kafu_task_t task);
+
+// Starts `fn` on `node_id`. The output region must not be touched until the task is joined.
+static inline kafu_task_t kafu_spawn(kafu_task_fn_t fn, const char *node_id, const void *in,
+                                     uint32_t in_len, void *out, uint32_t out_len) {
+  return __kafu_spawn(fn, node_id, (uint32_t)__builtin_strlen(node_id), in, in_len, out, out_len);
+}
+
+// Waits for `task` and copies its output region back. Returns 0 on success.
+// While a task is not joined, the program does not migrate: KAFU_DEST calls and regions
+// run on the current node. Tasks that are never joined are cancelled when the program ends.
+static inline int kafu_join(kafu_task_t task) { return __kafu_join(task); }
+
+// The KAFU_SPAWN macro: `kafu_task_t t = KAFU_SPAWN(fn, "node", in, in_len, out, out_len);`
+#define KAFU_SPAWN(fn, node, in, in_len, out, out_len)                                             \
+  kafu_spawn((fn), (node), (in), (in_len), (out), (out_len))
+
+// Argument-only tasks (KAFU_OFFLOAD).
+// For functions that only read `in` and only write `out`: instead of a copy of the caller's
+// memory, only the `in_len` bytes at `in` are sent, and `fn` runs in a fresh instance of the
+// program (after its constructors) on a copy of them. `fn` must not read any other caller data.
+__attribute__((import_module("kafu"), import_name("offload"))) kafu_task_t
+__kafu_offload(kafu_task_fn_t fn, const char *node, uint32_t node_len, const void *in,
+               uint32_t in_len, void *out, uint32_t out_len);
+
+// Exported so that the runtime can run the constructors of a fresh instance before an
+// argument-only task: wasm-ld runs them before any export of a command module.
+__attribute__((weak, used, export_name("__kafu_init"))) void __kafu_init(void) {}
+
+// Starts `fn` on `node_id` as an argument-only task. Join it with kafu_join.
+static inline kafu_task_t kafu_spawn_offload(kafu_task_fn_t fn, const char *node_id,
+                                             const void *in, uint32_t in_len, void *out,
+                                             uint32_t out_len) {
+  return __kafu_offload(fn, node_id, (uint32_t)__builtin_strlen(node_id), in, in_len, out,
+                        out_len);
+}
+
+// Calls `fn` on `node_id` as an argument-only task and waits for it. Returns 0 on success.
+static inline int kafu_offload(kafu_task_fn_t fn, const char *node_id, const void *in,
+                               uint32_t in_len, void *out, uint32_t out_len) {
+  kafu_task_t task = kafu_spawn_offload(fn, node_id, in, in_len, out, out_len);
+  return task == 0 ? -1 : kafu_join(task);
+}
+
+// The KAFU_OFFLOAD macro: `int err = KAFU_OFFLOAD(fn, "node", in, in_len, out, out_len);`
+#define KAFU_OFFLOAD(fn, node, in, in_len, out, out_len)                                           \
+  kafu_offload((fn), (node), (in), (in_len), (out), (out_len))
+
+// Actors (KAFU_ACTOR).
+// An actor is an instance of the program that stays alive on one node. Its methods are task
+// functions called with argument-only semantics (see KAFU_OFFLOAD), one at a time, in that
+// instance, so globals and heap objects set by one call are seen by the next. Keep state that
+// must outlive a call in globals or on the heap; static C++ objects with destructors are
+// destroyed right after the actor's constructors run.
+typedef struct {
+  // Node the actor lives on. Must stay valid while the actor is used.
+  const char *node_id;
+  // 0 if the actor could not be created.
+  uint64_t id;
+} kafu_actor_t;
+
+__attribute__((import_module("kafu"), import_name("actor_create"))) uint64_t
+__kafu_actor_create(const char *node, uint32_t node_len);
+
+__attribute__((import_module("kafu"), import_name("actor_call"))) int32_t
+__kafu_actor_call(const char *node, uint32_t node_len, uint64_t actor, kafu_task_fn_t method,
+                  const void *in, uint32_t in_len, void *out, uint32_t out_len);
+
+__attribute__((import_module("kafu"), import_name("actor_destroy"))) int32_t
+__kafu_actor_destroy(const char *node, uint32_t node_len, uint64_t actor);
+
+// Creates an actor on `node_id`. Check `.id != 0` for success.
+static inline kafu_actor_t kafu_actor_create(const char *node_id) {
+  kafu_actor_t actor;
+  actor.node_id = node_id;
+  actor.id = __kafu_actor_create(node_id, (uint32_t)__builtin_strlen(node_id));
+  return actor;
+}
+
+// Calls `method(in, in_len, out, out_len)` in `actor` and waits for it. Returns 0 on success.
+static inline int kafu_actor_call(kafu_actor_t actor, kafu_task_fn_t method, const void *in,
+                                  uint32_t in_len, void *out, uint32_t out_len) {
+  return __kafu_actor_call(actor.node_id, (uint32_t)__builtin_strlen(actor.node_id), actor.id,
+                           method, in, in_len, out, out_len);
+}
+
+// Destroys `actor` and frees its instance. Returns 0 on success. Actors that are not destroyed
+// are freed when the program finishes.
+static inline int kafu_actor_destroy(kafu_actor_t actor) {
+  return __kafu_actor_destroy(actor.node_id, (uint32_t)__builtin_strlen(actor.node_id), actor.id);
+}
+
+// The KAFU_ACTOR macro: `kafu_actor_t model = KAFU_ACTOR("cloud1");`
+#define KAFU_ACTOR(node) kafu_actor_create(node)
+
+// Regions: `KAFU_REGION_BEGIN("cloud1"); ... KAFU_REGION_END();` runs the code in between on
+// one node, migrating there once at the beginning and back once at the end. KAFU_DEST functions
+// called in the region whose destination is that node run without any migration, so a loop that
+// calls several of them migrates twice in total instead of twice per call. The node may be a
+// placement group or "any", as for KAFU_DEST. A region must end before the function that began it
+// returns; regions may nest.
+__attribute__((import_module("kafu"), import_name("region_target"))) int32_t
+__kafu_region_target(const char *node, uint32_t node_len);
+
+// Migration points of regions: the runtime migrates to the region's node on entry to
+// `__kafu_region_enter`, and back on entry to `__kafu_region_leave`. Weak, with their KAFU_DEST
+// markers written out, so that including this header from several translation units is fine.
+__attribute__((weak, used, noinline, export_name("__kafu_region_enter"))) void
+__kafu_region_enter(void) {}
+__attribute__((weak, used, export_name("__kafu_dest.__kafu_region_enter.__kafu_region_begin"))) void
+__kafu_dest___kafu_region_enter(void) {}
+__attribute__((weak, used, noinline, export_name("__kafu_region_leave"))) void
+__kafu_region_leave(void) {}
+__attribute__((weak, used, export_name("__kafu_dest.__kafu_region_leave.__kafu_region_end"))) void
+__kafu_dest___kafu_region_leave(void) {}
+
+#define KAFU_REGION_BEGIN(node)                                                                    \
+  do {                                                                                             \
+    __kafu_region_target(node, (uint32_t)__builtin_strlen(node));                                  \
+    __kafu_region_enter();                                                                         \
+  } while (0)
+
+#define KAFU_REGION_END() __kafu_region_leave()
+
+// Distributed parallel-for over a placement group.
+// The range [begin, end) is split into one contiguous shard per node of `group` (nodes with the
+// same `placement` in kafu-config.yaml, or a single node ID). Each shard runs as a task and calls
+// `body(i, ctx, out + (i - begin) * out_size)` for its indices; the shard's slice of `out` is
+// copied back when it is joined.
+typedef void (*kafu_range_body_t)(uint32_t i, const void *ctx, void *out);
+
+#define KAFU_MAX_GROUP_NODES 64
+
+__attribute__((import_module("kafu"), import_name("group_nodes"))) int32_t
+__kafu_group_nodes(const char *group, uint32_t group_len, char *buf, uint32_t buf_len);
+
+typedef struct {
+  kafu_range_body_t body;
+  const void *ctx;
+  uint32_t begin;
+  uint32_t end;
+  uint32_t out_size;
+} __kafu_shard_t;
+
+static inline void __kafu_run_shard(const void *in, uint32_t in_len, void *out, uint32_t out_len) {
+  (void)in_len;
+  (void)out_len;
+  const __kafu_shard_t *shard = (const __kafu_shard_t *)in;
+  for (uint32_t i = shard->begin; i < shard->end; i++) {
+    shard->body(i, shard->ctx, (char *)out + (uint64_t)(i - shard->begin) * shard->out_size);
+  }
+}
+
+// Returns 0 if every shard succeeded, -1 if `group` has no nodes, and 1 if a shard failed.
+static inline int kafu_parallel_for(uint32_t begin, uint32_t end, kafu_range_body_t body,
+                                    const void *ctx, void *out, uint32_t out_size,
+                                    const char *group) {
+  char names[KAFU_MAX_GROUP_NODES * 32];
+  int32_t num_nodes =
+      __kafu_group_nodes(group, (uint32_t)__builtin_strlen(group), names, sizeof(names));
+  if (num_nodes <= 0 || num_nodes > KAFU_MAX_GROUP_NODES) {
+    return -1;
+  }
+
+  __kafu_shard_t shards[KAFU_MAX_GROUP_NODES];
+  kafu_task_t tasks[KAFU_MAX_GROUP_NODES];
+  const char *node = names;
+  uint64_t count = end > begin ? end - begin : 0;
+  for (int32_t j = 0; j < num_nodes; j++) {
+    shards[j].body = body;
+    shards[j].ctx = ctx;
+    shards[j].begin = begin + (uint32_t)(count * j / num_nodes);
+    shards[j].end = begin + (uint32_t)(count * (j + 1) / num_nodes);
+    shards[j].out_size = out_size;
+    uint32_t len = (shards[j].end - shards[j].begin) * out_size;
+    tasks[j] = 0;
+    if (shards[j].begin != shards[j].end) {
+      char *shard_out = (char *)out + (uint64_t)(shards[j].begin - begin) * out_size;
+      tasks[j] = kafu_spawn(__kafu_run_shard, node, &shards[j], sizeof(shards[j]), shard_out, len);
+      if (tasks[j] == 0) {
+        __kafu_run_shard(&shards[j], sizeof(shards[j]), shard_out, len);
+      }
+    }
+    node += __builtin_strlen(node) + 1;
+  }
+
+  int failed = 0;
+  for (int32_t j = 0; j < num_nodes; j++) {
+    if (tasks[j] != 0 && kafu_join(tasks[j]) != 0) {
+      failed = 1;
+    }
+  }
+  return failed;
+}
+
+// Channels: bounded FIFO queues of messages, for streaming between code running concurrently on
+// different nodes (e.g. a task or actor consuming frames that the main program produces). A
+// channel is named and lives on its home node; every node that uses it must name the same home.
+// Receiving is cheapest on the home node, so make the consumer's node the home.
+// A full channel blocks its senders, so a fast producer cannot run ahead of its consumer.
+typedef struct {
+  const char *name;
+  // Node the channel's queue lives on. Must stay valid while the channel is used.
+  const char *home;
+} kafu_channel_t;
+
+__attribute__((import_module("kafu"), import_name("channel_open"))) int32_t
+__kafu_channel_open(const char *name, uint32_t name_len, const char *home, uint32_t home_len,
+                    uint32_t capacity);
+
+__attribute__((import_module("kafu"), import_name("channel_send"))) int32_t
+__kafu_channel_send(const char *name, uint32_t name_len, const char *home, uint32_t home_len,
+                    const void *buf, uint32_t len);
+
+__attribute__((import_module("kafu"), import_name("channel_recv"))) int32_t
+__kafu_channel_recv(const char *name, uint32_t name_len, const char *home, uint32_t home_len,
+                    void *buf, uint32_t cap);
+
+__attribute__((import_module("kafu"), import_name("channel_close"))) int32_t
+__kafu_channel_close(const char *name, uint32_t name_len, const char *home, uint32_t home_len);
+
+// Opens channel `name` on `home`, holding up to `capacity` messages. Opening a channel that
+// exists has no effect, and sending to or receiving from a channel that was never opened opens
+// it with the default capacity (16).
+static inline kafu_channel_t kafu_channel_open(const char *name, const char *home,
+                                               uint32_t capacity) {
+  kafu_channel_t channel;
+  channel.name = name;
+  channel.home = home;
+  __kafu_channel_open(name, (uint32_t)__builtin_strlen(name), home,
+                      (uint32_t)__builtin_strlen(home), capacity);
+  return channel;
+}
+
+// Sends a copy of `buf`, waiting while the channel is full. Returns 0 on success.
+static inline int kafu_channel_send(kafu_channel_t channel, const void *buf, uint32_t len) {
+  return __kafu_channel_send(channel.name, (uint32_t)__builtin_strlen(channel.name), channel.home,
+                             (uint32_t)__builtin_strlen(channel.home), buf, len);
+}
+
+// Receives the next message into `buf`, waiting while the channel is empty. Returns its length,
+// -1 once the channel is closed and drained, -2 on error, and -3 if the message is longer than
+// `cap`. Such a message stays first in the channel, to be received with a larger buffer.
+static inline int32_t kafu_channel_recv(kafu_channel_t channel, void *buf, uint32_t cap) {
+  return __kafu_channel_recv(channel.name, (uint32_t)__builtin_strlen(channel.name), channel.home,
+                             (uint32_t)__builtin_strlen(channel.home), buf, cap);
+}
+
+// Closes the channel after the messages already sent by this node. Receivers get the queued
+// messages, then -1. Returns 0 on success.
+static inline int kafu_channel_close(kafu_channel_t channel) {
+  return __kafu_channel_close(channel.name, (uint32_t)__builtin_strlen(channel.name), channel.home,
+                              (uint32_t)__builtin_strlen(channel.home));
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,373 @@
+/*
+ * Copyright (c) 2025 Raiki Tamura.
+ * SPDX-License-Identifier: MIT OR Apache-2.0 WITH LLVM-exception
+ */
+
+// C++ wrappers for the Kafu guest API
+#pragma once
+#include "kafu.h"
+#include "kafu_arena.h"
+
+#if __cplusplus >= 201703L
+#include <memory_resource>
+#include <new>
+#endif
+
+#if __cplusplus >= 202002L
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#endif
+
+namespace kafu {
+
+namespace detail {
+
+template <typename T, typename Body> struct RangeBody {
+  static void call(uint32_t i, const void *ctx, void *out) {
+    (*static_cast<const Body *>(ctx))(i, *static_cast<T *>(out));
+  }
+};
+
+#if __cplusplus >= 202002L
+// Appends to an argument payload. With a null `base`, only measures it.
+struct Writer {
+  unsigned char *base;
+  uint32_t offset;
+
+  void align(uint32_t alignment) { offset = (offset + alignment - 1) & ~(alignment - 1); }
+  void put(const void *src, uint32_t len) {
+    if (base != nullptr && len != 0) {
+      std::memcpy(base + offset, src, len);
+    }
+    offset += len;
+  }
+};
+
+struct Reader {
+  const unsigned char *base;
+  uint32_t offset;
+
+  void align(uint32_t alignment) { offset = (offset + alignment - 1) & ~(alignment - 1); }
+  const unsigned char *take(uint32_t len) {
+    const unsigned char *p = base + offset;
+    offset += len;
+    return p;
+  }
+};
+
+// Serializer of one argument type. Arguments are laid out back to back, each aligned to its
+// type, relative to the (16-byte aligned) start of the payload.
+template <typename T> struct Codec {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "kafu::remote arguments must be trivially copyable, spans or vectors");
+  static_assert(!std::is_pointer_v<T>, "pointers are not valid on another node; pass a span");
+
+  static void write(Writer &w, const T &value) {
+    w.align(alignof(T));
+    w.put(&value, sizeof(T));
+  }
+  static T read(Reader &r) {
+    r.align(alignof(T));
+    T value;
+    std::memcpy(&value, r.take(sizeof(T)), sizeof(T));
+    return value;
+  }
+};
+
+// Elements are stored inline after their count.
+template <typename T> struct SequenceCodec {
+  static_assert(std::is_trivially_copyable_v<T>, "elements must be trivially copyable");
+
+  static void write(Writer &w, const T *data, size_t size) {
+    uint32_t count = static_cast<uint32_t>(size);
+    Codec<uint32_t>::write(w, count);
+    w.align(alignof(T));
+    w.put(data, count * static_cast<uint32_t>(sizeof(T)));
+  }
+  static std::span<const T> read(Reader &r) {
+    uint32_t count = Codec<uint32_t>::read(r);
+    r.align(alignof(T));
+    const T *data = reinterpret_cast<const T *>(r.take(count * static_cast<uint32_t>(sizeof(T))));
+    return {data, count};
+  }
+};
+
+// Spans are read-only: the callee sees the elements in place, in the received payload.
+template <typename T, size_t Extent> struct Codec<std::span<T, Extent>> {
+  using Element = std::remove_const_t<T>;
+
+  static void write(Writer &w, std::span<T, Extent> value) {
+    SequenceCodec<Element>::write(w, value.data(), value.size());
+  }
+  static std::span<T, Extent> read(Reader &r) {
+    std::span<const Element> elements = SequenceCodec<Element>::read(r);
+    return std::span<T, Extent>(const_cast<T *>(elements.data()), elements.size());
+  }
+};
+
+template <typename T, typename Allocator> struct Codec<std::vector<T, Allocator>> {
+  static void write(Writer &w, const std::vector<T, Allocator> &value) {
+    SequenceCodec<T>::write(w, value.data(), value.size());
+  }
+  static std::vector<T, Allocator> read(Reader &r) {
+    std::span<const T> elements = SequenceCodec<T>::read(r);
+    return std::vector<T, Allocator>(elements.begin(), elements.end());
+  }
+};
+
+template <typename Param> using Decoded = std::remove_cvref_t<Param>;
+
+// Function pointers are table indices, which are the same in every instance of the program.
+template <typename R, typename... Params> struct Codec<R (*)(Params...)> {
+  static void write_function(Writer &w, R (*fn)(Params...)) {
+    w.align(alignof(decltype(fn)));
+    w.put(&fn, sizeof(fn));
+  }
+  static auto read_function(Reader &r) {
+    r.align(alignof(R (*)(Params...)));
+    R (*fn)(Params...);
+    std::memcpy(&fn, r.take(sizeof(fn)), sizeof(fn));
+    return fn;
+  }
+};
+
+// Task function of a remote call: the payload starts with the function pointer, followed by
+// the arguments; the result is written to `out`.
+template <typename R, typename... Params>
+void invoke_remote(const void *in, uint32_t in_len, void *out, uint32_t out_len) {
+  (void)in_len;
+  (void)out_len;
+  Reader r{static_cast<const unsigned char *>(in), 0};
+  auto fn = Codec<R (*)(Params...)>::read_function(r);
+  // Braced initialization evaluates the reads from left to right.
+  std::tuple<Decoded<Params>...> args{Codec<Decoded<Params>>::read(r)...};
+  if constexpr (std::is_void_v<R>) {
+    std::apply(fn, std::move(args));
+  } else {
+    R result = std::apply(fn, std::move(args));
+    std::memcpy(out, &result, sizeof(R));
+  }
+}
+
+// Encodes a call into `base` (or only measures it if `base` is null) and returns its size.
+// Arguments are converted to the parameter types here, so no copies are kept.
+template <typename R, typename... Params, typename... Args>
+uint32_t encode_call(unsigned char *base, R (*fn)(Params...), const Args &...args) {
+  Writer w{base, 0};
+  Codec<R (*)(Params...)>::write_function(w, fn);
+  (Codec<Decoded<Params>>::write(w, args), ...);
+  return w.offset;
+}
+
+template <typename R> constexpr uint32_t result_size() {
+  if constexpr (std::is_void_v<R>) {
+    return 0;
+  } else {
+    return sizeof(R);
+  }
+}
+
+// Alignment of encoded payloads, enough for any argument type.
+inline constexpr size_t payload_align = 128;
+// Payloads up to this size are encoded on the stack; larger ones go to the heap, since the
+// shadow stack is only 64 KiB.
+inline constexpr uint32_t max_stack_payload = 256;
+
+// Encodes `fn(args...)` and hands it to `send(task, in, in_len, out, out_len)`, which runs it
+// somewhere and writes the result to `result`. Returns what `send` returns, or -1 if the
+// payload could not be allocated.
+template <typename Send, typename R, typename... Params, typename... Args>
+int send_call(const Send &send, void *result, R (*fn)(Params...), const Args &...args) {
+  static_assert(sizeof...(Params) == sizeof...(Args), "wrong number of arguments");
+  static_assert(std::is_void_v<R> || std::is_trivially_copyable_v<R>,
+                "results of remote calls must be trivially copyable");
+  uint32_t len = encode_call(nullptr, fn, args...);
+  alignas(payload_align) unsigned char local[max_stack_payload];
+  std::unique_ptr<unsigned char, decltype(&std::free)> heap(nullptr, &std::free);
+  unsigned char *payload = local;
+  if (len > max_stack_payload) {
+    size_t size = (size_t(len) + payload_align - 1) / payload_align * payload_align;
+    heap.reset(static_cast<unsigned char *>(std::aligned_alloc(payload_align, size)));
+    if (!heap) {
+      return -1;
+    }
+    payload = heap.get();
+  }
+  encode_call(payload, fn, args...);
+  return send(&invoke_remote<R, Params...>, payload, len, result, result_size<R>());
+}
+
+template <size_t N> struct NodeName {
+  char value[N];
+  constexpr NodeName(const char (&name)[N]) {
+    for (size_t i = 0; i < N; i++) {
+      value[i] = name[i];
+    }
+  }
+};
+#endif
+
+} // namespace detail
+
+// Runs `body(i, out[i - begin])` for every i in [begin, end), split across the nodes of
+// `group` (see kafu_parallel_for). `body` may capture by reference: each shard starts from a
+// copy of the caller's memory. Only the elements of `out` are sent back.
+//
+//   kafu::parallel_for(0, n, labels, "edge", [&](uint32_t i, int &label) {
+//     label = classify(frames[i]);
+//   });
+template <typename T, typename Body>
+int parallel_for(uint32_t begin, uint32_t end, T *out, const char *group, const Body &body) {
+  return kafu_parallel_for(begin, end, &detail::RangeBody<T, Body>::call, &body, out, sizeof(T),
+                           group);
+}
+
+// Runs the rest of the enclosing scope on `node` (see KAFU_REGION_BEGIN): migrates there on
+// construction and back on destruction.
+//
+//   {
+//     kafu::stay_on cloud("cloud1");
+//     for (int i = 0; i < n; i++) {
+//       f(i);
+//       g(i);
+//     }
+//   }
+class stay_on {
+public:
+  explicit stay_on(const char *node) { KAFU_REGION_BEGIN(node); }
+  ~stay_on() { KAFU_REGION_END(); }
+  stay_on(const stay_on &) = delete;
+  stay_on &operator=(const stay_on &) = delete;
+};
+
+#if __cplusplus >= 201703L
+// A std::pmr memory resource backed by a kafu_arena_t (see kafu_arena.h). Deallocation is a
+// no-op; memory is returned all at once by reset() or the destructor.
+//
+//   kafu::arena_resource frame_arena;
+//   while (capture(frame)) {
+//     frame_arena.reset();
+//     std::pmr::vector<Box> boxes(&frame_arena);
+//     detect(frame, boxes);
+//   }
+//
+//   kafu::arena_resource hot(&kafu_hot_arena);
+//   std::pmr::unordered_map<int, Track> tracks(&hot);
+class arena_resource : public std::pmr::memory_resource {
+public:
+  // Owns a new arena with the given KAFU_ARENA_* flags.
+  explicit arena_resource(uint32_t flags = 0) : owned_{nullptr, 0, flags, 0}, arena_(&owned_) {}
+  // Allocates from `arena`, e.g. &kafu_hot_arena, which outlives the resource.
+  explicit arena_resource(kafu_arena_t *arena) : owned_{nullptr, 0, 0, 0}, arena_(arena) {}
+  ~arena_resource() override { kafu_arena_destroy(&owned_); }
+  arena_resource(const arena_resource &) = delete;
+  arena_resource &operator=(const arena_resource &) = delete;
+
+  // Frees everything allocated from the arena (see kafu_arena_reset).
+  void reset() { kafu_arena_reset(arena_); }
+
+  kafu_arena_t *arena() { return arena_; }
+
+private:
+  void *do_allocate(size_t bytes, size_t alignment) override {
+    void *p = kafu_arena_alloc(arena_, bytes, alignment);
+    if (p == nullptr) {
+#if __cpp_exceptions
+      throw std::bad_alloc();
+#else
+      __builtin_trap();
+#endif
+    }
+    return p;
+  }
+  void do_deallocate(void *, size_t, size_t) override {}
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+    return this == &other;
+  }
+
+  kafu_arena_t owned_;
+  kafu_arena_t *arena_;
+};
+#endif
+
+#if __cplusplus >= 202002L
+// Calls `fn(args...)` on `Node` as an argument-only task (see KAFU_OFFLOAD) and returns its
+// result. Only the arguments and the result cross the network: trivially copyable values,
+// `std::span`s (read-only on the callee) and `std::vector`s of trivially copyable elements.
+// The result must be trivially copyable. If the remote call fails, `fn` runs on the calling
+// node instead.
+//
+//   int label = kafu::remote<"cloud1">(classify, std::span<const uint8_t>(image, image_len));
+template <detail::NodeName Node, typename R, typename... Params, typename... Args>
+R remote(R (*fn)(Params...), Args &&...args) {
+  auto send = [](kafu_task_fn_t task, const void *in, uint32_t in_len, void *out,
+                 uint32_t out_len) {
+    return kafu_offload(task, Node.value, in, in_len, out, out_len);
+  };
+  if constexpr (std::is_void_v<R>) {
+    if (detail::send_call(send, nullptr, fn, args...) != 0) {
+      fn(std::forward<Args>(args)...);
+    }
+  } else {
+    R result;
+    if (detail::send_call(send, &result, fn, args...) != 0) {
+      result = fn(std::forward<Args>(args)...);
+    }
+    return result;
+  }
+}
+
+// An actor (see KAFU_ACTOR) with typed method calls. Methods are plain functions that keep
+// their state in globals or on the heap of the actor's instance; arguments and results follow
+// the rules of kafu::remote.
+//
+//   kafu::actor model("cloud1");
+//   model.call(load_model, std::span<const char>(path, path_len));
+//   std::optional<int> label = model.call(classify, std::span<const uint8_t>(image, image_len));
+class actor {
+public:
+  explicit actor(const char *node_id) : handle_(kafu_actor_create(node_id)) {}
+  ~actor() {
+    if (valid()) {
+      kafu_actor_destroy(handle_);
+    }
+  }
+  actor(const actor &) = delete;
+  actor &operator=(const actor &) = delete;
+  actor(actor &&other) noexcept : handle_(other.handle_) { other.handle_.id = 0; }
+
+  bool valid() const { return handle_.id != 0; }
+
+  // Calls `method(args...)` in the actor. Returns the result, or std::nullopt if the call
+  // failed; void methods return whether the call succeeded.
+  template <typename R, typename... Params, typename... Args>
+  auto call(R (*method)(Params...), const Args &...args) {
+    auto send = [this](kafu_task_fn_t task, const void *in, uint32_t in_len, void *out,
+                       uint32_t out_len) {
+      return kafu_actor_call(handle_, task, in, in_len, out, out_len);
+    };
+    if constexpr (std::is_void_v<R>) {
+      return detail::send_call(send, nullptr, method, args...) == 0;
+    } else {
+      R result;
+      if (detail::send_call(send, &result, method, args...) != 0) {
+        return std::optional<R>();
+      }
+      return std::optional<R>(result);
+    }
+  }
+
+private:
+  kafu_actor_t handle_;
+};
+#endif
+
+} // namespace kafu
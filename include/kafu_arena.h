@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2025 Raiki Tamura.
+ * SPDX-License-Identifier: MIT OR Apache-2.0 WITH LLVM-exception
+ */
+
+// Kafu Arena Allocator
+// Delta migrations resend every 64KB page that changed since the previous hop. malloc spreads
+// small objects (and its own bookkeeping) over many pages, so a few small writes dirty many of
+// them. An arena hands out memory from whole pages of its own, so data with the same lifetime
+// and write pattern shares few pages:
+// - kafu_long_lived_arena: data written once, such as model weights or lookup tables. Its pages
+//   are sent on the first hop and match the destination's copy on later ones.
+// - kafu_hot_arena: small state mutated between hops, packed into as few pages as possible.
+// - Per-iteration arenas, emptied with kafu_arena_reset at the end of each iteration.
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "kafu_memory.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Arenas allocate whole Wasm pages.
+#define KAFU_ARENA_PAGE_SIZE 65536
+
+// Flag of arenas whose data is never live at a migration point, such as per-iteration buffers:
+// their pages are scratch memory (see kafu_mark_scratch), which migrations do not carry.
+#define KAFU_ARENA_SCRATCH 1u
+
+typedef struct __kafu_arena_chunk {
+  // The previous chunk of the arena, or NULL.
+  struct __kafu_arena_chunk *next;
+  // Size of the chunk in bytes, including this header.
+  size_t size;
+} __kafu_arena_chunk_t;
+
+typedef struct {
+  // The chunk allocations are served from, or NULL.
+  __kafu_arena_chunk_t *chunk;
+  // Bytes used in `chunk`, including its header.
+  size_t used;
+  uint32_t flags;
+  // 1 + the index of the free span (see kafu_free_span_reserve) that holds the unused end of
+  // `chunk`, or 0 if none is reserved yet.
+  int32_t free_span;
+} kafu_arena_t;
+
+// Initializer of an empty arena: `kafu_arena_t frame_arena = KAFU_ARENA_INIT(0);`
+#define KAFU_ARENA_INIT(flags) {NULL, 0, (flags), 0}
+
+// Weak, like the data in kafu.h, so that every translation unit can include this header.
+__attribute__((weak)) kafu_arena_t kafu_long_lived_arena = KAFU_ARENA_INIT(0);
+__attribute__((weak)) kafu_arena_t kafu_hot_arena = KAFU_ARENA_INIT(0);
+
+// Publishes the unused end of the current chunk as a free span, so that snapshots skip it.
+static inline void __kafu_arena_publish(kafu_arena_t *arena) {
+  if (arena->free_span == 0) {
+    arena->free_span = kafu_free_span_reserve() + 1;
+    if (arena->free_span == 0) {
+      return;
+    }
+  }
+  __kafu_arena_chunk_t *chunk = arena->chunk;
+  kafu_free_span_set(arena->free_span - 1, (char *)chunk + arena->used, chunk->size - arena->used);
+}
+
+// Returns `size` bytes aligned to `align` (a power of two, at most KAFU_ARENA_PAGE_SIZE), or
+// NULL if out of memory. The memory is uninitialized and stays allocated until the arena is
+// reset or destroyed; there is no per-object free.
+static inline void *kafu_arena_alloc(kafu_arena_t *arena, size_t size, size_t align) {
+  __kafu_arena_chunk_t *chunk = arena->chunk;
+  if (chunk != NULL) {
+    size_t offset = (arena->used + align - 1) & ~(align - 1);
+    if (offset <= chunk->size && size <= chunk->size - offset) {
+      arena->used = offset + size;
+      __kafu_arena_publish(arena);
+      return (char *)chunk + offset;
+    }
+  }
+
+  // Chunks are whole pages, page-aligned, so they share no page with other data.
+  size_t header = (sizeof(__kafu_arena_chunk_t) + align - 1) & ~(align - 1);
+  if (size > SIZE_MAX - header - KAFU_ARENA_PAGE_SIZE) {
+    return NULL;
+  }
+  size_t chunk_size =
+      (header + size + KAFU_ARENA_PAGE_SIZE - 1) & ~(size_t)(KAFU_ARENA_PAGE_SIZE - 1);
+  __kafu_arena_chunk_t *fresh =
+      (__kafu_arena_chunk_t *)aligned_alloc(KAFU_ARENA_PAGE_SIZE, chunk_size);
+  if (fresh == NULL) {
+    return NULL;
+  }
+  fresh->next = chunk;
+  fresh->size = chunk_size;
+  if (arena->flags & KAFU_ARENA_SCRATCH) {
+    // The header stays in snapshots: the arena must still find its chunks after a migration.
+    kafu_mark_scratch(fresh + 1, chunk_size - sizeof(*fresh));
+  }
+  arena->chunk = fresh;
+  arena->used = header + size;
+  __kafu_arena_publish(arena);
+  return (char *)fresh + header;
+}
+
+static inline void __kafu_arena_free_chunk(kafu_arena_t *arena, __kafu_arena_chunk_t *chunk) {
+  if (arena->flags & KAFU_ARENA_SCRATCH) {
+    kafu_unmark_scratch(chunk + 1, chunk->size - sizeof(*chunk));
+  }
+  free(chunk);
+}
+
+// Frees everything allocated from `arena` at once. The current chunk is kept for the next
+// allocations, so an arena reset at the end of every iteration keeps reusing the same pages.
+static inline void kafu_arena_reset(kafu_arena_t *arena) {
+  __kafu_arena_chunk_t *chunk = arena->chunk;
+  if (chunk == NULL) {
+    return;
+  }
+  while (chunk->next != NULL) {
+    __kafu_arena_chunk_t *next = chunk->next->next;
+    __kafu_arena_free_chunk(arena, chunk->next);
+    chunk->next = next;
+  }
+  arena->used = sizeof(*chunk);
+  __kafu_arena_publish(arena);
+}
+
+// Frees everything allocated from `arena`, and its pages. The arena can be used again.
+static inline void kafu_arena_destroy(kafu_arena_t *arena) {
+  while (arena->chunk != NULL) {
+    __kafu_arena_chunk_t *next = arena->chunk->next;
+    __kafu_arena_free_chunk(arena, arena->chunk);
+    arena->chunk = next;
+  }
+  arena->used = 0;
+  if (arena->free_span != 0) {
+    kafu_free_span_release(arena->free_span - 1);
+    arena->free_span = 0;
+  }
+}
+
+// The KAFU_ARENA_NEW macro: `struct stats *s = KAFU_ARENA_NEW(&kafu_hot_arena, struct stats);`
+#define KAFU_ARENA_NEW(arena, type)                                                                \
+  ((type *)kafu_arena_alloc((arena), sizeof(type), __alignof__(type)))
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2025 Raiki Tamura.
+ * SPDX-License-Identifier: MIT OR Apache-2.0 WITH LLVM-exception
+ */
+
+// Kafu Blob API
+// Keeps large read-only data (model weights, label tables, ...) on the host instead of in linear
+// memory, so that migrations do not carry it. A blob is identified by the SHA-256 digest of its
+// contents. The program keeps only the digest, and copies the parts of the blob it needs into its
+// memory. A node that does not hold a blob fetches it from the other nodes on first use, once.
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+  // SHA-256 digest of the contents of the blob.
+  uint8_t digest[32];
+} kafu_blob_t;
+
+__attribute__((import_module("kafu"), import_name("blob_put"))) int32_t
+__kafu_blob_put(const void *buf, uint32_t len, kafu_blob_t *blob);
+
+__attribute__((import_module("kafu"), import_name("blob_load"))) int32_t
+__kafu_blob_load(const char *path, uint32_t path_len, kafu_blob_t *blob);
+
+__attribute__((import_module("kafu"), import_name("blob_size"))) int64_t
+__kafu_blob_size(const kafu_blob_t *blob);
+
+__attribute__((import_module("kafu"), import_name("blob_read"))) int64_t
+__kafu_blob_read(const kafu_blob_t *blob, uint64_t offset, void *buf, uint32_t len);
+
+// Copies `len` bytes at `buf` into a blob and sets `*blob` to it. The buffer can be freed
+// afterwards. Returns 0 on success.
+static inline int kafu_blob_put(const void *buf, size_t len, kafu_blob_t *blob) {
+  return __kafu_blob_put(buf, (uint32_t)len, blob);
+}
+
+// Reads the file at `path` into a blob and sets `*blob` to it. `path` is resolved like a WASI
+// path, inside the preopened directory, and cannot leave it. The host reads the file directly,
+// so it never enters linear memory. Returns 0 on success.
+static inline int kafu_blob_load(const char *path, kafu_blob_t *blob) {
+  return __kafu_blob_load(path, (uint32_t)strlen(path), blob);
+}
+
+// Returns the size of the blob in bytes, or -1 if no node holds it.
+static inline int64_t kafu_blob_size(const kafu_blob_t *blob) { return __kafu_blob_size(blob); }
+
+// Copies up to `len` bytes of the blob, starting at `offset`, into `buf`. Returns the number of
+// bytes copied, which is less than `len` only at the end of the blob, or -1 on error.
+static inline int64_t kafu_blob_read(const kafu_blob_t *blob, uint64_t offset, void *buf,
+                                     size_t len) {
+  return __kafu_blob_read(blob, offset, buf, (uint32_t)len);
+}
+
+#ifdef __cplusplus
+}
+#endif
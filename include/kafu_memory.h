@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2025 Raiki Tamura.
+ * SPDX-License-Identifier: MIT OR Apache-2.0 WITH LLVM-exception
+ */
+
+// Kafu Scratch Memory API
+// Keeps dead buffers (decoded images, intermediate tensors, ...) out of migration snapshots.
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+__attribute__((import_module("kafu"), import_name("mark_scratch"))) int32_t
+__kafu_mark_scratch(const void *ptr, uint32_t len);
+
+__attribute__((import_module("kafu"), import_name("unmark_scratch"))) int32_t
+__kafu_unmark_scratch(const void *ptr, uint32_t len);
+
+__attribute__((import_module("kafu"), import_name("discard"))) int32_t
+__kafu_discard(void *ptr, uint32_t len);
+
+// Marks `len` bytes at `ptr` as scratch: their contents are not carried by migrations, and
+// read as zero on the destination. The range stays marked, on whichever node the program runs,
+// until it is unmarked. Mark buffers that are rewritten before each use, and never hold live
+// data at a migration point. Returns 0 on success.
+static inline int kafu_mark_scratch(const void *ptr, size_t len) {
+  return __kafu_mark_scratch(ptr, (uint32_t)len);
+}
+
+// Unmarks `len` bytes at `ptr`, e.g. before the buffer is freed. Returns 0 on success.
+static inline int kafu_unmark_scratch(const void *ptr, size_t len) {
+  return __kafu_unmark_scratch(ptr, (uint32_t)len);
+}
+
+// Discards the contents of `len` bytes at `ptr`, which then read as zero. Zeroed pages are
+// skipped by delta transfers when the destination already has them zeroed, and compress to
+// almost nothing otherwise; call this on large buffers before freeing them. Returns 0 on success.
+static inline int kafu_discard(void *ptr, size_t len) { return __kafu_discard(ptr, (uint32_t)len); }
+
+// Free spans: an allocator publishes the parts of its heap that hold no live data in this table,
+// and snapshots treat them like scratch memory. The runtime reads the table at every checkpoint,
+// without calling into the guest, so the allocator keeps it up to date as it allocates and frees.
+#define KAFU_MAX_FREE_SPANS 256
+
+typedef struct {
+  // UINT32_MAX if the span was released.
+  uint32_t offset;
+  // 0 if the span is empty.
+  uint32_t len;
+} kafu_span_t;
+
+typedef struct {
+  // Number of reserved spans.
+  uint32_t count;
+  kafu_span_t spans[KAFU_MAX_FREE_SPANS];
+} kafu_free_spans_t;
+
+// Shared with the runtime like __kafu_node_state (see kafu.h).
+__attribute__((weak, used)) kafu_free_spans_t __kafu_free_spans;
+
+// Reserves an empty span of the table and returns its index, or -1 if the table is full.
+static inline int32_t kafu_free_span_reserve(void) {
+  kafu_free_spans_t *table = &__kafu_free_spans;
+  for (uint32_t i = 0; i < table->count; i++) {
+    if (table->spans[i].offset == UINT32_MAX) {
+      table->spans[i].offset = 0;
+      return (int32_t)i;
+    }
+  }
+  if (table->count >= KAFU_MAX_FREE_SPANS) {
+    return -1;
+  }
+  return (int32_t)table->count++;
+}
+
+// Sets span `index` to the `len` free bytes at `ptr`, or clears it if `len` is 0. The bytes must
+// not hold live data until the span is changed.
+static inline void kafu_free_span_set(int32_t index, const void *ptr, size_t len) {
+  __kafu_free_spans.spans[index].offset = (uint32_t)(uintptr_t)ptr;
+  __kafu_free_spans.spans[index].len = (uint32_t)len;
+}
+
+// Releases span `index` for a later kafu_free_span_reserve.
+static inline void kafu_free_span_release(int32_t index) {
+  __kafu_free_spans.spans[index].offset = UINT32_MAX;
+  __kafu_free_spans.spans[index].len = 0;
+}
+
+#ifdef __cplusplus
+}
+#endif